@@ -1,18 +1,45 @@
 #include "ata.h"
+#include "pci.h"
 #include "../kernel/logger.h"
 #include "../mm/memory.h"
 #include "../cpu/ports.h"
+#include "../cpu/irq.h"
 #include <string.h>
 
 typedef struct {
     uint16_t io_base;
     uint16_t ctrl_base;
     uint8_t drive;
+    uint8_t channel;
     uint32_t sectors;
+    uint16_t multiple_sectors;
+    int dma_capable;
     int exists;
 } ata_device_t;
 
+typedef struct {
+    uint32_t phys_addr;
+    uint16_t byte_count;
+    uint16_t flags;
+} __attribute__((packed)) ata_prd_t;
+
+typedef struct {
+    uint16_t io_base;
+    uint16_t bmide_base;
+    int dma_enabled;
+    volatile int irq_fired;
+    ata_prd_t* prd;
+    ata_device_t* volatile active;
+    uint32_t active_lba;
+    int active_write;
+    ata_done_t done;
+} ata_channel_t;
+
 static ata_device_t ata_devices[4] = {0};
+static ata_channel_t ata_channels[2] = {0};
+
+// Aligned to its own size so a table never straddles a 64 KiB boundary
+static ata_prd_t ata_prd_tables[2][ATA_PRD_MAX] __attribute__((aligned(ATA_PRD_MAX * 8)));
 
 static int ata_wait_bsy(uint16_t io_base) {
     int timeout = 500000;
@@ -36,6 +63,384 @@ static void ata_delay(uint16_t io_base) {
     }
 }
 
+static int ata_set_multiple_mode(ata_device_t* dev, uint16_t sectors) {
+    outb(dev->io_base + ATA_REG_HDDEVSEL, dev->drive);
+    ata_delay(dev->io_base);
+
+    outb(dev->io_base + ATA_REG_SECCOUNT0, sectors & 0xFF);
+    outb(dev->io_base + ATA_REG_COMMAND, ATA_CMD_SET_MULTIPLE);
+
+    if (ata_wait_bsy(dev->io_base) != 0 || (inb(dev->io_base + ATA_REG_STATUS) & ATA_STATUS_ERR)) {
+        log(LOG_WARNING, "ATA drive rejected SET MULTIPLE MODE (%d sectors)", sectors);
+        return -1;
+    }
+
+    dev->multiple_sectors = sectors;
+    return 0;
+}
+
+// Programs the task file for one command covering up to ATA_MAX_SECTORS_PER_CMD sectors
+static void ata_issue_command(ata_device_t* dev, uint32_t lba, uint32_t count, uint8_t command) {
+    outb(dev->io_base + ATA_REG_HDDEVSEL, dev->drive | 0x40 | ((lba >> 24) & 0x0F));
+    ata_delay(dev->io_base);
+
+    outb(dev->io_base + ATA_REG_FEATURES, 0);
+    outb(dev->io_base + ATA_REG_SECCOUNT0, count == ATA_MAX_SECTORS_PER_CMD ? 0 : count);
+    outb(dev->io_base + ATA_REG_LBA0, lba & 0xFF);
+    outb(dev->io_base + ATA_REG_LBA1, (lba >> 8) & 0xFF);
+    outb(dev->io_base + ATA_REG_LBA2, (lba >> 16) & 0xFF);
+    outb(dev->io_base + ATA_REG_COMMAND, command);
+}
+
+// Waits until the drive is ready to move the next DRQ data block
+static int ata_wait_data(ata_device_t* dev, uint32_t lba, const char* op) {
+    if (ata_wait_bsy(dev->io_base) != 0) {
+        log(LOG_ERROR, "ATA %s timeout waiting for BSY clear (sector %d)", op, lba);
+        return -1;
+    }
+
+    if (inb(dev->io_base + ATA_REG_STATUS) & ATA_STATUS_ERR) {
+        log(LOG_ERROR, "ATA %s error for sector %d", op, lba);
+        return -1;
+    }
+
+    if (ata_wait_drq(dev->io_base) != 0) {
+        log(LOG_ERROR, "ATA %s timeout waiting for DRQ (sector %d)", op, lba);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int ata_interrupts_enabled(void) {
+    uint32_t flags;
+    __asm__ __volatile__("pushf; pop %0" : "=r"(flags));
+    return (flags & 0x200) != 0;
+}
+
+static uint32_t ata_irq_save(void) {
+    uint32_t flags;
+    __asm__ __volatile__("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void ata_irq_restore(uint32_t flags) {
+    if (flags & 0x200) {
+        __asm__ __volatile__("sti" : : : "memory");
+    }
+}
+
+// Stops the bus-master engine and checks how the transfer that just ended went
+static int ata_dma_finish(ata_channel_t* ch) {
+    ata_device_t* dev = ch->active;
+    uint8_t direction = ch->active_write ? 0 : ATA_BM_CMD_READ;
+    const char* op = ch->active_write ? "write" : "read";
+
+    outb(ch->bmide_base + ATA_BM_COMMAND, direction);
+    uint8_t bm_status = inb(ch->bmide_base + ATA_BM_STATUS);
+    outb(ch->bmide_base + ATA_BM_STATUS, bm_status | ATA_BM_STATUS_IRQ | ATA_BM_STATUS_ERR);
+    ch->active = NULL;
+
+    if (ata_wait_bsy(dev->io_base) != 0 || (bm_status & ATA_BM_STATUS_ERR) ||
+        (inb(dev->io_base + ATA_REG_STATUS) & ATA_STATUS_ERR)) {
+        log(LOG_ERROR, "ATA DMA %s error (sector %d)", op, ch->active_lba);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Ends an asynchronous transfer and hands the result to its owner. Called with interrupts off.
+static void ata_dma_complete(ata_channel_t* ch) {
+    ata_done_t done = ch->done;
+    ch->done = NULL;
+
+    int status = ata_dma_finish(ch);
+    if (done) {
+        done(ch - ata_channels, status);
+    }
+}
+
+static void ata_irq_handler(registers_t* regs) {
+    ata_channel_t* ch = &ata_channels[regs->int_no == IRQ15 ? 1 : 0];
+
+    if (ch->dma_enabled && (inb(ch->bmide_base + ATA_BM_STATUS) & ATA_BM_STATUS_IRQ)) {
+        if (ch->active && ch->done) {
+            ata_dma_complete(ch);
+            return;
+        }
+        ch->irq_fired = 1;
+    }
+
+    // Reading the status register acknowledges INTRQ on the drive
+    inb(ch->io_base + ATA_REG_STATUS);
+}
+
+static void ata_dma_init(void) {
+    pci_device_t ide;
+    if (pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &ide) != 0) {
+        log(LOG_LOG, "No PCI IDE controller found, ATA stays in PIO mode");
+        return;
+    }
+
+    if (!(ide.prog_if & 0x80)) {
+        log(LOG_LOG, "IDE controller %x:%x has no bus-master support, ATA stays in PIO mode",
+            ide.vendor_id, ide.device_id);
+        return;
+    }
+
+    uint32_t bar4 = pci_config_read(ide.bus, ide.slot, ide.func, PCI_REG_BAR4);
+    if (!(bar4 & 1)) {
+        log(LOG_WARNING, "IDE bus-master registers are not in I/O space, ATA stays in PIO mode");
+        return;
+    }
+    uint16_t bmide = bar4 & 0xFFFC;
+
+    uint32_t command = pci_config_read(ide.bus, ide.slot, ide.func, PCI_REG_COMMAND) & 0xFFFF;
+    pci_config_write(ide.bus, ide.slot, ide.func, PCI_REG_COMMAND,
+                     command | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    for (int i = 0; i < 2; i++) {
+        // Channels in PCI native mode don't use the legacy ports or IRQ14/15
+        if (ide.prog_if & (i == 0 ? 0x01 : 0x04)) {
+            continue;
+        }
+
+        ata_channels[i].io_base = i == 0 ? ATA_PRIMARY_IO : ATA_SECONDARY_IO;
+        ata_channels[i].bmide_base = bmide + i * 8;
+        ata_channels[i].prd = ata_prd_tables[i];
+        ata_channels[i].irq_fired = 0;
+        ata_channels[i].dma_enabled = 1;
+    }
+
+    register_interrupt_handler(IRQ14, ata_irq_handler);
+    register_interrupt_handler(IRQ15, ata_irq_handler);
+
+    log(LOG_OK, "ATA bus-master DMA enabled (controller %x:%x, BMIDE 0x%x)",
+        ide.vendor_id, ide.device_id, bmide);
+}
+
+// Describes the segments as a PRD table. Entries may not cross a 64 KiB boundary;
+// segments that happen to be adjacent in memory share an entry.
+static int ata_dma_build_prd(ata_channel_t* ch, const ata_segment_t* segs, int seg_count) {
+    int entries = 0;
+    uint32_t prev_end = 0;
+
+    for (int i = 0; i < seg_count; i++) {
+        uint32_t addr = (uint32_t)(uintptr_t)segs[i].buffer;
+        uint32_t bytes = segs[i].sectors * ATA_SECTOR_SIZE;
+
+        while (bytes > 0) {
+            uint32_t len = 0x10000 - (addr & 0xFFFF);
+            if (len > bytes) {
+                len = bytes;
+            }
+
+            if (entries > 0 && addr == prev_end && (addr & 0xFFFF) != 0) {
+                ch->prd[entries - 1].byte_count += len;
+            } else {
+                if (entries >= ATA_PRD_MAX) {
+                    return -1;
+                }
+                ch->prd[entries].phys_addr = addr;
+                ch->prd[entries].byte_count = len & 0xFFFF;
+                ch->prd[entries].flags = 0;
+                entries++;
+            }
+
+            addr += len;
+            bytes -= len;
+            prev_end = addr;
+        }
+    }
+
+    ch->prd[entries - 1].flags = ATA_PRD_EOT;
+    return 0;
+}
+
+static int ata_dma_usable(ata_device_t* dev, const uint8_t* buffer) {
+    return dev->dma_capable && ata_channels[dev->channel].dma_enabled && !((uintptr_t)buffer & 1);
+}
+
+static int ata_dma_segments_usable(ata_device_t* dev, const ata_segment_t* segs, int seg_count) {
+    for (int i = 0; i < seg_count; i++) {
+        if (!ata_dma_usable(dev, segs[i].buffer)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Programs the controller and starts one READ/WRITE DMA command. Fails without touching
+// the hardware when the segments don't fit the PRD table.
+static int ata_dma_start(ata_device_t* dev, uint32_t lba, uint32_t count,
+                         const ata_segment_t* segs, int seg_count, int write, ata_done_t done) {
+    ata_channel_t* ch = &ata_channels[dev->channel];
+    uint8_t direction = write ? 0 : ATA_BM_CMD_READ;
+
+    if (ata_dma_build_prd(ch, segs, seg_count) != 0) {
+        return -1;
+    }
+
+    outb(ch->bmide_base + ATA_BM_COMMAND, direction);
+    outl(ch->bmide_base + ATA_BM_PRDT, (uint32_t)(uintptr_t)ch->prd);
+    outb(ch->bmide_base + ATA_BM_STATUS, inb(ch->bmide_base + ATA_BM_STATUS) | ATA_BM_STATUS_IRQ | ATA_BM_STATUS_ERR);
+
+    ch->irq_fired = 0;
+    ch->active = dev;
+    ch->active_lba = lba;
+    ch->active_write = write;
+    ch->done = done;
+
+    ata_issue_command(dev, lba, count, write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+    outb(ch->bmide_base + ATA_BM_COMMAND, direction | ATA_BM_CMD_START);
+    return 0;
+}
+
+static int ata_dma_finished(ata_channel_t* ch) {
+    return ch->irq_fired || !ch->active || (inb(ch->bmide_base + ATA_BM_STATUS) & ATA_BM_STATUS_IRQ);
+}
+
+static int ata_dma_wait(ata_channel_t* ch) {
+    if (ata_interrupts_enabled()) {
+        // Sleep until IRQ14/15 (or the next timer tick) instead of spinning on the status port
+        for (int i = 0; i < ATA_DMA_TIMEOUT_WAKEUPS; i++) {
+            __asm__ __volatile__("cli");
+            if (ata_dma_finished(ch)) {
+                __asm__ __volatile__("sti");
+                return 0;
+            }
+            __asm__ __volatile__("sti; hlt");
+        }
+        return -1;
+    }
+
+    // Interrupts are off (early boot or inside an interrupt handler): poll the controller
+    int timeout = 50000000;
+    while (!ata_dma_finished(ch) && timeout--) {
+        __asm__ __volatile__("pause");
+    }
+    return timeout > 0 ? 0 : -1;
+}
+
+// Lets an asynchronous transfer on the channel finish before its task file is reused
+static void ata_wait_idle(ata_channel_t* ch) {
+    while (ch->active && ch->done) {
+        int result = ata_dma_wait(ch);
+
+        uint32_t flags = ata_irq_save();
+        if (ch->active && ch->done) {
+            if (result != 0) {
+                log(LOG_ERROR, "ATA DMA %s timeout (sector %d)", ch->active_write ? "write" : "read", ch->active_lba);
+            }
+            ata_dma_complete(ch);
+        }
+        ata_irq_restore(flags);
+    }
+}
+
+// PIO transfer of one command; the data stream may run across several segments
+static int ata_pio_transfer(ata_device_t* dev, uint32_t lba, uint32_t count, const ata_segment_t* segs, int write) {
+    const char* op = write ? "write" : "read";
+    uint8_t command;
+    if (write) {
+        command = dev->multiple_sectors ? ATA_CMD_WRITE_MULTIPLE : ATA_CMD_WRITE_SECTORS;
+    } else {
+        command = dev->multiple_sectors ? ATA_CMD_READ_MULTIPLE : ATA_CMD_READ_SECTORS;
+    }
+    uint32_t drq_sectors = dev->multiple_sectors ? dev->multiple_sectors : 1;
+
+    uint8_t* buffer = segs->buffer;
+    uint32_t seg_left = segs->sectors;
+
+    ata_issue_command(dev, lba, count, command);
+
+    for (uint32_t done = 0; done < count; ) {
+        uint32_t block = count - done < drq_sectors ? count - done : drq_sectors;
+
+        if (ata_wait_data(dev, lba + done, op) != 0) {
+            return -1;
+        }
+
+        for (uint32_t moved = 0; moved < block; ) {
+            if (seg_left == 0) {
+                segs++;
+                buffer = segs->buffer;
+                seg_left = segs->sectors;
+            }
+
+            uint32_t n = block - moved < seg_left ? block - moved : seg_left;
+            if (write) {
+                outsw(dev->io_base + ATA_REG_DATA, buffer, n * ATA_SECTOR_SIZE / 2);
+            } else {
+                insw(dev->io_base + ATA_REG_DATA, buffer, n * ATA_SECTOR_SIZE / 2);
+            }
+
+            buffer += n * ATA_SECTOR_SIZE;
+            seg_left -= n;
+            moved += n;
+        }
+
+        done += block;
+    }
+
+    if (ata_wait_bsy(dev->io_base) != 0) {
+        log(LOG_ERROR, "ATA %s timeout waiting for BSY clear after data transfer (sector %d)", op, lba);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Runs one command to completion, by DMA when the controller and buffers allow it
+static int ata_transfer_sync(ata_device_t* dev, uint32_t lba, uint32_t count,
+                             const ata_segment_t* segs, int seg_count, int write) {
+    if (ata_dma_segments_usable(dev, segs, seg_count) &&
+        ata_dma_start(dev, lba, count, segs, seg_count, write, NULL) == 0) {
+        ata_channel_t* ch = &ata_channels[dev->channel];
+
+        if (ata_dma_wait(ch) != 0) {
+            log(LOG_ERROR, "ATA DMA %s timeout (sector %d)", write ? "write" : "read", lba);
+            ata_dma_finish(ch);
+            return -1;
+        }
+
+        return ata_dma_finish(ch);
+    }
+
+    return ata_pio_transfer(dev, lba, count, segs, write);
+}
+
+static int ata_rw(uint32_t device_id, uint32_t lba, uint32_t count, uint8_t* buffer, int write) {
+    if (device_id >= 4 || !ata_devices[device_id].exists || count == 0 || !buffer) {
+        return -1;
+    }
+
+    ata_device_t* dev = &ata_devices[device_id];
+
+    if (lba + count > dev->sectors) {
+        log(LOG_ERROR, "%s beyond drive capacity", write ? "Write" : "Read");
+        return -1;
+    }
+
+    ata_wait_idle(&ata_channels[dev->channel]);
+
+    while (count > 0) {
+        uint32_t chunk = count > ATA_MAX_SECTORS_PER_CMD ? ATA_MAX_SECTORS_PER_CMD : count;
+        ata_segment_t seg = { buffer, chunk };
+
+        if (ata_transfer_sync(dev, lba, chunk, &seg, 1, write) != 0) {
+            return -1;
+        }
+
+        buffer += chunk * ATA_SECTOR_SIZE;
+        lba += chunk;
+        count -= chunk;
+    }
+
+    return 0;
+}
+
 static int ata_identify(uint32_t device_id) {
     if (device_id >= 4) return -1;
     
@@ -73,6 +478,14 @@ static int ata_identify(uint32_t device_id) {
     
     dev->sectors = ((uint32_t)buffer[61] << 16) | buffer[60];
     dev->exists = 1;
+    dev->multiple_sectors = 0;
+    dev->dma_capable = (buffer[49] & (1 << 8)) != 0;
+
+    // Word 47 holds the largest DRQ block READ/WRITE MULTIPLE can move
+    uint16_t max_multiple = buffer[47] & 0xFF;
+    if (max_multiple > 1) {
+        ata_set_multiple_mode(dev, max_multiple);
+    }
     
     return 0;
 }
@@ -102,6 +515,7 @@ int ata_init(void) {
     
     int found_drives = 0;
     for (int i = 0; i < 4; i++) {
+        ata_devices[i].channel = i / 2;
         if (ata_identify(i) == 0) {
             log(LOG_OK, "Found ATA drive %d: %d sectors", i, ata_devices[i].sectors);
             found_drives++;
@@ -112,6 +526,8 @@ int ata_init(void) {
         log(LOG_ERROR, "No ATA drives found");
         return -1;
     }
+
+    ata_dma_init();
     
     log(LOG_OK, "ATA driver initialized, found %d drives", found_drives);
     return 0;
@@ -128,111 +544,90 @@ uint32_t ata_get_drive_size(uint32_t device_id) {
 }
 
 int ata_read_sectors(uint32_t device_id, uint32_t lba, uint32_t count, uint8_t* buffer) {
-    if (device_id >= 4 || !ata_devices[device_id].exists || count == 0 || !buffer) {
-        return -1;
-    }
-    
-    ata_device_t* dev = &ata_devices[device_id];
-    
-    if (lba + count > dev->sectors) {
-        log(LOG_ERROR, "Read beyond drive capacity");
+    return ata_rw(device_id, lba, count, buffer, 0);
+}
+
+int ata_write_sectors(uint32_t device_id, uint32_t lba, uint32_t count, const uint8_t* buffer) {
+    return ata_rw(device_id, lba, count, (uint8_t*)buffer, 1);
+}
+
+// Issues one command for the segments (at most ATA_MAX_SECTORS_PER_CMD sectors in total).
+// With a completion callback and a DMA-capable channel it returns ATA_QUEUED right after
+// starting the transfer and reports the result from IRQ14/15 (or ata_poll); otherwise the
+// transfer runs synchronously and its status is returned directly.
+int ata_transfer(uint32_t device_id, uint32_t lba, const ata_segment_t* segs, int seg_count, int write, ata_done_t done) {
+    if (device_id >= 4 || !ata_devices[device_id].exists || !segs || seg_count <= 0) {
         return -1;
     }
-    
-    for (uint32_t i = 0; i < count; i++) {
-        uint32_t current_lba = lba + i;
-        
-        outb(dev->io_base + ATA_REG_HDDEVSEL, dev->drive | 0x40 | ((current_lba >> 24) & 0x0F));
-        ata_delay(dev->io_base);
-        
-        outb(dev->io_base + ATA_REG_FEATURES, 0);
-        outb(dev->io_base + ATA_REG_SECCOUNT0, 1);
-        outb(dev->io_base + ATA_REG_LBA0, current_lba & 0xFF);
-        outb(dev->io_base + ATA_REG_LBA1, (current_lba >> 8) & 0xFF);
-        outb(dev->io_base + ATA_REG_LBA2, (current_lba >> 16) & 0xFF);
-        outb(dev->io_base + ATA_REG_COMMAND, ATA_CMD_READ_SECTORS);
-        
-        if (ata_wait_bsy(dev->io_base) != 0) {
-            log(LOG_ERROR, "ATA read timeout waiting for BSY clear (sector %d)", current_lba);
-            return -1;
-        }
-        
-        if (inb(dev->io_base + ATA_REG_STATUS) & ATA_STATUS_ERR) {
-            log(LOG_ERROR, "ATA read error for sector %d", current_lba);
-            return -1;
-        }
-        
-        if (ata_wait_drq(dev->io_base) != 0) {
-            log(LOG_ERROR, "ATA read timeout waiting for DRQ (sector %d)", current_lba);
-            return -1;
-        }
 
-        insw(dev->io_base + ATA_REG_DATA, buffer + i * ATA_SECTOR_SIZE, ATA_SECTOR_SIZE / 2);
+    ata_device_t* dev = &ata_devices[device_id];
 
-        if (ata_wait_bsy(dev->io_base) != 0) {
-            log(LOG_ERROR, "ATA read timeout waiting for BSY clear after data transfer (sector %d)", current_lba);
+    uint32_t count = 0;
+    for (int i = 0; i < seg_count; i++) {
+        if (!segs[i].buffer || segs[i].sectors == 0) {
             return -1;
         }
+        count += segs[i].sectors;
     }
-    
-    return 0;
-}
 
-int ata_write_sectors(uint32_t device_id, uint32_t lba, uint32_t count, const uint8_t* buffer) {
-    if (device_id >= 4 || !ata_devices[device_id].exists || count == 0 || !buffer) {
+    if (count > ATA_MAX_SECTORS_PER_CMD || lba + count > dev->sectors) {
+        log(LOG_ERROR, "Invalid ATA transfer (sector %d, %d sectors)", lba, count);
         return -1;
     }
-    
-    ata_device_t* dev = &ata_devices[device_id];
-    
-    if (lba + count > dev->sectors) {
-        log(LOG_ERROR, "Write beyond drive capacity");
-        return -1;
-    }
-    
-    for (uint32_t i = 0; i < count; i++) {
-        uint32_t current_lba = lba + i;
-        
-        outb(dev->io_base + ATA_REG_HDDEVSEL, dev->drive | 0x40 | ((current_lba >> 24) & 0x0F));
-        ata_delay(dev->io_base);
-        
-        outb(dev->io_base + ATA_REG_FEATURES, 0);
-        outb(dev->io_base + ATA_REG_SECCOUNT0, 1);
-        outb(dev->io_base + ATA_REG_LBA0, current_lba & 0xFF);
-        outb(dev->io_base + ATA_REG_LBA1, (current_lba >> 8) & 0xFF);
-        outb(dev->io_base + ATA_REG_LBA2, (current_lba >> 16) & 0xFF);
-        outb(dev->io_base + ATA_REG_COMMAND, ATA_CMD_WRITE_SECTORS);
-        
-        if (ata_wait_bsy(dev->io_base) != 0) {
-            log(LOG_ERROR, "ATA write timeout waiting for BSY clear (sector %d)", current_lba);
-            return -1;
-        }
-        
-        if (inb(dev->io_base + ATA_REG_STATUS) & ATA_STATUS_ERR) {
-            log(LOG_ERROR, "ATA write error for sector %d", current_lba);
-            return -1;
-        }
-        
-        if (ata_wait_drq(dev->io_base) != 0) {
-            log(LOG_ERROR, "ATA write timeout waiting for DRQ (sector %d)", current_lba);
-            return -1;
+
+    ata_wait_idle(&ata_channels[dev->channel]);
+
+    if (done && ata_dma_segments_usable(dev, segs, seg_count)) {
+        uint32_t flags = ata_irq_save();
+        int started = ata_dma_start(dev, lba, count, segs, seg_count, write, done);
+        ata_irq_restore(flags);
+
+        if (started == 0) {
+            return ATA_QUEUED;
         }
+    }
 
-        outsw(dev->io_base + ATA_REG_DATA, buffer + i * ATA_SECTOR_SIZE, ATA_SECTOR_SIZE / 2);
+    return ata_transfer_sync(dev, lba, count, segs, seg_count, write);
+}
 
-        if (ata_wait_bsy(dev->io_base) != 0) {
-            log(LOG_ERROR, "ATA write timeout waiting for BSY clear after data transfer (sector %d)", current_lba);
-            return -1;
+int ata_get_channel(uint32_t device_id) {
+    if (device_id >= 4 || !ata_devices[device_id].exists) return -1;
+    return ata_devices[device_id].channel;
+}
+
+// Completes asynchronous transfers for callers that run with interrupts disabled
+void ata_poll(void) {
+    for (int i = 0; i < 2; i++) {
+        ata_channel_t* ch = &ata_channels[i];
+
+        uint32_t flags = ata_irq_save();
+        if (ch->active && ch->done && (inb(ch->bmide_base + ATA_BM_STATUS) & ATA_BM_STATUS_IRQ)) {
+            ata_dma_complete(ch);
         }
+        ata_irq_restore(flags);
+    }
+}
+
+// Write barrier: data from earlier writes may sit in the drive cache until this is issued
+int ata_flush_cache(uint32_t device_id) {
+    if (device_id >= 4 || !ata_devices[device_id].exists) {
+        return -1;
     }
 
-    // Flush cache to ensure data is written to disk
+    ata_device_t* dev = &ata_devices[device_id];
+    ata_wait_idle(&ata_channels[dev->channel]);
+
     outb(dev->io_base + ATA_REG_HDDEVSEL, dev->drive | 0x40);
     ata_delay(dev->io_base);
     outb(dev->io_base + ATA_REG_COMMAND, ATA_CMD_CACHE_FLUSH);
 
     if (ata_wait_bsy(dev->io_base) != 0) {
-        log(LOG_ERROR, "ATA cache flush timeout after write");
+        log(LOG_ERROR, "ATA cache flush timeout");
+        return -1;
+    }
+
+    if (inb(dev->io_base + ATA_REG_STATUS) & ATA_STATUS_ERR) {
+        log(LOG_ERROR, "ATA cache flush failed on drive %d", device_id);
         return -1;
     }
 
@@ -252,8 +647,9 @@ void ata_list_devices(void) {
             int drive = i % 2;
             uint32_t size_mb = (ata_devices[i].sectors * ATA_SECTOR_SIZE) / (1024 * 1024);
             
-            log(LOG_SYSTEM, "  Device %d: %s %s - %d sectors (%d MB)", 
-                i, bus_names[bus], drive_names[drive], ata_devices[i].sectors, size_mb);
+            log(LOG_SYSTEM, "  Device %d: %s %s - %d sectors (%d MB, %s)", 
+                i, bus_names[bus], drive_names[drive], ata_devices[i].sectors, size_mb,
+                ata_dma_usable(&ata_devices[i], NULL) ? "DMA" : "PIO");
             found++;
         }
     }
@@ -23,6 +23,11 @@
 
 #define ATA_CMD_READ_SECTORS 0x20
 #define ATA_CMD_WRITE_SECTORS 0x30
+#define ATA_CMD_READ_MULTIPLE 0xC4
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_SET_MULTIPLE 0xC6
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
 #define ATA_CMD_CACHE_FLUSH 0xE7
 #define ATA_CMD_IDENTIFY 0xEC
 
@@ -31,16 +36,44 @@
 #define ATA_STATUS_DRQ 0x08
 #define ATA_STATUS_ERR 0x01
 
+#define ATA_BM_COMMAND 0x00
+#define ATA_BM_STATUS 0x02
+#define ATA_BM_PRDT 0x04
+
+#define ATA_BM_CMD_START 0x01
+#define ATA_BM_CMD_READ 0x08
+#define ATA_BM_STATUS_ACTIVE 0x01
+#define ATA_BM_STATUS_ERR 0x02
+#define ATA_BM_STATUS_IRQ 0x04
+
+#define ATA_PRD_MAX 16
+#define ATA_PRD_EOT 0x8000
+#define ATA_DMA_TIMEOUT_WAKEUPS 500
+
 #define ATA_MASTER 0xA0
 #define ATA_SLAVE 0xB0
 
 #define ATA_SECTOR_SIZE 512
+#define ATA_MAX_SECTORS_PER_CMD 256
+
+#define ATA_QUEUED 1
+
+typedef struct {
+    uint8_t* buffer;
+    uint32_t sectors;
+} ata_segment_t;
+
+typedef void (*ata_done_t)(uint32_t channel, int status);
 
 int ata_init(void);
 int ata_drive_exists(uint32_t device_id);
 uint32_t ata_get_drive_size(uint32_t device_id);
 int ata_read_sectors(uint32_t device_id, uint32_t lba, uint32_t count, uint8_t* buffer);
 int ata_write_sectors(uint32_t device_id, uint32_t lba, uint32_t count, const uint8_t* buffer);
+int ata_transfer(uint32_t device_id, uint32_t lba, const ata_segment_t* segs, int seg_count, int write, ata_done_t done);
+int ata_get_channel(uint32_t device_id);
+void ata_poll(void);
+int ata_flush_cache(uint32_t device_id);
 void ata_list_devices(void);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,265 @@
+#include "blkdev.h"
+#include "ata.h"
+#include "../kernel/logger.h"
+#include <stddef.h>
+
+// Block request queue in front of the ATA driver. Each IDE channel keeps its pending
+// requests sorted by (device, LBA) and serves them in C-LOOK order, merging requests
+// that continue each other into a single command. Completion arrives through the ATA
+// driver's IRQ14/15 callback, so callers can keep several requests in flight.
+
+typedef struct {
+    blk_request_t* pending;
+    blk_request_t* active;
+    uint32_t head_device;
+    uint32_t head_lba;
+    int dispatching;
+    ata_segment_t segs[BLK_MAX_BATCH];
+} blk_queue_t;
+
+static blk_queue_t blk_queues[2];
+static blk_stats_t blk_stats;
+static int blk_plugged = 0;
+
+static void blk_dispatch(uint32_t channel);
+
+static uint32_t blk_irq_save(void) {
+    uint32_t flags;
+    __asm__ __volatile__("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static void blk_irq_restore(uint32_t flags) {
+    if (flags & 0x200) {
+        __asm__ __volatile__("sti" : : : "memory");
+    }
+}
+
+// Waits for the next completion with interrupts off on entry and exit. With interrupts
+// enabled by the caller the CPU halts, so the timer IRQ can schedule other work meanwhile.
+static void blk_idle(uint32_t flags) {
+    if (flags & 0x200) {
+        __asm__ __volatile__("sti; hlt; cli" : : : "memory");
+    }
+    // Also catches a completion whose interrupt was missed
+    ata_poll();
+}
+
+static int blk_before(uint32_t device_a, uint32_t lba_a, uint32_t device_b, uint32_t lba_b) {
+    return device_a < device_b || (device_a == device_b && lba_a < lba_b);
+}
+
+static int blk_overlaps(const blk_request_t* a, const blk_request_t* b) {
+    return a->device_id == b->device_id && (a->write || b->write) &&
+           a->lba < b->lba + b->count && b->lba < a->lba + a->count;
+}
+
+// Overlapping requests must not be reordered by the elevator
+static int blk_conflicts(blk_queue_t* q, const blk_request_t* req) {
+    for (blk_request_t* r = q->active; r; r = r->next) {
+        if (blk_overlaps(r, req)) return 1;
+    }
+    for (blk_request_t* r = q->pending; r; r = r->next) {
+        if (blk_overlaps(r, req)) return 1;
+    }
+    return 0;
+}
+
+static void blk_finish(blk_queue_t* q, int status) {
+    blk_request_t* req = q->active;
+    q->active = NULL;
+
+    while (req) {
+        blk_request_t* next = req->next;
+        req->next = NULL;
+        req->status = status;
+        blk_stats.queued--;
+        if (req->callback) {
+            req->callback(req);
+        }
+        req = next;
+    }
+}
+
+static void blk_complete(uint32_t channel, int status) {
+    blk_finish(&blk_queues[channel], status);
+    blk_dispatch(channel);
+}
+
+static void blk_dispatch(uint32_t channel) {
+    blk_queue_t* q = &blk_queues[channel];
+    if (q->dispatching || blk_plugged) {
+        return;
+    }
+
+    q->dispatching = 1;
+    while (!q->active && q->pending) {
+        // C-LOOK: first request at or beyond the head, wrapping to the lowest one
+        blk_request_t** link = &q->pending;
+        while (*link && blk_before((*link)->device_id, (*link)->lba, q->head_device, q->head_lba)) {
+            link = &(*link)->next;
+        }
+        if (!*link) {
+            link = &q->pending;
+        }
+
+        blk_request_t* first = *link;
+        blk_request_t* last = first;
+        uint32_t count = first->count;
+        int segs = 1;
+        q->segs[0].buffer = first->buffer;
+        q->segs[0].sectors = first->count;
+
+        while (last->next && segs < BLK_MAX_BATCH) {
+            blk_request_t* next = last->next;
+            if (next->device_id != first->device_id || next->write != first->write ||
+                next->lba != last->lba + last->count || count + next->count > ATA_MAX_SECTORS_PER_CMD) {
+                break;
+            }
+
+            q->segs[segs].buffer = next->buffer;
+            q->segs[segs].sectors = next->count;
+            segs++;
+            count += next->count;
+            last = next;
+            blk_stats.merged++;
+        }
+
+        *link = last->next;
+        last->next = NULL;
+        q->active = first;
+        q->head_device = first->device_id;
+        q->head_lba = first->lba + count;
+        blk_stats.dispatched++;
+
+        int result = ata_transfer(first->device_id, first->lba, q->segs, segs, first->write, blk_complete);
+        if (result != ATA_QUEUED) {
+            blk_finish(q, result);
+        }
+    }
+    q->dispatching = 0;
+}
+
+// Queues a request and returns; req->status stays BLK_PENDING until it completes,
+// after which the optional callback runs (possibly from interrupt context)
+int blk_submit(blk_request_t* req) {
+    if (!req) {
+        return -1;
+    }
+
+    int channel = ata_get_channel(req->device_id);
+    if (channel < 0 || !req->buffer || req->count == 0 || req->count > ATA_MAX_SECTORS_PER_CMD) {
+        req->status = -1;
+        return -1;
+    }
+
+    blk_queue_t* q = &blk_queues[channel];
+    uint32_t flags = blk_irq_save();
+
+    if (blk_conflicts(q, req)) {
+        blk_unplug();
+        while (q->active || q->pending) {
+            blk_idle(flags);
+        }
+    }
+
+    req->status = BLK_PENDING;
+    blk_request_t** link = &q->pending;
+    while (*link && !blk_before(req->device_id, req->lba, (*link)->device_id, (*link)->lba)) {
+        link = &(*link)->next;
+    }
+    req->next = *link;
+    *link = req;
+
+    blk_stats.submitted++;
+    blk_stats.queued++;
+    blk_dispatch(channel);
+
+    blk_irq_restore(flags);
+    return 0;
+}
+
+int blk_wait(blk_request_t* req) {
+    uint32_t flags = blk_irq_save();
+
+    if (req->status == BLK_PENDING) {
+        blk_unplug();
+    }
+    while (req->status == BLK_PENDING) {
+        blk_idle(flags);
+    }
+
+    blk_irq_restore(flags);
+    return req->status;
+}
+
+// While plugged, submitted requests only queue up so a burst can be sorted and merged
+// before anything reaches the drive
+void blk_plug(void) {
+    blk_plugged = 1;
+}
+
+void blk_unplug(void) {
+    if (!blk_plugged) {
+        return;
+    }
+
+    uint32_t flags = blk_irq_save();
+    blk_plugged = 0;
+    blk_dispatch(0);
+    blk_dispatch(1);
+    blk_irq_restore(flags);
+}
+
+void blk_poll(void) {
+    ata_poll();
+}
+
+static int blk_rw(uint32_t device_id, uint32_t lba, uint32_t count, uint8_t* buffer, int write) {
+    blk_request_t requests[BLK_SYNC_REQUESTS];
+    int result = 0;
+
+    while (count > 0) {
+        int in_flight = 0;
+
+        while (count > 0 && in_flight < BLK_SYNC_REQUESTS) {
+            uint32_t chunk = count > ATA_MAX_SECTORS_PER_CMD ? ATA_MAX_SECTORS_PER_CMD : count;
+            blk_request_t* req = &requests[in_flight++];
+
+            req->device_id = device_id;
+            req->lba = lba;
+            req->count = chunk;
+            req->buffer = buffer;
+            req->write = write;
+            req->callback = NULL;
+            req->private_data = NULL;
+            blk_submit(req);
+
+            buffer += chunk * ATA_SECTOR_SIZE;
+            lba += chunk;
+            count -= chunk;
+        }
+
+        for (int i = 0; i < in_flight; i++) {
+            if (blk_wait(&requests[i]) != 0) {
+                result = -1;
+            }
+        }
+    }
+
+    return result;
+}
+
+int blk_read(uint32_t device_id, uint32_t lba, uint32_t count, void* buffer) {
+    return blk_rw(device_id, lba, count, (uint8_t*)buffer, 0);
+}
+
+int blk_write(uint32_t device_id, uint32_t lba, uint32_t count, const void* buffer) {
+    return blk_rw(device_id, lba, count, (uint8_t*)buffer, 1);
+}
+
+void blk_get_stats(blk_stats_t* stats) {
+    if (stats) {
+        *stats = blk_stats;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef BLKDEV_H
+#define BLKDEV_H
+
+#include <stdint.h>
+
+// Requests merged into one command at most (one PRD segment each)
+#define BLK_MAX_BATCH 16
+// Requests blk_read/blk_write keep in flight at once
+#define BLK_SYNC_REQUESTS 8
+
+#define BLK_PENDING 1
+
+typedef struct blk_request {
+    uint32_t device_id;
+    uint32_t lba;
+    uint32_t count;
+    uint8_t* buffer;
+    int write;
+    volatile int status;
+    void (*callback)(struct blk_request* req);
+    void* private_data;
+    struct blk_request* next;
+} blk_request_t;
+
+typedef struct {
+    uint32_t submitted;
+    uint32_t merged;
+    uint32_t dispatched;
+    uint32_t queued;
+} blk_stats_t;
+
+int blk_submit(blk_request_t* req);
+int blk_wait(blk_request_t* req);
+void blk_plug(void);
+void blk_unplug(void);
+void blk_poll(void);
+int blk_read(uint32_t device_id, uint32_t lba, uint32_t count, void* buffer);
+int blk_write(uint32_t device_id, uint32_t lba, uint32_t count, const void* buffer);
+void blk_get_stats(blk_stats_t* stats);
+
+#endif
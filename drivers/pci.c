@@ -0,0 +1,55 @@
+#include "pci.h"
+#include "../cpu/ports.h"
+
+uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    uint32_t address = 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+                       ((uint32_t)func << 8) | (offset & 0xFC);
+    outl(PCI_CONFIG_ADDRESS, address);
+    return inl(PCI_CONFIG_DATA);
+}
+
+void pci_config_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value) {
+    uint32_t address = 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+                       ((uint32_t)func << 8) | (offset & 0xFC);
+    outl(PCI_CONFIG_ADDRESS, address);
+    outl(PCI_CONFIG_DATA, value);
+}
+
+// Brute-force scan of every bus/slot/function for the first device of the given class
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t* out) {
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            uint32_t id = pci_config_read(bus, slot, 0, PCI_REG_VENDOR_ID);
+            if ((id & 0xFFFF) == 0xFFFF) {
+                continue;
+            }
+
+            uint8_t header = (pci_config_read(bus, slot, 0, PCI_REG_HEADER_TYPE) >> 16) & 0xFF;
+            uint8_t functions = (header & 0x80) ? 8 : 1;
+
+            for (uint8_t func = 0; func < functions; func++) {
+                id = pci_config_read(bus, slot, func, PCI_REG_VENDOR_ID);
+                if ((id & 0xFFFF) == 0xFFFF) {
+                    continue;
+                }
+
+                uint32_t class_reg = pci_config_read(bus, slot, func, PCI_REG_CLASS);
+                if (((class_reg >> 24) & 0xFF) == class_code && ((class_reg >> 16) & 0xFF) == subclass) {
+                    if (out) {
+                        out->bus = bus;
+                        out->slot = slot;
+                        out->func = func;
+                        out->vendor_id = id & 0xFFFF;
+                        out->device_id = (id >> 16) & 0xFFFF;
+                        out->class_code = class_code;
+                        out->subclass = subclass;
+                        out->prog_if = (class_reg >> 8) & 0xFF;
+                    }
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,38 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+#define PCI_REG_VENDOR_ID 0x00
+#define PCI_REG_COMMAND 0x04
+#define PCI_REG_CLASS 0x08
+#define PCI_REG_HEADER_TYPE 0x0C
+#define PCI_REG_BAR0 0x10
+#define PCI_REG_BAR4 0x20
+#define PCI_REG_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO 0x0001
+#define PCI_COMMAND_BUS_MASTER 0x0004
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+typedef struct {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint16_t vendor_id;
+    uint16_t device_id;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+} pci_device_t;
+
+uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset);
+void pci_config_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value);
+int pci_find_class(uint8_t class_code, uint8_t subclass, pci_device_t* out);
+
+#endif
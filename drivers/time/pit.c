@@ -3,7 +3,7 @@
 
 static volatile uint64_t ticks = 0;
 
-void pit_handler() {
+void pit_handler(void) {
     ticks++;
 }
 
@@ -15,7 +15,6 @@ void pit_init(uint32_t frequency) {
     outb(0x40, (divisor >> 8) & 0xFF);
 
     ticks = 0;
-    // Hook pit_handler() into IRQ0
 }
 
 uint64_t pit_ticks(void) {
@@ -4,6 +4,7 @@
 #include <stdint.h>
 
 void pit_init(uint32_t frequency);
+void pit_handler(void);
 uint64_t pit_ticks(void);
 
 #endif
@@ -4,58 +4,16 @@
 #include "../kernel/logger.h"
 #include <string.h>
 
-static rfss_inode_t* rfss_get_inode(rfss_fs_t* fs, uint32_t inode_num) {
-    if (!fs || inode_num == 0 || inode_num > fs->superblock->inode_count) {
-        //log(LOG_ERROR, "Invalid inode number: %d", inode_num);
-        return NULL;
-    }
-    
-    uint32_t inodes_per_block = RFSS_BLOCK_SIZE / sizeof(rfss_inode_t);
-    uint32_t block = (inode_num - 1) / inodes_per_block;
-    uint32_t index = (inode_num - 1) % inodes_per_block;
-    
-    static rfss_inode_t inodes[RFSS_BLOCK_SIZE / sizeof(rfss_inode_t)];
-    if (rfss_read_block(fs, fs->superblock->inode_table_block + block, inodes) != 0) {
-        //log(LOG_ERROR, "Failed to read inode block %d", block);
-        return NULL;
-    }
-    
-    return &inodes[index];
-}
-
-static int rfss_write_inode(rfss_fs_t* fs, uint32_t inode_num, rfss_inode_t* inode) {
-    if (!fs || !inode || inode_num == 0 || inode_num > fs->superblock->inode_count) {
-        //log(LOG_ERROR, "Invalid parameters for write inode");
-        return -1;
-    }
-
-    if (fs->journaling_enabled) {
-        return rfss_safe_write_inode(fs, inode_num, inode);
-    }
-    
-    uint32_t inodes_per_block = RFSS_BLOCK_SIZE / sizeof(rfss_inode_t);
-    uint32_t block = (inode_num - 1) / inodes_per_block;
-    uint32_t index = (inode_num - 1) % inodes_per_block;
-
-    static rfss_inode_t inodes[RFSS_BLOCK_SIZE / sizeof(rfss_inode_t)];
-    if (rfss_read_block(fs, fs->superblock->inode_table_block + block, inodes) != 0) {
-        //log(LOG_ERROR, "Failed to read inode block for writing");
-        return -1;
-    }
-    
-    memcpy(&inodes[index], inode, sizeof(rfss_inode_t));
-    int result = rfss_write_block(fs, fs->superblock->inode_table_block + block, inodes);
-    if (result != 0) {
-       //log(LOG_ERROR, "Failed to write inode block");
-    }
-    return result;
-}
-
 static uint32_t rfss_find_file_in_directory(rfss_fs_t* fs, uint32_t dir_inode, const char* name) {
     if (!fs || !name || strlen(name) == 0 || strlen(name) >= RFSS_MAX_FILENAME) {
         //log(LOG_ERROR, "Invalid filename");
         return 0;
     }
+
+    uint32_t cached = 0;
+    if (rfss_dcache_lookup(fs, dir_inode, name, &cached)) {
+        return cached;
+    }
     
     rfss_inode_t* inode = rfss_get_inode(fs, dir_inode);
     if (!inode || ((inode->mode >> 12) & 0xF) != RFSS_FILE_DIRECTORY) {
@@ -63,35 +21,12 @@ static uint32_t rfss_find_file_in_directory(rfss_fs_t* fs, uint32_t dir_inode, c
         return 0;
     }
 
-    static uint8_t block_buffer[RFSS_BLOCK_SIZE];
-    for (int i = 0; i < RFSS_DIRECT_BLOCKS && inode->direct_blocks[i]; i++) {
-        if (rfss_read_block(fs, inode->direct_blocks[i], block_buffer) != 0) {
-            continue;
-        }
-        
-        uint32_t offset = 0;
-        while (offset < RFSS_BLOCK_SIZE) {
-            rfss_dir_entry_t* entry = (rfss_dir_entry_t*)(block_buffer + offset);
-            if (entry->rec_len == 0 || entry->rec_len > RFSS_BLOCK_SIZE - offset || 
-                entry->rec_len < sizeof(rfss_dir_entry_t)) {
-                break;
-            }
-            
-            if (entry->inode != 0 && entry->name_len > 0 && 
-                entry->name_len < RFSS_MAX_FILENAME && 
-                entry->name_len == strlen(name) && 
-                memcmp(entry->name, name, entry->name_len) == 0) {
-                return entry->inode;
-            }
-            
-            offset += entry->rec_len;
-        }
-    }
-    
-    return 0;
+    uint32_t found = rfss_dir_lookup(fs, inode, name);
+    rfss_dcache_insert(fs, dir_inode, name, found);
+    return found;
 }
 
-static uint32_t rfss_resolve_path(rfss_fs_t* fs, const char* path) {
+uint32_t rfss_resolve_path(rfss_fs_t* fs, const char* path) {
     if (!fs || !path) {
         //log(LOG_ERROR, "Invalid parameters for path resolution");
         return 0;
@@ -131,6 +66,33 @@ static uint32_t rfss_resolve_path(rfss_fs_t* fs, const char* path) {
     return current_inode;
 }
 
+// Resolves the directory holding the last component of `path` and copies that component
+// into `name`. Returns 0 if the parent doesn't exist.
+static uint32_t rfss_resolve_parent(rfss_fs_t* fs, const char* path, char* name) {
+    const char* last_slash = strrchr(path, '/');
+    const char* base = last_slash ? last_slash + 1 : path;
+    if (strlen(base) == 0 || strlen(base) >= RFSS_MAX_FILENAME) {
+        return 0;
+    }
+    strcpy(name, base);
+
+    if (!last_slash) {
+        return fs->current_dir_inode;
+    }
+    if (last_slash == path) {
+        return fs->superblock->root_inode;
+    }
+
+    char parent_path[RFSS_MAX_FILENAME + 1];
+    uint32_t len = last_slash - path;
+    if (len > RFSS_MAX_FILENAME) {
+        return 0;
+    }
+    memcpy(parent_path, path, len);
+    parent_path[len] = '\0';
+    return rfss_resolve_path(fs, parent_path);
+}
+
 static int rfss_add_directory_entry(rfss_fs_t* fs, uint32_t dir_inode, const char* name, uint32_t file_inode, uint8_t file_type) {
     if (!fs || !name || strlen(name) == 0 || strlen(name) >= RFSS_MAX_FILENAME || file_inode == 0) {
         //log(LOG_ERROR, "Invalid parameters for add directory entry");
@@ -143,110 +105,23 @@ static int rfss_add_directory_entry(rfss_fs_t* fs, uint32_t dir_inode, const cha
         return -1;
     }
     
-    uint16_t name_len = strlen(name);
-    uint16_t entry_size = sizeof(rfss_dir_entry_t) + name_len;
-    entry_size = (entry_size + 3) & ~3;
-    
-    if (entry_size > RFSS_BLOCK_SIZE - sizeof(rfss_dir_entry_t)) {
-        //log(LOG_ERROR, "Filename too long");
+    rfss_inode_t dir;
+    memcpy(&dir, inode, sizeof(rfss_inode_t));
+
+    if (rfss_dir_add(fs, &dir, name, file_inode, file_type) != 0) {
+        //log(LOG_ERROR, "Failed to add directory entry '%s'", name);
         return -1;
     }
-    
-    static uint8_t block_buffer[RFSS_BLOCK_SIZE];
 
-    for (int i = 0; i < RFSS_DIRECT_BLOCKS && inode->direct_blocks[i]; i++) {
-        if (rfss_read_block(fs, inode->direct_blocks[i], block_buffer) != 0) {
-            continue;
-        }
-        
-        uint32_t offset = 0;
-        rfss_dir_entry_t* last_entry = NULL;
-        uint32_t last_offset = 0;
-        
-        while (offset < RFSS_BLOCK_SIZE) {
-            rfss_dir_entry_t* entry = (rfss_dir_entry_t*)(block_buffer + offset);
-            if (entry->rec_len == 0 || entry->rec_len > RFSS_BLOCK_SIZE - offset ||
-                entry->rec_len < sizeof(rfss_dir_entry_t)) {
-                break;
-            }
-            
-            last_entry = entry;
-            last_offset = offset;
-            offset += entry->rec_len;
-        }
-        
-        if (last_entry && last_entry->name_len < RFSS_MAX_FILENAME) {
-            uint32_t actual_last_size = sizeof(rfss_dir_entry_t) + last_entry->name_len;
-            actual_last_size = (actual_last_size + 3) & ~3;
-            
-            uint32_t free_space = RFSS_BLOCK_SIZE - (last_offset + actual_last_size);
-            
-            if (free_space >= entry_size) {
-                last_entry->rec_len = actual_last_size;
-                
-                rfss_dir_entry_t* new_entry = (rfss_dir_entry_t*)(block_buffer + last_offset + actual_last_size);
-                new_entry->inode = file_inode;
-                new_entry->rec_len = free_space;
-                new_entry->name_len = name_len;
-                new_entry->file_type = file_type;
-                memcpy(new_entry->name, name, name_len);
-                memset(new_entry->name + name_len, 0, RFSS_MAX_FILENAME - name_len);
-                
-                if (rfss_write_block(fs, inode->direct_blocks[i], block_buffer) == 0) {
-                    //log(LOG_DEBUG, "Added directory entry '%s' to existing block", name);
-                    return 0;
-                } else {
-                    //log(LOG_ERROR, "Failed to write directory block");
-                    return -1;
-                }
-            }
-        }
-    }
-    
-    for (int i = 0; i < RFSS_DIRECT_BLOCKS; i++) {
-        if (inode->direct_blocks[i] == 0) {
-            uint32_t new_block = rfss_allocate_block(fs);
-            if (new_block == 0) {
-                //log(LOG_ERROR, "Failed to allocate block for directory");
-                return -1;
-            }
-            
-            inode->direct_blocks[i] = new_block;
-            inode->blocks_count++;
-            inode->size += RFSS_BLOCK_SIZE;
-            
-            memset(block_buffer, 0, RFSS_BLOCK_SIZE);
-            
-            rfss_dir_entry_t* new_entry = (rfss_dir_entry_t*)block_buffer;
-            new_entry->inode = file_inode;
-            new_entry->rec_len = RFSS_BLOCK_SIZE;
-            new_entry->name_len = name_len;
-            new_entry->file_type = file_type;
-            memcpy(new_entry->name, name, name_len);
-            memset(new_entry->name + name_len, 0, RFSS_MAX_FILENAME - name_len);
-            
-            if (rfss_write_block(fs, new_block, block_buffer) != 0) {
-                //log(LOG_ERROR, "Failed to write new directory block");
-                rfss_free_block(fs, new_block);
-                return -1;
-            }
-            
-            if (rfss_write_inode(fs, dir_inode, inode) != 0) {
-                //log(LOG_ERROR, "Failed to update directory inode");
-                rfss_free_block(fs, new_block);
-                return -1;
-            }
-            
-            //log(LOG_DEBUG, "Added directory entry '%s' to new block %d", name, new_block);
-            return 0;
-        }
+    if (rfss_write_inode(fs, dir_inode, &dir) != 0) {
+        //log(LOG_ERROR, "Failed to update directory inode");
+        return -1;
     }
-    
-    //log(LOG_ERROR, "Directory is full, no more direct blocks available");
-    return -1;
+
+    return 0;
 }
 
-int rfss_create_file(rfss_fs_t* fs, const char* path, uint32_t mode) {
+static int rfss_create_file_tx(rfss_fs_t* fs, const char* path, uint32_t mode) {
     if (!fs || !path || !fs->mounted || strlen(path) == 0 || strlen(path) > 255) {
         //log(LOG_ERROR, "Invalid parameters for create file");
         return -1;
@@ -315,6 +190,7 @@ int rfss_create_file(rfss_fs_t* fs, const char* path, uint32_t mode) {
     new_inode.size = 0;
     new_inode.links_count = 1;
     new_inode.blocks_count = 0;
+    new_inode.flags = RFSS_INODE_FLAG_EXTENTS;
     
     if (rfss_write_inode(fs, new_inode_num, &new_inode) != 0) {
         //log(LOG_ERROR, "Failed to write new inode");
@@ -329,50 +205,45 @@ int rfss_create_file(rfss_fs_t* fs, const char* path, uint32_t mode) {
         kfree(path_copy);
         return -1;
     }
+    rfss_dcache_insert(fs, parent_inode, filename, new_inode_num);
     
     log(LOG_DEBUG, "Created file: %s (inode %d)", path, new_inode_num);
     kfree(path_copy);
     return 0;
 }
 
-static rfss_fs_t* mounted_fs = NULL;
-
-uint32_t rfss_calculate_checksum(const void* data, size_t size) {
-    if (!data) {
-        return 0;
-    }
-    uint32_t checksum = 0;
-    const uint8_t* ptr = (const uint8_t*)data;
-    for (size_t i = 0; i < size; i++) {
-        checksum = (checksum << 5) + checksum + ptr[i];
+int rfss_create_file(rfss_fs_t* fs, const char* path, uint32_t mode) {
+    if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS) != 0) {
+        return -1;
     }
-    return checksum;
+
+    int result = rfss_create_file_tx(fs, path, mode);
+    rfss_journal_commit_transaction(fs);
+    return result;
 }
 
+static rfss_fs_t* mounted_fs[RFSS_MAX_MOUNTS];
+
 int rfss_read_block(rfss_fs_t* fs, uint32_t block, void* buffer) {
     if (!buffer) {
         //log(LOG_ERROR, "Invalid buffer for read block");
         return -1;
     }
 
-    uint32_t device_id = fs ? fs->device_id : 0;
-
     if (fs && fs->superblock && block >= fs->superblock->total_blocks && block != 0) {
         //log(LOG_ERROR, "Block number out of range: %d >= %d", block, fs->superblock->total_blocks);
         return -1;
     }
 
-    uint32_t sectors_per_block = RFSS_BLOCK_SIZE / ATA_SECTOR_SIZE;
-    uint32_t start_sector = block * sectors_per_block;
+    if (!fs) {
+        return rfss_device_read(0, block, 1, buffer);
+    }
 
-    for (uint32_t i = 0; i < sectors_per_block; i++) {
-        if (ata_read_sectors(device_id, start_sector + i, 1, (uint8_t*)buffer + i * ATA_SECTOR_SIZE) != 0) {
-            //log(LOG_ERROR, "Failed to read sector %d", start_sector + i);
-            return -1;
-        }
+    if (fs->journaling_enabled && rfss_journal_read_block(fs, block, buffer) == 0) {
+        return 0;
     }
 
-    return 0;
+    return rfss_cache_read(fs, block, buffer);
 }
 
 int rfss_write_block(rfss_fs_t* fs, uint32_t block, const void* buffer) {
@@ -385,106 +256,16 @@ int rfss_write_block(rfss_fs_t* fs, uint32_t block, const void* buffer) {
         return rfss_safe_write_block(fs, block, buffer);
     }
 
-    uint32_t device_id = fs ? fs->device_id : 0;
-
     if (fs && fs->superblock && block >= fs->superblock->total_blocks && block != 0) {
         //log(LOG_ERROR, "Block number out of range: %d >= %d", block, fs->superblock->total_blocks);
         return -1;
     }
 
-    uint32_t sectors_per_block = RFSS_BLOCK_SIZE / ATA_SECTOR_SIZE;
-    uint32_t start_sector = block * sectors_per_block;
-
-    for (uint32_t i = 0; i < sectors_per_block; i++) {
-        if (ata_write_sectors(device_id, start_sector + i, 1, (const uint8_t*)buffer + i * ATA_SECTOR_SIZE) != 0) {
-            //log(LOG_ERROR, "Failed to write sector %d", start_sector + i);
-            return -1;
-        }
-    }
-
-    return 0;
-}
-
-uint32_t rfss_allocate_block(rfss_fs_t* fs) {
-    if (!fs || !fs->block_bitmap || !fs->superblock) {
-        //log(LOG_ERROR, "Filesystem not properly initialized");
-        return 0;
-    }
-
-    if (fs->superblock->free_blocks == 0) {
-        //log(LOG_ERROR, "No free blocks available");
-        return 0;
-    }
-
-    uint32_t total_blocks = fs->superblock->total_blocks;
-    for (uint32_t i = 80; i < total_blocks; i++) {
-        uint32_t byte = i / 8;
-        uint32_t bit = i % 8;
-        if (!(fs->block_bitmap[byte] & (1 << bit))) {
-            fs->block_bitmap[byte] |= (1 << bit);
-            fs->superblock->free_blocks--;
-            fs->dirty = 1;
-            return i;
-        }
-    }
-
-    //log(LOG_ERROR, "No free blocks available");
-    return 0;
-}
-
-void rfss_free_block(rfss_fs_t* fs, uint32_t block) {
-    if (!fs || !fs->block_bitmap || block >= fs->superblock->total_blocks || block < 80) {
-        return;
-    }
-
-    uint32_t byte = block / 8;
-    uint32_t bit = block % 8;
-    if (fs->block_bitmap[byte] & (1 << bit)) {
-        fs->block_bitmap[byte] &= ~(1 << bit);
-        fs->superblock->free_blocks++;
-        fs->dirty = 1;
-    }
-}
-
-uint32_t rfss_allocate_inode(rfss_fs_t* fs) {
-    if (!fs || !fs->inode_bitmap || !fs->superblock) {
-        //log(LOG_ERROR, "Filesystem not properly initialized");
-        return 0;
-    }
-
-    if (fs->superblock->free_inode_count == 0) {
-        //log(LOG_ERROR, "No free inodes available");
-        return 0;
-    }
-
-    uint32_t total_inodes = fs->superblock->inode_count;
-    for (uint32_t i = 1; i <= total_inodes; i++) {
-        uint32_t byte = (i - 1) / 8;
-        uint32_t bit = (i - 1) % 8;
-        if (!(fs->inode_bitmap[byte] & (1 << bit))) {
-            fs->inode_bitmap[byte] |= (1 << bit);
-            fs->superblock->free_inode_count--;
-            fs->dirty = 1;
-            return i;
-        }
-    }
-
-    //log(LOG_ERROR, "No free inodes available");
-    return 0;
-}
-
-void rfss_free_inode(rfss_fs_t* fs, uint32_t inode) {
-    if (!fs || !fs->inode_bitmap || inode == 0 || inode > fs->superblock->inode_count) {
-        return;
+    if (!fs) {
+        return rfss_device_write(0, block, 1, buffer);
     }
 
-    uint32_t byte = (inode - 1) / 8;
-    uint32_t bit = (inode - 1) % 8;
-    if (fs->inode_bitmap[byte] & (1 << bit)) {
-        fs->inode_bitmap[byte] &= ~(1 << bit);
-        fs->superblock->free_inode_count++;
-        fs->dirty = 1;
-    }
+    return rfss_cache_write(fs, block, buffer);
 }
 
 int rfss_format(uint32_t device_id, const char* label) {
@@ -504,26 +285,39 @@ int rfss_format(uint32_t device_id, const char* label) {
     uint32_t sectors_per_block = RFSS_BLOCK_SIZE / ATA_SECTOR_SIZE;
     uint32_t total_blocks = total_sectors / sectors_per_block;
 
-    if (total_blocks < 81) {
-        //log(LOG_ERROR, "Drive too small for filesystem (need at least 81 blocks)");
+    // Layout: superblock, inode table, block bitmap, inode bitmap, summary, journal, root directory, data
+    uint32_t bitmap_blocks = (total_blocks + RFSS_BITMAP_BITS - 1) / RFSS_BITMAP_BITS;
+    uint32_t summary_blocks = (bitmap_blocks + RFSS_SUMMARY_ENTRIES - 1) / RFSS_SUMMARY_ENTRIES;
+    uint32_t inode_bitmap_block = 69 + bitmap_blocks;
+    uint32_t summary_block = inode_bitmap_block + 1;
+    uint32_t journal_block = summary_block + summary_blocks;
+    uint32_t root_block_num = journal_block + RFSS_JOURNAL_BLOCKS;
+    uint32_t reserved_blocks = root_block_num + 1;
+
+    if (total_blocks <= reserved_blocks) {
+        //log(LOG_ERROR, "Drive too small for filesystem (need at least %d blocks)", reserved_blocks + 1);
         return -1;
     }
 
+    rfss_cache_invalidate(device_id);
+    rfss_dcache_purge(device_id, 0);
+
+    static uint8_t superblock_buffer[RFSS_BLOCK_SIZE];
+    memset(superblock_buffer, 0, RFSS_BLOCK_SIZE);
     rfss_superblock_t superblock;
     memset(&superblock, 0, sizeof(rfss_superblock_t));
     superblock.magic = RFSS_MAGIC;
     superblock.version = RFSS_VERSION;
     superblock.block_size = RFSS_BLOCK_SIZE;
     superblock.total_blocks = total_blocks;
-    uint32_t reserved_blocks = 80;
     superblock.free_blocks = total_blocks - reserved_blocks;
     superblock.inode_table_block = 1;
     superblock.inode_count = 1024;
     superblock.free_inode_count = 1023;
     superblock.root_inode = 1;
     superblock.bitmap_block = 69;
-    superblock.journal_block = 71;
-    superblock.journal_size = 0;
+    superblock.journal_block = journal_block;
+    superblock.journal_size = RFSS_JOURNAL_BLOCKS;
     superblock.created_time = 0;
     superblock.modified_time = 0;
     superblock.mount_count = 0;
@@ -537,52 +331,71 @@ int rfss_format(uint32_t device_id, const char* label) {
     } else {
         strcpy(superblock.label, "RFSS_DRIVE");
     }
+    superblock.bitmap_blocks = bitmap_blocks;
+    superblock.inode_bitmap_block = inode_bitmap_block;
+    superblock.summary_block = summary_block;
+    superblock.summary_blocks = summary_blocks;
+    superblock.first_data_block = reserved_blocks;
+    superblock.features = RFSS_FEATURE_METADATA_CSUM;
     memset(superblock.reserved, 0, sizeof(superblock.reserved));
     //log(LOG_DEBUG, "Superblock: magic=0x%x, total_blocks=%d, free_blocks=%d", superblock.magic, superblock.total_blocks, superblock.free_blocks);
 
-    if (rfss_write_block(NULL, 0, &superblock) != 0) {
+    rfss_superblock_seal(&superblock);
+    memcpy(superblock_buffer, &superblock, sizeof(rfss_superblock_t));
+    if (rfss_device_write(device_id, 0, 1, superblock_buffer) != 0) {
         //log(LOG_ERROR, "Failed to write superblock");
         return -1;
     }
 
-    //log(LOG_DEBUG, "Initializing bitmaps");
-    uint32_t bitmap_size = (total_blocks + 7) / 8;
-    //log(LOG_DEBUG, "bitmap_size=%d", bitmap_size);
-    uint8_t* block_bitmap = kmalloc(RFSS_BLOCK_SIZE);
-    if (!block_bitmap) {
-        //log(LOG_ERROR, "Failed to allocate block bitmap");
+    // An empty journal superblock makes the first mount start a fresh log
+    memset(superblock_buffer, 0, RFSS_BLOCK_SIZE);
+    if (rfss_device_write(device_id, journal_block, 1, superblock_buffer) != 0) {
+        //log(LOG_ERROR, "Failed to clear journal");
         return -1;
     }
-    memset(block_bitmap, 0, RFSS_BLOCK_SIZE);
 
-    for (uint32_t i = 0; i < reserved_blocks && i < total_blocks; i++) {
-        uint32_t byte = i / 8;
-        uint32_t bit = i % 8;
-        if (byte < RFSS_BLOCK_SIZE) {
-            block_bitmap[byte] |= (1 << bit);
+    //log(LOG_DEBUG, "Initializing bitmaps");
+    static uint8_t bitmap_buffer[RFSS_BLOCK_SIZE];
+    static uint32_t summary_buffer[RFSS_SUMMARY_ENTRIES];
+
+    for (uint32_t i = 0; i < bitmap_blocks; i++) {
+        uint32_t base = i * RFSS_BITMAP_BITS;
+        uint32_t lo = reserved_blocks > base ? reserved_blocks - base : 0;
+        uint32_t hi = total_blocks - base < RFSS_BITMAP_BITS ? total_blocks - base : RFSS_BITMAP_BITS;
+        if (lo > hi) {
+            lo = hi;
         }
-    }
 
-    if (rfss_write_block(NULL, superblock.bitmap_block, block_bitmap) != 0) {
-        //log(LOG_ERROR, "Failed to write block bitmap");
-        kfree(block_bitmap);
-        return -1;
-    }
+        // Metadata blocks and the bits past the end of the volume are marked in use
+        memset(bitmap_buffer, 0, RFSS_BLOCK_SIZE);
+        for (uint32_t bit = 0; bit < RFSS_BITMAP_BITS; bit++) {
+            if (bit < lo || bit >= hi) {
+                bitmap_buffer[bit / 8] |= (1 << (bit % 8));
+            }
+        }
 
-    uint8_t* inode_bitmap = kmalloc(RFSS_BLOCK_SIZE);
-    if (!inode_bitmap) {
-        //log(LOG_ERROR, "Failed to allocate inode bitmap");
-        kfree(block_bitmap);
-        return -1;
+        if (i % RFSS_SUMMARY_ENTRIES == 0) {
+            memset(summary_buffer, 0, RFSS_BLOCK_SIZE);
+        }
+        summary_buffer[i % RFSS_SUMMARY_ENTRIES] = hi - lo;
+
+        if (rfss_device_write(device_id, superblock.bitmap_block + i, 1, bitmap_buffer) != 0) {
+            //log(LOG_ERROR, "Failed to write block bitmap");
+            return -1;
+        }
+
+        if ((i + 1) % RFSS_SUMMARY_ENTRIES == 0 || i + 1 == bitmap_blocks) {
+            if (rfss_device_write(device_id, summary_block + i / RFSS_SUMMARY_ENTRIES, 1, summary_buffer) != 0) {
+                //log(LOG_ERROR, "Failed to write bitmap summary");
+                return -1;
+            }
+        }
     }
-    memset(inode_bitmap, 0, RFSS_BLOCK_SIZE);
-    inode_bitmap[0] |= 1;
 
-    uint32_t inode_bitmap_block = superblock.bitmap_block + 1;
-    if (rfss_write_block(NULL, inode_bitmap_block, inode_bitmap) != 0) {
+    memset(bitmap_buffer, 0, RFSS_BLOCK_SIZE);
+    bitmap_buffer[0] |= 1;
+    if (rfss_device_write(device_id, inode_bitmap_block, 1, bitmap_buffer) != 0) {
         //log(LOG_ERROR, "Failed to write inode bitmap");
-        kfree(block_bitmap);
-        kfree(inode_bitmap);
         return -1;
     }
 
@@ -592,8 +405,6 @@ int rfss_format(uint32_t device_id, const char* label) {
     rfss_inode_t* inode_table = kmalloc(inode_blocks * RFSS_BLOCK_SIZE);
     if (!inode_table) {
         //log(LOG_ERROR, "Failed to allocate inode table");
-        kfree(block_bitmap);
-        kfree(inode_bitmap);
         return -1;
     }
     memset(inode_table, 0, inode_blocks * RFSS_BLOCK_SIZE);
@@ -604,15 +415,15 @@ int rfss_format(uint32_t device_id, const char* label) {
     inode_table[0].size = RFSS_BLOCK_SIZE;
     inode_table[0].links_count = 2;
     inode_table[0].blocks_count = 1;
-    inode_table[0].direct_blocks[0] = 79;
+    inode_table[0].direct_blocks[0] = root_block_num;
 
     for (uint32_t i = 0; i < inode_blocks; i++) {
-        if (rfss_write_block(NULL, superblock.inode_table_block + i, (uint8_t*)inode_table + i * RFSS_BLOCK_SIZE) != 0) {
-            kfree(block_bitmap);
-            kfree(inode_bitmap);
-            kfree(inode_table);
-            return -1;
-        }
+        rfss_inode_block_seal((uint8_t*)inode_table + i * RFSS_BLOCK_SIZE);
+    }
+
+    if (rfss_device_write(device_id, superblock.inode_table_block, inode_blocks, inode_table) != 0) {
+        kfree(inode_table);
+        return -1;
     }
 
     static uint8_t root_block[RFSS_BLOCK_SIZE];
@@ -628,32 +439,34 @@ int rfss_format(uint32_t device_id, const char* label) {
 
     rfss_dir_entry_t* dotdot_entry = (rfss_dir_entry_t*)(root_block + 12);
     dotdot_entry->inode = 1;
-    dotdot_entry->rec_len = RFSS_BLOCK_SIZE - 12;
+    dotdot_entry->rec_len = RFSS_BLOCK_SIZE - sizeof(rfss_dir_tail_t) - 12;
     dotdot_entry->name_len = 2;
     dotdot_entry->file_type = RFSS_FILE_DIRECTORY;
     dotdot_entry->name[0] = '.';
     dotdot_entry->name[1] = '.';
     memset(&dotdot_entry->name[2], 0, RFSS_MAX_FILENAME - 2);
+    rfss_dir_seal(root_block);
 
-    if (rfss_write_block(NULL, 79, root_block) != 0) {
+    if (rfss_device_write(device_id, root_block_num, 1, root_block) != 0) {
         //log(LOG_ERROR, "Failed to write root directory block");
-        kfree(block_bitmap);
-        kfree(inode_bitmap);
         kfree(inode_table);
         return -1;
     }
 
-    kfree(block_bitmap);
-    kfree(inode_bitmap);
     kfree(inode_table);
 
+    if (ata_flush_cache(device_id) != 0) {
+        //log(LOG_ERROR, "Failed to flush drive cache after format");
+        return -1;
+    }
+
     log(LOG_OK, "Filesystem formatted successfully on drive %d", device_id);
     return 0;
 }
 
 int rfss_mount(uint32_t device_id, rfss_fs_t* fs) {
-    if (!fs || mounted_fs) {
-        //log(LOG_ERROR, "Invalid mount parameters or filesystem already mounted");
+    if (!fs || device_id >= RFSS_MAX_MOUNTS || mounted_fs[device_id]) {
+        //log(LOG_ERROR, "Invalid mount parameters or device already mounted");
         return -1;
     }
 
@@ -663,13 +476,14 @@ int rfss_mount(uint32_t device_id, rfss_fs_t* fs) {
     }
 
     memset(fs, 0, sizeof(rfss_fs_t));
+    fs->device_id = device_id;
 
-    fs->superblock = kmalloc(sizeof(rfss_superblock_t));
+    fs->superblock = kmalloc(RFSS_BLOCK_SIZE);
     if (!fs->superblock) {
         //log(LOG_ERROR, "Failed to allocate superblock");
         return -1;
     }
-    memset(fs->superblock, 0, sizeof(rfss_superblock_t));
+    memset(fs->superblock, 0, RFSS_BLOCK_SIZE);
 
     if (rfss_read_block(fs, 0, fs->superblock) != 0) {
         //log(LOG_ERROR, "Failed to read superblock");
@@ -689,42 +503,40 @@ int rfss_mount(uint32_t device_id, rfss_fs_t* fs) {
         return -1;
     }
 
-    uint32_t bitmap_size = (fs->superblock->total_blocks + 7) / 8;
-    if (bitmap_size > RFSS_BLOCK_SIZE) {
-        bitmap_size = RFSS_BLOCK_SIZE;
-    }
-    fs->block_bitmap = kmalloc(RFSS_BLOCK_SIZE);
-    if (!fs->block_bitmap) {
-        //log(LOG_ERROR, "Failed to allocate block bitmap");
+    if (rfss_superblock_verify(fs->superblock) != 0) {
+        log(LOG_ERROR, "Superblock checksum mismatch");
+        rfss_cache_invalidate(device_id);
         kfree(fs->superblock);
         return -1;
     }
 
-    if (rfss_read_block(fs, fs->superblock->bitmap_block, fs->block_bitmap) != 0) {
-        //log(LOG_ERROR, "Failed to read block bitmap");
-        kfree(fs->superblock);
-        kfree(fs->block_bitmap);
-        return -1;
+    rfss_superblock_t* sb = fs->superblock;
+    if (sb->first_data_block == 0) {
+        sb->bitmap_blocks = 1;
+        sb->inode_bitmap_block = sb->bitmap_block + 1;
+        sb->summary_block = 0;
+        sb->summary_blocks = 0;
+        sb->first_data_block = RFSS_LEGACY_FIRST_DATA_BLOCK;
     }
 
-    uint32_t inode_bitmap_size = (fs->superblock->inode_count + 7) / 8;
-    if (inode_bitmap_size > RFSS_BLOCK_SIZE) {
-        inode_bitmap_size = RFSS_BLOCK_SIZE;
-    }
-    fs->inode_bitmap = kmalloc(RFSS_BLOCK_SIZE);
-    if (!fs->inode_bitmap) {
-        //log(LOG_ERROR, "Failed to allocate inode bitmap");
+    if (sb->first_data_block >= sb->total_blocks) {
+        //log(LOG_ERROR, "Invalid data area start: %d", sb->first_data_block);
         kfree(fs->superblock);
-        kfree(fs->block_bitmap);
         return -1;
     }
 
-    if (rfss_read_block(fs, fs->superblock->bitmap_block + 1, fs->inode_bitmap) != 0) {
-        //log(LOG_ERROR, "Failed to read inode bitmap");
-        kfree(fs->superblock);
-        kfree(fs->block_bitmap);
-        kfree(fs->inode_bitmap);
-        return -1;
+    // Committed transactions are redone before any metadata is read; block 0 may be among them
+    if (sb->journal_size >= RFSS_JOURNAL_MAX_BLOCKS + 3 && rfss_journal_replay(fs) > 0) {
+        if (rfss_read_block(fs, 0, fs->superblock) != 0) {
+            kfree(fs->superblock);
+            return -1;
+        }
+    }
+
+    // Legacy volumes larger than 128 MiB only ever used the part their single bitmap block covers
+    uint32_t block_bits = sb->total_blocks;
+    if (block_bits > sb->bitmap_blocks * RFSS_BITMAP_BITS) {
+        block_bits = sb->bitmap_blocks * RFSS_BITMAP_BITS;
     }
 
     uint32_t inodes_per_block = RFSS_BLOCK_SIZE / sizeof(rfss_inode_t);
@@ -733,78 +545,117 @@ int rfss_mount(uint32_t device_id, rfss_fs_t* fs) {
     if (!fs->inode_table) {
         //log(LOG_ERROR, "Failed to allocate inode table");
         kfree(fs->superblock);
-        kfree(fs->block_bitmap);
-        kfree(fs->inode_bitmap);
         return -1;
     }
 
-    for (uint32_t i = 0; i < inode_blocks; i++) {
-        if (rfss_read_block(fs, fs->superblock->inode_table_block + i, (uint8_t*)fs->inode_table + i * RFSS_BLOCK_SIZE) != 0) {
-            //log(LOG_ERROR, "Failed to read inode table block %d", i);
-            kfree(fs->superblock);
-            kfree(fs->block_bitmap);
-            kfree(fs->inode_bitmap);
-            kfree(fs->inode_table);
-            return -1;
-        }
+    if (rfss_cache_read_blocks(fs, fs->superblock->inode_table_block, inode_blocks, fs->inode_table) != 0) {
+        //log(LOG_ERROR, "Failed to read inode table");
+        kfree(fs->superblock);
+        kfree(fs->inode_table);
+        return -1;
+    }
+
+    if (rfss_icache_init(fs) != 0) {
+        //log(LOG_ERROR, "Failed to set up inode cache");
+        kfree(fs->superblock);
+        kfree(fs->inode_table);
+        return -1;
+    }
+
+    if (rfss_bitmap_init(fs, &fs->block_alloc, sb->bitmap_block, block_bits, sb->first_data_block, sb->summary_block) != 0 ||
+        rfss_bitmap_init(fs, &fs->inode_alloc, sb->inode_bitmap_block, sb->inode_count, 0, 0) != 0) {
+        //log(LOG_ERROR, "Failed to set up allocation bitmaps");
+        rfss_bitmap_release(&fs->block_alloc);
+        rfss_bitmap_release(&fs->inode_alloc);
+        kfree(fs->superblock);
+        kfree(fs->inode_table);
+        kfree(fs->inode_refs);
+        kfree(fs->inode_dirty);
+        return -1;
     }
 
     fs->current_dir_inode = fs->superblock->root_inode;
     strcpy(fs->current_path, "/");
-    fs->device_id = device_id;
     fs->mounted = 1;
     fs->dirty = 0;
-    fs->journaling_enabled = (fs->superblock->journal_size > 0);
-    if (fs->journaling_enabled) {
-        rfss_journal_init(fs);
-    }
+    fs->journaling_enabled = 0;
 
-    mounted_fs = fs;
+    mounted_fs[device_id] = fs;
 
     log(LOG_OK, "Filesystem mounted successfully");
     return 0;
 }
 
-int rfss_unmount(rfss_fs_t* fs) {
+// Allocates and writes buffered file data, writes back the dirty inodes, bitmaps and
+// superblock, then every dirty cached block
+int rfss_sync(rfss_fs_t* fs) {
     if (!fs || !fs->mounted) {
         return -1;
     }
 
+    int result = rfss_delalloc_flush(fs);
+
     if (fs->dirty) {
-        if (rfss_write_block(fs, 0, fs->superblock) != 0) {
-            //log(LOG_ERROR, "Failed to write back superblock");
+        if (rfss_sync_inodes(fs) != 0) {
+            //log(LOG_ERROR, "Failed to write back inode table");
+            result = -1;
         }
 
-        if (rfss_write_block(fs, fs->superblock->bitmap_block, fs->block_bitmap) != 0) {
-            //log(LOG_ERROR, "Failed to write back block bitmap");
+        if (rfss_bitmap_sync(fs, &fs->block_alloc) != 0 || rfss_bitmap_sync(fs, &fs->inode_alloc) != 0) {
+            //log(LOG_ERROR, "Failed to write back bitmaps");
+            result = -1;
         }
 
-        if (rfss_write_block(fs, fs->superblock->bitmap_block + 1, fs->inode_bitmap) != 0) {
-            //log(LOG_ERROR, "Failed to write back inode bitmap");
+        rfss_superblock_seal(fs->superblock);
+        if (rfss_write_block(fs, 0, fs->superblock) != 0) {
+            //log(LOG_ERROR, "Failed to write back superblock");
+            result = -1;
         }
 
-        uint32_t inodes_per_block = RFSS_BLOCK_SIZE / sizeof(rfss_inode_t);
-        uint32_t inode_blocks = (fs->superblock->inode_count + inodes_per_block - 1) / inodes_per_block;
-        for (uint32_t i = 0; i < inode_blocks; i++) {
-            if (rfss_write_block(fs, fs->superblock->inode_table_block + i, (uint8_t*)fs->inode_table + i * RFSS_BLOCK_SIZE) != 0) {
-                //log(LOG_ERROR, "Failed to write back inode table block %d", i);
-            }
+        if (result == 0) {
+            fs->dirty = 0;
         }
     }
 
+    if (fs->journaling_enabled && rfss_journal_flush(fs) != 0) {
+        result = -1;
+    }
+
+    if (rfss_cache_sync(fs) != 0) {
+        log(LOG_ERROR, "Failed to flush block cache");
+        result = -1;
+    }
+
+    return result;
+}
+
+int rfss_unmount(rfss_fs_t* fs) {
+    if (!fs || !fs->mounted) {
+        return -1;
+    }
+
+    rfss_sync(fs);
+    if (fs->journaling_enabled) {
+        rfss_journal_clear(fs);
+    }
+    rfss_cache_invalidate(fs->device_id);
+    rfss_dcache_purge(fs->device_id, 0);
+
     kfree(fs->superblock);
-    kfree(fs->block_bitmap);
-    kfree(fs->inode_bitmap);
     kfree(fs->inode_table);
+    kfree(fs->inode_refs);
+    kfree(fs->inode_dirty);
+    rfss_bitmap_release(&fs->block_alloc);
+    rfss_bitmap_release(&fs->inode_alloc);
 
+    mounted_fs[fs->device_id] = NULL;
     memset(fs, 0, sizeof(rfss_fs_t));
-    mounted_fs = NULL;
 
     log(LOG_OK, "Filesystem unmounted successfully");
     return 0;
 }
 
-int rfss_delete_file(rfss_fs_t* fs, const char* path) {
+static int rfss_delete_file_tx(rfss_fs_t* fs, const char* path) {
     if (!fs || !path || !fs->mounted) {
         return -1;
     }
@@ -825,67 +676,51 @@ int rfss_delete_file(rfss_fs_t* fs, const char* path) {
         return -1;
     }
 
-    for (int i = 0; i < RFSS_DIRECT_BLOCKS && inode->direct_blocks[i]; i++) {
-        rfss_free_block(fs, inode->direct_blocks[i]);
-    }
-
-    rfss_free_inode(fs, inode_num);
-
-    char* path_copy = kmalloc(strlen(path) + 1);
-    if (!path_copy) {
-        return -1;
-    }
-    strcpy(path_copy, path);
-
-    char* filename = strrchr(path_copy, '/');
-    if (filename) {
-        *filename = '\0';
-        filename++;
-    } else {
-        filename = path_copy;
-        path_copy = "/";
-    }
-
-    uint32_t parent_inode = rfss_resolve_path(fs, path_copy);
+    char filename[RFSS_MAX_FILENAME + 1];
+    uint32_t parent_inode = rfss_resolve_parent(fs, path, filename);
     if (parent_inode != 0) {
         rfss_inode_t* parent_inode_ptr = rfss_get_inode(fs, parent_inode);
         if (parent_inode_ptr) {
-            static uint8_t block_buffer[RFSS_BLOCK_SIZE];
-            for (int i = 0; i < RFSS_DIRECT_BLOCKS && parent_inode_ptr->direct_blocks[i]; i++) {
-                if (rfss_read_block(fs, parent_inode_ptr->direct_blocks[i], block_buffer) != 0) {
-                    continue;
-                }
-                uint32_t offset = 0;
-                while (offset < RFSS_BLOCK_SIZE) {
-                    rfss_dir_entry_t* entry = (rfss_dir_entry_t*)(block_buffer + offset);
-                    if (entry->rec_len == 0 || entry->rec_len > RFSS_BLOCK_SIZE - offset ||
-                        entry->rec_len < sizeof(rfss_dir_entry_t)) {
-                        break;
-                    }
-                    if (entry->inode == inode_num && entry->name_len == strlen(filename) &&
-                        memcmp(entry->name, filename, entry->name_len) == 0) {
-                        entry->inode = 0;
-                        rfss_write_block(fs, parent_inode_ptr->direct_blocks[i], block_buffer);
-                        break;
-                    }
-                    offset += entry->rec_len;
-                }
-            }
+            rfss_dir_remove(fs, parent_inode_ptr, filename);
         }
     }
 
-    kfree(path_copy);
+    rfss_dcache_purge(fs->device_id, inode_num);
+    rfss_release_inode(fs, inode_num);
     return 0;
 }
 
-int rfss_remove_directory(rfss_fs_t* fs, const char* path) {
+int rfss_delete_file(rfss_fs_t* fs, const char* path) {
     if (!fs || !path || !fs->mounted) {
         return -1;
     }
 
+    // A file nobody has open gives its blocks back a transaction at a time before its
+    // entry goes, so deleting a big one never needs more log space than one has
     uint32_t inode_num = rfss_resolve_path(fs, path);
-    if (inode_num == 0) {
-        //log(LOG_ERROR, "Directory not found: %s", path);
+    rfss_inode_t* inode = rfss_get_inode(fs, inode_num);
+    if (inode && ((inode->mode >> 12) & 0xF) == RFSS_FILE_REGULAR && fs->inode_refs[inode_num - 1].count == 0 &&
+        rfss_shrink_inode(fs, inode_num, inode, 0, NULL) != 0) {
+        return -1;
+    }
+
+    if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS) != 0) {
+        return -1;
+    }
+
+    int result = rfss_delete_file_tx(fs, path);
+    rfss_journal_commit_transaction(fs);
+    return result;
+}
+
+static int rfss_remove_directory_tx(rfss_fs_t* fs, const char* path) {
+    if (!fs || !path || !fs->mounted) {
+        return -1;
+    }
+
+    uint32_t inode_num = rfss_resolve_path(fs, path);
+    if (inode_num == 0) {
+        //log(LOG_ERROR, "Directory not found: %s", path);
         return -1;
     }
 
@@ -895,8 +730,9 @@ int rfss_remove_directory(rfss_fs_t* fs, const char* path) {
     }
 
     static uint8_t block_buffer[RFSS_BLOCK_SIZE];
-    for (int i = 0; i < RFSS_DIRECT_BLOCKS && inode->direct_blocks[i]; i++) {
-        if (rfss_read_block(fs, inode->direct_blocks[i], block_buffer) != 0) {
+    for (uint32_t i = 0; i < inode->blocks_count; i++) {
+        uint32_t block = rfss_dir_block(fs, inode, i);
+        if (block == 0 || rfss_read_block(fs, block, block_buffer) != 0) {
             continue;
         }
 
@@ -916,59 +752,98 @@ int rfss_remove_directory(rfss_fs_t* fs, const char* path) {
         }
     }
 
-    for (int i = 0; i < RFSS_DIRECT_BLOCKS && inode->direct_blocks[i]; i++) {
-        rfss_free_block(fs, inode->direct_blocks[i]);
+    char dirname[RFSS_MAX_FILENAME + 1];
+    uint32_t parent_inode = rfss_resolve_parent(fs, path, dirname);
+    if (parent_inode != 0) {
+        rfss_inode_t* parent_inode_ptr = rfss_get_inode(fs, parent_inode);
+        if (parent_inode_ptr) {
+            rfss_dir_remove(fs, parent_inode_ptr, dirname);
+        }
     }
 
-    rfss_free_inode(fs, inode_num);
+    rfss_dcache_purge(fs->device_id, inode_num);
+    rfss_release_inode(fs, inode_num);
+    return 0;
+}
 
-    char* path_copy = kmalloc(strlen(path) + 1);
-    if (!path_copy) {
+int rfss_remove_directory(rfss_fs_t* fs, const char* path) {
+    if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS) != 0) {
         return -1;
     }
-    strcpy(path_copy, path);
 
-    char* dirname = strrchr(path_copy, '/');
-    if (dirname) {
-        *dirname = '\0';
-        dirname++;
-    } else {
-        dirname = path_copy;
-        path_copy = "/";
+    int result = rfss_remove_directory_tx(fs, path);
+    rfss_journal_commit_transaction(fs);
+    return result;
+}
+
+static int rfss_rename_tx(rfss_fs_t* fs, const char* old_path, const char* new_path) {
+    if (!fs || !old_path || !new_path || !fs->mounted) {
+        return -1;
     }
 
-    uint32_t parent_inode = rfss_resolve_path(fs, path_copy);
-    if (parent_inode != 0) {
-        rfss_inode_t* parent_inode_ptr = rfss_get_inode(fs, parent_inode);
-        if (parent_inode_ptr) {
-            static uint8_t block_buffer[RFSS_BLOCK_SIZE];
-            for (int i = 0; i < RFSS_DIRECT_BLOCKS && parent_inode_ptr->direct_blocks[i]; i++) {
-                if (rfss_read_block(fs, parent_inode_ptr->direct_blocks[i], block_buffer) != 0) {
-                    continue;
-                }
-                uint32_t offset = 0;
-                while (offset < RFSS_BLOCK_SIZE) {
-                    rfss_dir_entry_t* entry = (rfss_dir_entry_t*)(block_buffer + offset);
-                    if (entry->rec_len == 0 || entry->rec_len > RFSS_BLOCK_SIZE - offset ||
-                        entry->rec_len < sizeof(rfss_dir_entry_t)) {
-                        break;
-                    }
-                    if (entry->inode == inode_num && entry->name_len == strlen(dirname) &&
-                        memcmp(entry->name, dirname, entry->name_len) == 0) {
-                        entry->inode = 0;
-                        rfss_write_block(fs, parent_inode_ptr->direct_blocks[i], block_buffer);
-                        break;
-                    }
-                    offset += entry->rec_len;
-                }
+    char old_name[RFSS_MAX_FILENAME + 1];
+    char new_name[RFSS_MAX_FILENAME + 1];
+    uint32_t inode_num = rfss_resolve_path(fs, old_path);
+    uint32_t old_parent = rfss_resolve_parent(fs, old_path, old_name);
+    uint32_t new_parent = rfss_resolve_parent(fs, new_path, new_name);
+    if (inode_num == 0 || old_parent == 0 || new_parent == 0 || inode_num == fs->superblock->root_inode) {
+        return -1;
+    }
+
+    if (rfss_find_file_in_directory(fs, new_parent, new_name) != 0) {
+        //log(LOG_ERROR, "Destination already exists: %s", new_path);
+        return -1;
+    }
+
+    rfss_inode_t* inode = rfss_get_inode(fs, inode_num);
+    if (!inode) {
+        return -1;
+    }
+    uint8_t type = (inode->mode >> 12) & 0xF;
+
+    if (type == RFSS_FILE_DIRECTORY) {
+        // A directory can't move underneath itself
+        uint32_t dir = new_parent;
+        while (dir != 0 && dir != fs->superblock->root_inode) {
+            rfss_inode_t* dir_inode = rfss_get_inode(fs, dir);
+            if (dir == inode_num || !dir_inode) {
+                return -1;
             }
+            dir = rfss_dir_parent(fs, dir_inode);
         }
     }
 
-    kfree(path_copy);
+    if (rfss_add_directory_entry(fs, new_parent, new_name, inode_num, type) != 0) {
+        return -1;
+    }
+
+    rfss_inode_t* parent_inode_ptr = rfss_get_inode(fs, old_parent);
+    if (parent_inode_ptr) {
+        rfss_dir_remove(fs, parent_inode_ptr, old_name);
+    }
+
+    if (type == RFSS_FILE_DIRECTORY && old_parent != new_parent) {
+        inode = rfss_get_inode(fs, inode_num);
+        if (inode) {
+            rfss_dir_set_parent(fs, inode, new_parent);
+        }
+    }
+
+    rfss_dcache_invalidate(fs, old_parent, old_name);
+    rfss_dcache_insert(fs, new_parent, new_name, inode_num);
     return 0;
 }
 
+int rfss_rename(rfss_fs_t* fs, const char* old_path, const char* new_path) {
+    if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS) != 0) {
+        return -1;
+    }
+
+    int result = rfss_rename_tx(fs, old_path, new_path);
+    rfss_journal_commit_transaction(fs);
+    return result;
+}
+
 int rfss_get_stats(rfss_fs_t* fs, uint32_t* total_blocks, uint32_t* free_blocks, uint32_t* total_inodes, uint32_t* free_inodes) {
     if (!fs || !fs->mounted) {
         return -1;
@@ -982,29 +857,24 @@ int rfss_get_stats(rfss_fs_t* fs, uint32_t* total_blocks, uint32_t* free_blocks,
     return 0;
 }
 
-int rfss_check_filesystem(rfss_fs_t* fs) {
-    if (!fs || !fs->mounted) {
-        return -1;
-    }
-
-    if (fs->superblock->magic != RFSS_MAGIC) {
-        //log(LOG_ERROR, "Invalid magic number");
-        return -1;
+void rfss_superblock_seal(rfss_superblock_t* sb) {
+    if (sb->features & RFSS_FEATURE_METADATA_CSUM) {
+        sb->checksum = rfss_crc32c(0, sb, sizeof(rfss_superblock_t) - sizeof(uint32_t));
     }
+}
 
-    if (fs->superblock->version != RFSS_VERSION) {
-        //log(LOG_ERROR, "Unsupported version");
-        return -1;
+int rfss_superblock_verify(const rfss_superblock_t* sb) {
+    if (!(sb->features & RFSS_FEATURE_METADATA_CSUM)) {
+        return 0;
     }
-
-    return 0;
+    return sb->checksum == rfss_crc32c(0, sb, sizeof(rfss_superblock_t) - sizeof(uint32_t)) ? 0 : -1;
 }
 
-rfss_fs_t* rfss_get_mounted_fs(void) {
-    return mounted_fs;
+rfss_fs_t* rfss_get_mount(uint32_t device_id) {
+    return device_id < RFSS_MAX_MOUNTS ? mounted_fs[device_id] : NULL;
 }
 
-int rfss_create_directory(rfss_fs_t* fs, const char* path) {
+static int rfss_create_directory_tx(rfss_fs_t* fs, const char* path) {
     if (!fs || !path || !fs->mounted || strlen(path) == 0 || strlen(path) > 255) {
         //log(LOG_ERROR, "Invalid parameters for create directory");
         return -1;
@@ -1098,14 +968,14 @@ int rfss_create_directory(rfss_fs_t* fs, const char* path) {
     
     rfss_dir_entry_t* dotdot_entry = (rfss_dir_entry_t*)(block_buffer + 12);
     dotdot_entry->inode = parent_inode;
-    dotdot_entry->rec_len = RFSS_BLOCK_SIZE - 12;
+    dotdot_entry->rec_len = rfss_dir_block_end(fs) - 12;
     dotdot_entry->name_len = 2;
     dotdot_entry->file_type = RFSS_FILE_DIRECTORY;
     dotdot_entry->name[0] = '.';
     dotdot_entry->name[1] = '.';
     memset(&dotdot_entry->name[2], 0, RFSS_MAX_FILENAME - 2);
     
-    if (rfss_write_block(fs, dir_block, block_buffer) != 0) {
+    if (rfss_dir_write_block(fs, dir_block, block_buffer) != 0) {
         //log(LOG_ERROR, "Failed to write directory block");
         rfss_free_block(fs, dir_block);
         rfss_free_inode(fs, new_inode_num);
@@ -1128,12 +998,23 @@ int rfss_create_directory(rfss_fs_t* fs, const char* path) {
         kfree(path_copy);
         return -1;
     }
+    rfss_dcache_insert(fs, parent_inode, dirname, new_inode_num);
     
     //log(LOG_DEBUG, "Successfully created directory: %s", path);
     kfree(path_copy);
     return 0;
 }
 
+int rfss_create_directory(rfss_fs_t* fs, const char* path) {
+    if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS) != 0) {
+        return -1;
+    }
+
+    int result = rfss_create_directory_tx(fs, path);
+    rfss_journal_commit_transaction(fs);
+    return result;
+}
+
 int rfss_open_file(rfss_fs_t* fs, const char* path, int flags, rfss_file_t* file) {
     if (!fs || !path || !file || !fs->mounted) {
         //log(LOG_ERROR, "Invalid parameters for open file");
@@ -1146,33 +1027,32 @@ int rfss_open_file(rfss_fs_t* fs, const char* path, int flags, rfss_file_t* file
         return -1;
     }
     
-    rfss_inode_t* inode = rfss_get_inode(fs, inode_num);
-    if (!inode) {
-        //log(LOG_ERROR, "Failed to get inode %d", inode_num);
-        return -1;
-    }
-    
-    file->inode = kmalloc(sizeof(rfss_inode_t));
+    file->inode = rfss_iget(fs, inode_num);
     if (!file->inode) {
-        //log(LOG_ERROR, "Memory allocation failed for file inode");
+        //log(LOG_ERROR, "Failed to get inode %d", inode_num);
         return -1;
     }
     
-    memcpy(file->inode, inode, sizeof(rfss_inode_t));
     file->inode_num = inode_num;
     file->position = 0;
     file->flags = flags;
     file->fs = fs;
+    memset(&file->map_cache, 0, sizeof(file->map_cache));
+    file->ra_pos = 0;
+    file->ra_window = 0;
+    file->ra_end = 0;
 
     // Truncate file if opened for writing
     if (flags & 1) {
-        for (int i = 0; i < RFSS_DIRECT_BLOCKS && file->inode->direct_blocks[i]; i++) {
-            rfss_free_block(fs, file->inode->direct_blocks[i]);
-            file->inode->direct_blocks[i] = 0;
+        if (rfss_shrink_inode(fs, inode_num, file->inode, 0, NULL) != 0 ||
+            rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS) != 0) {
+            rfss_iput(fs, inode_num);
+            return -1;
         }
+        rfss_free_file_blocks(fs, file->inode);
         file->inode->size = 0;
-        file->inode->blocks_count = 0;
         rfss_write_inode(fs, inode_num, file->inode);
+        rfss_journal_commit_transaction(fs);
     }
     
     //log(LOG_DEBUG, "Opened file: %s (inode %d)", path, inode_num);
@@ -1184,7 +1064,7 @@ int rfss_close_file(rfss_file_t* file) {
         return -1;
     }
     
-    kfree(file->inode);
+    rfss_iput(file->fs, file->inode_num);
     memset(file, 0, sizeof(rfss_file_t));
     return 0;
 }
@@ -1201,72 +1081,152 @@ int rfss_read_file(rfss_file_t* file, void* buffer, size_t size) {
     if (file->position + size > file->inode->size) {
         size = file->inode->size - file->position;
     }
+
+    if (file->inode->flags & RFSS_INODE_FLAG_INLINE) {
+        return rfss_inline_read(file, buffer, size);
+    }
+
+    if (rfss_delalloc_flush_inode(file->fs, file->inode) != 0) {
+        return -1;
+    }
     
     size_t bytes_read = 0;
-    static uint8_t block_buffer[RFSS_BLOCK_SIZE];
+    static uint8_t journal_buffer[RFSS_BLOCK_SIZE];
+
+    // Reads that pick up where the last one ended keep readahead going; a seek turns it off
+    if (file->position != file->ra_pos) {
+        file->ra_window = 0;
+        file->ra_end = 0;
+    } else if (file->ra_window == 0) {
+        file->ra_window = RFSS_READAHEAD_MIN;
+    }
+    uint32_t file_blocks = (file->inode->size + RFSS_BLOCK_SIZE - 1) / RFSS_BLOCK_SIZE;
     
     while (bytes_read < size) {
         uint32_t block_index = (file->position + bytes_read) / RFSS_BLOCK_SIZE;
         uint32_t block_offset = (file->position + bytes_read) % RFSS_BLOCK_SIZE;
-        uint32_t block_num = 0;
-        
-        if (block_index < RFSS_DIRECT_BLOCKS) {
-            block_num = file->inode->direct_blocks[block_index];
-        }
+        uint32_t run = 0;
+        uint32_t block_num = rfss_map_block(file->fs, file->inode, block_index, &run, &file->map_cache);
         
         if (block_num == 0) {
             break;
         }
-        
-        if (rfss_read_block(file->fs, block_num, block_buffer) != 0) {
-            break;
+
+        // Whole blocks go straight into the caller's buffer, a contiguous run per request;
+        // a partial block is copied out of the buffer cache
+        uint32_t count = 1;
+        if (block_offset == 0 && size - bytes_read >= RFSS_BLOCK_SIZE) {
+            uint32_t whole = (size - bytes_read) / RFSS_BLOCK_SIZE;
+            count = run < whole ? run : whole;
         }
-        
-        size_t copy_size = RFSS_BLOCK_SIZE - block_offset;
+
+        // Small sequential reads fill the cache a window at a time, doubling the window
+        // each time the reader catches up with it
+        if (count == 1 && file->ra_window > 0 && block_index >= file->ra_end) {
+            uint32_t ahead = file->ra_window;
+            if (ahead > run) {
+                ahead = run;
+            }
+            if (ahead > file_blocks - block_index) {
+                ahead = file_blocks - block_index;
+            }
+
+            rfss_cache_readahead(file->fs, block_num, ahead);
+            file->ra_end = block_index + ahead;
+            if (file->ra_window < RFSS_READAHEAD_MAX) {
+                file->ra_window *= 2;
+            }
+        }
+
+        size_t copy_size = count * RFSS_BLOCK_SIZE - block_offset;
         if (copy_size > size - bytes_read) {
             copy_size = size - bytes_read;
         }
+
+        uint8_t* dest = (uint8_t*)buffer + bytes_read;
+        int result;
+        if (copy_size % RFSS_BLOCK_SIZE == 0) {
+            result = rfss_cache_read_blocks(file->fs, block_num, count, dest);
+        } else if (file->fs->journaling_enabled && rfss_journal_read_block(file->fs, block_num, journal_buffer) == 0) {
+            memcpy(dest, journal_buffer + block_offset, copy_size);
+            result = 0;
+        } else {
+            result = rfss_cache_read_range(file->fs, block_num, block_offset, copy_size, dest);
+        }
+
+        if (result != 0) {
+            break;
+        }
         
-        memcpy((uint8_t*)buffer + bytes_read, block_buffer + block_offset, copy_size);
         bytes_read += copy_size;
     }
     
     file->position += bytes_read;
+    file->ra_pos = file->position;
     return bytes_read;
 }
 
-int rfss_write_file(rfss_file_t* file, const void* buffer, size_t size) {
-    if (!file || !file->inode || !buffer || !file->fs || size == 0) {
-        return -1;
-    }
-    
+static int rfss_write_file_tx(rfss_file_t* file, const void* buffer, size_t size) {
     size_t bytes_written = 0;
     static uint8_t block_buffer[RFSS_BLOCK_SIZE];
     
     while (bytes_written < size) {
         uint32_t block_index = (file->position + bytes_written) / RFSS_BLOCK_SIZE;
         uint32_t block_offset = (file->position + bytes_written) % RFSS_BLOCK_SIZE;
-        uint32_t block_num = 0;
-        
-        if (block_index < RFSS_DIRECT_BLOCKS) {
-            if (file->inode->direct_blocks[block_index] == 0) {
-                file->inode->direct_blocks[block_index] = rfss_allocate_block(file->fs);
-                if (file->inode->direct_blocks[block_index] == 0) {
-                    break;
-                }
-                file->inode->blocks_count++;
-                memset(block_buffer, 0, RFSS_BLOCK_SIZE);
-            } else {
-                if (rfss_read_block(file->fs, file->inode->direct_blocks[block_index], block_buffer) != 0) {
-                    break;
+
+        // New blocks are buffered until the file is flushed. Writes too big for the
+        // buffer allocate everything they need at once so it lands in one run.
+        if (block_index >= file->inode->blocks_count) {
+            uint32_t end_block = (file->position + size + RFSS_BLOCK_SIZE - 1) / RFSS_BLOCK_SIZE;
+            uint8_t* pending = NULL;
+            if (end_block - file->inode->blocks_count <= RFSS_DELALLOC_BLOCKS) {
+                pending = rfss_delalloc_block(file->fs, file->inode, file->inode_num, block_index);
+            }
+
+            if (pending) {
+                size_t copy_size = RFSS_BLOCK_SIZE - block_offset;
+                if (copy_size > size - bytes_written) {
+                    copy_size = size - bytes_written;
                 }
+                memcpy(pending + block_offset, (const uint8_t*)buffer + bytes_written, copy_size);
+                bytes_written += copy_size;
+                continue;
+            }
+
+            // Full buffer: flush it and try again from the new end of the file
+            uint32_t allocated = file->inode->blocks_count;
+            if (rfss_delalloc_flush_inode(file->fs, file->inode) != 0) {
+                break;
+            }
+            if (file->inode->blocks_count != allocated) {
+                continue;
+            }
+            if (rfss_extend_file(file->fs, file->inode, end_block - file->inode->blocks_count, &file->map_cache) == 0) {
+                break;
             }
-            block_num = file->inode->direct_blocks[block_index];
         }
-        
+
+        uint32_t run = 0;
+        uint32_t block_num = rfss_map_block(file->fs, file->inode, block_index, &run, &file->map_cache);
         if (block_num == 0) {
             break;
         }
+
+        uint32_t whole_blocks = (size - bytes_written) / RFSS_BLOCK_SIZE;
+        if (block_offset == 0 && whole_blocks > 0 && !file->fs->journaling_enabled) {
+            uint32_t count = run < whole_blocks ? run : whole_blocks;
+            if (rfss_cache_write_blocks(file->fs, block_num, count, (const uint8_t*)buffer + bytes_written) != 0) {
+                break;
+            }
+            bytes_written += count * RFSS_BLOCK_SIZE;
+            continue;
+        }
+
+        if ((uint64_t)block_index * RFSS_BLOCK_SIZE >= file->inode->size) {
+            memset(block_buffer, 0, RFSS_BLOCK_SIZE);
+        } else if (rfss_read_block(file->fs, block_num, block_buffer) != 0) {
+            break;
+        }
         
         size_t copy_size = RFSS_BLOCK_SIZE - block_offset;
         if (copy_size > size - bytes_written) {
@@ -1291,6 +1251,241 @@ int rfss_write_file(rfss_file_t* file, const void* buffer, size_t size) {
     return bytes_written;
 }
 
+int rfss_write_file(rfss_file_t* file, const void* buffer, size_t size) {
+    if (!file || !file->inode || !buffer || !file->fs || size == 0) {
+        return -1;
+    }
+
+    rfss_fs_t* fs = file->fs;
+    int result;
+
+    // Small files live in the inode until they outgrow it
+    if (rfss_inline_fits(file->inode, file->position + size)) {
+        if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS) != 0) {
+            return -1;
+        }
+        result = rfss_inline_write(file, buffer, size);
+        rfss_journal_commit_transaction(fs);
+        return result;
+    }
+    if (file->inode->flags & RFSS_INODE_FLAG_INLINE) {
+        if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS + RFSS_DELALLOC_BLOCKS) != 0) {
+            return -1;
+        }
+        result = rfss_inline_spill(fs, file->inode, file->inode_num);
+        rfss_journal_commit_transaction(fs);
+        if (result != 0) {
+            return -1;
+        }
+    }
+
+    // The journal takes data a block at a time, so a journaled write goes a few blocks
+    // per transaction. Each may also write back a full delayed allocation buffer.
+    size_t chunk = fs->journaling_enabled ? RFSS_JOURNAL_WRITE_BLOCKS * RFSS_BLOCK_SIZE : size;
+    size_t bytes_written = 0;
+    while (bytes_written < size) {
+        size_t count = size - bytes_written < chunk ? size - bytes_written : chunk;
+        if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_WRITE_BLOCKS + RFSS_DELALLOC_BLOCKS + 2 * RFSS_JOURNAL_OP_BLOCKS) != 0) {
+            break;
+        }
+        result = rfss_write_file_tx(file, (const uint8_t*)buffer + bytes_written, count);
+        rfss_journal_commit_transaction(fs);
+
+        bytes_written += result;
+        if ((size_t)result != count) {
+            break;
+        }
+    }
+
+    return bytes_written;
+}
+
+// Cuts the inode down to `size` bytes, which must not be past its end. The tail of the
+// new last block is cleared so the old bytes don't come back if the file grows again.
+// Buffered blocks are dropped; callers that keep data flush them first. On a journaled
+// volume the blocks go back RFSS_JOURNAL_SHRINK_BLOCKS per transaction from the end,
+// with the size following, so a big file never needs more log space than one has.
+int rfss_shrink_inode(rfss_fs_t* fs, uint32_t inode_num, rfss_inode_t* inode, uint64_t size, rfss_map_cache_t* cache) {
+    static uint8_t block_buffer[RFSS_BLOCK_SIZE];
+
+    rfss_delalloc_drop(fs, inode);
+    if (inode->flags & RFSS_INODE_FLAG_INLINE) {
+        return 0;
+    }
+
+    uint32_t keep = (size + RFSS_BLOCK_SIZE - 1) / RFSS_BLOCK_SIZE;
+    uint32_t tail = size % RFSS_BLOCK_SIZE;
+    do {
+        uint32_t count = keep;
+        if (fs->journaling_enabled && inode->blocks_count > keep + RFSS_JOURNAL_SHRINK_BLOCKS) {
+            count = inode->blocks_count - RFSS_JOURNAL_SHRINK_BLOCKS;
+        }
+
+        // Every block freed may log a different bitmap block
+        if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS + RFSS_JOURNAL_SHRINK_BLOCKS) != 0) {
+            return -1;
+        }
+
+        if (count == keep && tail != 0) {
+            uint32_t run = 0;
+            uint32_t block_num = rfss_map_block(fs, inode, keep - 1, &run, cache);
+            if (block_num != 0) {
+                if (rfss_read_block(fs, block_num, block_buffer) != 0) {
+                    rfss_journal_commit_transaction(fs);
+                    return -1;
+                }
+                memset(block_buffer + tail, 0, RFSS_BLOCK_SIZE - tail);
+                if (rfss_write_block(fs, block_num, block_buffer) != 0) {
+                    rfss_journal_commit_transaction(fs);
+                    return -1;
+                }
+            }
+        }
+
+        rfss_shrink_file(fs, inode, count, cache);
+        uint64_t limit = count == keep ? size : (uint64_t)count * RFSS_BLOCK_SIZE;
+        if (inode->size > limit) {
+            inode->size = limit;
+        }
+        rfss_write_inode(fs, inode_num, inode);
+        rfss_journal_commit_transaction(fs);
+    } while (inode->blocks_count > keep);
+
+    return 0;
+}
+
+int rfss_truncate_file(rfss_file_t* file, uint64_t size) {
+    if (!file || !file->inode || !file->fs || size > file->inode->size) {
+        return -1;
+    }
+
+    if (file->inode->flags & RFSS_INODE_FLAG_INLINE) {
+        if (rfss_journal_start_transaction(file->fs, RFSS_JOURNAL_OP_BLOCKS) != 0) {
+            return -1;
+        }
+        int result = rfss_inline_truncate(file, size);
+        rfss_journal_commit_transaction(file->fs);
+        return result;
+    }
+
+    if (rfss_delalloc_flush_inode(file->fs, file->inode) != 0 ||
+        rfss_shrink_inode(file->fs, file->inode_num, file->inode, size, &file->map_cache) != 0) {
+        return -1;
+    }
+
+    if (file->position > size) {
+        file->position = size;
+    }
+    file->ra_window = 0;
+    file->ra_end = 0;
+    return 0;
+}
+
+// Copies size bytes from src to dst at their current positions and advances both. The
+// destination is allocated up front, then block-aligned stretches move a contiguous run
+// per request without touching the caller or the inode; anything else goes through the
+// regular read and write paths.
+int rfss_copy_file_range(rfss_file_t* src, rfss_file_t* dst, size_t size) {
+    if (!src || !dst || !src->inode || !dst->inode || !src->fs || src->fs != dst->fs || src->inode == dst->inode) {
+        return -1;
+    }
+
+    rfss_fs_t* fs = src->fs;
+    if (src->position >= src->inode->size) {
+        return 0;
+    }
+    if (rfss_delalloc_flush_inode(fs, src->inode) != 0 || rfss_delalloc_flush_inode(fs, dst->inode) != 0) {
+        return -1;
+    }
+    if (src->position + size > src->inode->size) {
+        size = src->inode->size - src->position;
+    }
+
+    static uint8_t copy_buffer[RFSS_COPY_CHUNK_BLOCKS * RFSS_BLOCK_SIZE];
+    size_t copied = 0;
+
+    // A destination that stays inline is filled by rfss_write_file; one that won't has
+    // to be in blocks before they are allocated
+    if (!rfss_inline_fits(dst->inode, dst->position + size)) {
+        if (dst->inode->flags & RFSS_INODE_FLAG_INLINE) {
+            if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS + RFSS_DELALLOC_BLOCKS) != 0) {
+                return -1;
+            }
+            int result = rfss_inline_spill(fs, dst->inode, dst->inode_num);
+            rfss_journal_commit_transaction(fs);
+            if (result != 0 || rfss_delalloc_flush_inode(fs, dst->inode) != 0) {
+                return -1;
+            }
+        }
+
+        // Journaled copies go through rfss_write_file, which allocates as it goes
+        uint32_t end_block = (dst->position + size + RFSS_BLOCK_SIZE - 1) / RFSS_BLOCK_SIZE;
+        if (!fs->journaling_enabled && end_block > dst->inode->blocks_count &&
+            rfss_extend_file(fs, dst->inode, end_block - dst->inode->blocks_count, &dst->map_cache) == 0) {
+            return -1;
+        }
+    }
+
+    while (copied < size) {
+        size_t remaining = size - copied;
+        uint32_t src_offset = src->position % RFSS_BLOCK_SIZE;
+        uint32_t dst_offset = dst->position % RFSS_BLOCK_SIZE;
+
+        if (src_offset == 0 && dst_offset == 0 && remaining >= RFSS_BLOCK_SIZE && !fs->journaling_enabled) {
+            uint32_t src_run = 0;
+            uint32_t dst_run = 0;
+            uint32_t src_block = rfss_map_block(fs, src->inode, src->position / RFSS_BLOCK_SIZE, &src_run, &src->map_cache);
+            uint32_t dst_block = rfss_map_block(fs, dst->inode, dst->position / RFSS_BLOCK_SIZE, &dst_run, &dst->map_cache);
+            if (src_block == 0 || dst_block == 0) {
+                break;
+            }
+
+            uint32_t count = remaining / RFSS_BLOCK_SIZE;
+            if (count > src_run) count = src_run;
+            if (count > dst_run) count = dst_run;
+            if (count > RFSS_COPY_CHUNK_BLOCKS) count = RFSS_COPY_CHUNK_BLOCKS;
+
+            if (rfss_cache_read_blocks(fs, src_block, count, copy_buffer) != 0 ||
+                rfss_cache_write_blocks(fs, dst_block, count, copy_buffer) != 0) {
+                break;
+            }
+
+            src->position += count * RFSS_BLOCK_SIZE;
+            dst->position += count * RFSS_BLOCK_SIZE;
+            copied += count * RFSS_BLOCK_SIZE;
+            continue;
+        }
+
+        // Stop at the next source block boundary so the rest can take the run path
+        size_t chunk = remaining < sizeof(copy_buffer) ? remaining : sizeof(copy_buffer);
+        if (src_offset != 0 && src_offset == dst_offset && chunk > RFSS_BLOCK_SIZE - src_offset) {
+            chunk = RFSS_BLOCK_SIZE - src_offset;
+        }
+
+        int bytes_read = rfss_read_file(src, copy_buffer, chunk);
+        if (bytes_read <= 0) {
+            break;
+        }
+        int bytes_written = rfss_write_file(dst, copy_buffer, bytes_read);
+        if (bytes_written > 0) {
+            copied += bytes_written;
+        }
+        if (bytes_written != bytes_read) {
+            break;
+        }
+    }
+
+    if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS) != 0) {
+        return copied;
+    }
+    if (dst->position > dst->inode->size) {
+        dst->inode->size = dst->position;
+    }
+    rfss_write_inode(fs, dst->inode_num, dst->inode);
+    rfss_journal_commit_transaction(fs);
+    return copied;
+}
+
 int rfss_change_directory(rfss_fs_t* fs, const char* path) {
     if (!fs || !path || !fs->mounted) {
         return -1;
@@ -1336,8 +1531,9 @@ int rfss_list_directory(rfss_fs_t* fs, const char* path, rfss_dir_entry_t** entr
     *entries = NULL;
     
     static uint8_t block_buffer[RFSS_BLOCK_SIZE];
-    for (int i = 0; i < RFSS_DIRECT_BLOCKS && inode->direct_blocks[i]; i++) {
-        if (rfss_read_block(fs, inode->direct_blocks[i], block_buffer) != 0) {
+    for (uint32_t i = 0; i < inode->blocks_count; i++) {
+        uint32_t block = rfss_dir_block(fs, inode, i);
+        if (block == 0 || rfss_read_block(fs, block, block_buffer) != 0) {
             continue;
         }
         
@@ -1361,46 +1557,15 @@ int rfss_list_directory(rfss_fs_t* fs, const char* path, rfss_dir_entry_t** entr
         return 0;
     }
     
-    int rfss_enable_journaling(rfss_fs_t* fs) {
-        if (!fs || !fs->mounted) {
-            return -1;
-        }
-    
-        if (fs->superblock->journal_size == 0) {
-            //log(LOG_ERROR, "Journal not configured in superblock");
-            return -1;
-        }
-    
-        if (!fs->journaling_enabled) {
-            fs->journaling_enabled = 1;
-            rfss_journal_init(fs);
-            log(LOG_OK, "Journaling enabled");
-        }
-    
-        return 0;
-    }
-    
-    int rfss_disable_journaling(rfss_fs_t* fs) {
-        if (!fs || !fs->mounted) {
-            return -1;
-        }
-    
-        if (fs->journaling_enabled) {
-            fs->journaling_enabled = 0;
-            log(LOG_OK, "Journaling disabled");
-        }
-    
-        return 0;
-    }
-    
     *entries = kmalloc(*count * sizeof(rfss_dir_entry_t));
     if (!*entries) {
         return -1;
     }
     
     int entry_index = 0;
-    for (int i = 0; i < RFSS_DIRECT_BLOCKS && inode->direct_blocks[i] && entry_index < *count; i++) {
-        if (rfss_read_block(fs, inode->direct_blocks[i], block_buffer) != 0) {
+    for (uint32_t i = 0; i < inode->blocks_count && entry_index < *count; i++) {
+        uint32_t block = rfss_dir_block(fs, inode, i);
+        if (block == 0 || rfss_read_block(fs, block, block_buffer) != 0) {
             continue;
         }
         
@@ -1422,4 +1587,42 @@ int rfss_list_directory(rfss_fs_t* fs, const char* path, rfss_dir_entry_t** entr
     }
     
     return 0;
-}
\ No newline at end of file
+}
+
+int rfss_enable_journaling(rfss_fs_t* fs) {
+    if (!fs || !fs->mounted) {
+        return -1;
+    }
+
+    if (fs->superblock->journal_size < RFSS_JOURNAL_MAX_BLOCKS + 3) {
+        //log(LOG_ERROR, "Journal not configured in superblock");
+        return -1;
+    }
+
+    if (!fs->journaling_enabled) {
+        // Anything still dirty predates the journal and must not mix with logged blocks
+        if (rfss_sync(fs) != 0 || rfss_journal_init(fs) != 0) {
+            return -1;
+        }
+        fs->journaling_enabled = 1;
+        log(LOG_OK, "Journaling enabled");
+    }
+
+    return 0;
+}
+
+int rfss_disable_journaling(rfss_fs_t* fs) {
+    if (!fs || !fs->mounted) {
+        return -1;
+    }
+
+    if (fs->journaling_enabled) {
+        if (rfss_journal_clear(fs) != 0) {
+            return -1;
+        }
+        fs->journaling_enabled = 0;
+        log(LOG_OK, "Journaling disabled");
+    }
+
+    return 0;
+}
@@ -13,6 +13,43 @@
 #define RFSS_DOUBLE_INDIRECT_BLOCKS 1
 #define RFSS_TRIPLE_INDIRECT_BLOCKS 1
 #define RFSS_MAX_EXTENTS 8
+#define RFSS_CACHE_MAX_BLOCKS 256
+#define RFSS_MAX_MOUNTS 4
+#define RFSS_CACHE_DEFAULT_BLOCKS 128
+#define RFSS_ALLOC_REGION_BITS 1024
+#define RFSS_BITMAP_NONE 0xFFFFFFFF
+#define RFSS_BITMAP_BITS (RFSS_BLOCK_SIZE * 8)
+#define RFSS_BITMAP_REGIONS (RFSS_BITMAP_BITS / RFSS_ALLOC_REGION_BITS)
+#define RFSS_BITMAP_SLOTS 2
+#define RFSS_SUMMARY_ENTRIES (RFSS_BLOCK_SIZE / sizeof(uint32_t))
+#define RFSS_LEGACY_FIRST_DATA_BLOCK 80
+#define RFSS_READAHEAD_MIN 4
+#define RFSS_READAHEAD_MAX 32
+#define RFSS_COPY_CHUNK_BLOCKS 32
+#define RFSS_JOURNAL_BLOCKS 256
+#define RFSS_JOURNAL_MAX_BLOCKS 128
+#define RFSS_JOURNAL_GROUP_BLOCKS 16
+// Log space reserved by one metadata operation, and the file blocks rfss_write_file and
+// truncation handle per transaction on a journaled volume
+#define RFSS_JOURNAL_OP_BLOCKS 24
+#define RFSS_JOURNAL_WRITE_BLOCKS 16
+#define RFSS_JOURNAL_SHRINK_BLOCKS 64
+#define RFSS_MAP_CACHE_ENTRIES 128
+#define RFSS_DCACHE_SIZE 512
+#define RFSS_DCACHE_NAME_MAX 48
+#define RFSS_FSCK_PASSES 4
+#define RFSS_DELALLOC_FILES 4
+#define RFSS_DELALLOC_BLOCKS 32
+#define RFSS_DEFRAG_SCAN 64
+#define RFSS_DEFRAG_CHUNK_BLOCKS 16
+
+#define RFSS_FEATURE_METADATA_CSUM 0x1
+
+#define RFSS_INODE_FLAG_EXTENTS 0x1
+#define RFSS_INODE_FLAG_INDEX 0x2
+// Regular file whose data sits in the inode itself, over the block map and extent fields
+#define RFSS_INODE_FLAG_INLINE 0x4
+#define RFSS_DX_MAGIC 0x58445352
 
 typedef enum {
     RFSS_FILE_REGULAR = 1,
@@ -47,7 +84,17 @@ typedef struct {
     uint32_t errors;
     uint8_t uuid[16];
     char label[16];
-    uint8_t reserved[928];
+    // Zero in volumes formatted before multi-block bitmaps; rfss_mount fills in the
+    // legacy layout (one bitmap block each, data from block 80)
+    uint32_t bitmap_blocks;
+    uint32_t inode_bitmap_block;
+    uint32_t summary_block;
+    uint32_t summary_blocks;
+    uint32_t first_data_block;
+    uint32_t features;
+    uint8_t reserved[900];
+    // CRC32C of everything above, when RFSS_FEATURE_METADATA_CSUM is set
+    uint32_t checksum;
 } __attribute__((packed)) rfss_superblock_t;
 
 typedef struct {
@@ -70,6 +117,10 @@ typedef struct {
     uint8_t reserved[64];
 } __attribute__((packed)) rfss_inode_t;
 
+#define RFSS_INLINE_DATA_SIZE (sizeof(rfss_inode_t) - offsetof(rfss_inode_t, direct_blocks))
+#define RFSS_INLINE_DATA(inode) ((uint8_t*)(inode) + offsetof(rfss_inode_t, direct_blocks))
+#define RFSS_INODES_PER_BLOCK (RFSS_BLOCK_SIZE / sizeof(rfss_inode_t))
+
 typedef struct {
     uint32_t inode;
     uint16_t rec_len;
@@ -78,70 +129,281 @@ typedef struct {
     char name[RFSS_MAX_FILENAME];
 } __attribute__((packed)) rfss_dir_entry_t;
 
+// Closes every directory block on checksummed volumes. Its rec_len is too short for a
+// real entry, so directory scans stop in front of it.
+typedef struct {
+    uint32_t inode;
+    uint16_t rec_len;
+    uint8_t name_len;
+    uint8_t file_type;
+    uint32_t checksum;
+} __attribute__((packed)) rfss_dir_tail_t;
+
+// Hash index block header, followed by `count` entries sorted by hash. The root copy
+// lives in directory block 0 behind the '..' entry.
+typedef struct {
+    uint32_t magic;
+    uint16_t levels;
+    uint16_t count;
+    uint16_t limit;
+    uint16_t reserved;
+} __attribute__((packed)) rfss_dx_header_t;
+
+typedef struct {
+    uint32_t hash;
+    uint32_t block;
+} __attribute__((packed)) rfss_dx_entry_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t sequence;
+    uint32_t start;
+    uint32_t checksum;
+} __attribute__((packed)) rfss_journal_super_t;
+
+// Descriptor and commit records share this layout. A descriptor lists the home block of
+// each data block that follows it; the commit checksum covers the descriptor and data.
 typedef struct {
-    uint32_t transaction_id;
-    uint32_t block_count;
-    uint64_t timestamp;
+    uint32_t magic;
+    uint32_t type;
+    uint32_t sequence;
+    uint32_t count;
     uint32_t checksum;
-    uint8_t data[];
+    uint32_t blocks[];
 } __attribute__((packed)) rfss_journal_header_t;
 
+// One bitmap block held in memory, with free counts per RFSS_ALLOC_REGION_BITS region
 typedef struct {
-    uint32_t block_num;
-    uint32_t old_checksum;
-    uint32_t new_checksum;
-    uint8_t data[RFSS_BLOCK_SIZE];
-} __attribute__((packed)) rfss_journal_block_t;
+    uint32_t index;
+    int dirty;
+    uint16_t region_free[RFSS_BITMAP_REGIONS];
+    uint32_t words[RFSS_BLOCK_SIZE / sizeof(uint32_t)];
+} rfss_bitmap_slot_t;
+
+// Allocation bitmap spread over consecutive blocks. block_free counts the free bits of
+// every bitmap block so full ones are skipped unread; only a few blocks are resident.
+typedef struct {
+    uint32_t start_block;
+    uint32_t blocks;
+    uint32_t bits;
+    uint32_t first;
+    uint32_t hint;
+    uint32_t summary_block;
+    uint32_t* block_free;
+    rfss_bitmap_slot_t* slots;
+    uint32_t next_slot;
+} rfss_bitmap_t;
+
+typedef struct {
+    uint16_t count;
+    uint8_t orphan;
+    uint8_t reserved;
+    // Bumped whenever blocks are added to or dropped from the file
+    uint32_t map_generation;
+} rfss_inode_ref_t;
+
+// Where the journal log starts and ends on disk and the running transaction. The staging
+// buffer for the running transaction is shared; only one volume has blocks in it at a time.
+typedef struct {
+    uint32_t head;
+    uint32_t start;
+    uint32_t sequence;
+    uint32_t count;
+    uint32_t handles;
+    int ready;
+} rfss_journal_t;
 
 typedef struct {
     rfss_superblock_t* superblock;
-    uint8_t* block_bitmap;
-    uint8_t* inode_bitmap;
     rfss_inode_t* inode_table;
+    rfss_inode_ref_t* inode_refs;
+    uint8_t* inode_dirty;
     uint32_t current_dir_inode;
     char current_path[1024];
     uint32_t device_id;
     int mounted;
     int dirty;
     int journaling_enabled;
+    rfss_journal_t journal;
+    rfss_bitmap_t block_alloc;
+    rfss_bitmap_t inode_alloc;
+    // Background defragmentation: on or off, and the next inode it looks at
+    int defrag_enabled;
+    uint32_t defrag_next;
 } rfss_fs_t;
 
+// Window of the indirect block that mapped the last lookup, kept per open file. It only
+// holds while the inode's map_generation is the one it was read under.
+typedef struct {
+    uint32_t leaf;
+    uint32_t generation;
+    uint32_t first;
+    uint32_t count;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t entries[RFSS_MAP_CACHE_ENTRIES];
+} rfss_map_cache_t;
+
 typedef struct {
     rfss_inode_t* inode;
     uint32_t inode_num;
     uint64_t position;
     int flags;
     rfss_fs_t* fs;
+    rfss_map_cache_t map_cache;
+    // Sequential readahead: where the last read ended, the next window size (0 while
+    // access looks random) and the first block not yet read ahead
+    uint64_t ra_pos;
+    uint32_t ra_window;
+    uint32_t ra_end;
 } rfss_file_t;
 
+typedef struct {
+    uint32_t size;
+    uint32_t used;
+    uint32_t dirty;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t evictions;
+    uint32_t writebacks;
+    uint32_t readahead;
+} rfss_cache_stats_t;
+
+typedef struct {
+    uint32_t size;
+    uint32_t used;
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t negative_hits;
+    uint32_t evictions;
+} rfss_dcache_stats_t;
+
+typedef struct {
+    uint32_t allocs;
+    uint32_t frees;
+    uint64_t alloc_cycles;
+    uint64_t free_cycles;
+} rfss_alloc_bench_t;
+
+// Per pass: superblock, inodes, directories, bitmaps
+typedef struct {
+    uint32_t errors[RFSS_FSCK_PASSES];
+    uint64_t cycles[RFSS_FSCK_PASSES];
+    uint32_t total_errors;
+    uint32_t inodes;
+    uint32_t directories;
+    uint32_t blocks;
+    uint32_t reads;
+} rfss_fsck_report_t;
+
+// Regular files only. breaks counts places where the next block of a file isn't the next
+// block on disk, out of joins places where it could be.
+typedef struct {
+    uint32_t files;
+    uint32_t fragmented;
+    uint32_t blocks;
+    uint32_t breaks;
+    uint32_t joins;
+    uint32_t free_blocks;
+    uint32_t free_runs;
+    uint32_t largest_free;
+} rfss_frag_stats_t;
+
+extern const char* const rfss_fsck_pass_names[RFSS_FSCK_PASSES];
+
 int rfss_format(uint32_t device_id, const char* label);
 int rfss_mount(uint32_t device_id, rfss_fs_t* fs);
 int rfss_unmount(rfss_fs_t* fs);
+int rfss_sync(rfss_fs_t* fs);
 int rfss_create_file(rfss_fs_t* fs, const char* path, uint32_t mode);
 int rfss_delete_file(rfss_fs_t* fs, const char* path);
 int rfss_open_file(rfss_fs_t* fs, const char* path, int flags, rfss_file_t* file);
 int rfss_close_file(rfss_file_t* file);
 int rfss_read_file(rfss_file_t* file, void* buffer, size_t size);
 int rfss_write_file(rfss_file_t* file, const void* buffer, size_t size);
+int rfss_copy_file_range(rfss_file_t* src, rfss_file_t* dst, size_t size);
+int rfss_truncate_file(rfss_file_t* file, uint64_t size);
 int rfss_create_directory(rfss_fs_t* fs, const char* path);
 int rfss_remove_directory(rfss_fs_t* fs, const char* path);
+int rfss_rename(rfss_fs_t* fs, const char* old_path, const char* new_path);
 int rfss_list_directory(rfss_fs_t* fs, const char* path, rfss_dir_entry_t** entries, int* count);
 int rfss_change_directory(rfss_fs_t* fs, const char* path);
+uint32_t rfss_resolve_path(rfss_fs_t* fs, const char* path);
 int rfss_get_stats(rfss_fs_t* fs, uint32_t* total_blocks, uint32_t* free_blocks, uint32_t* total_inodes, uint32_t* free_inodes);
 int rfss_check_filesystem(rfss_fs_t* fs);
-rfss_fs_t* rfss_get_mounted_fs(void);
+int rfss_fsck(rfss_fs_t* fs, rfss_fsck_report_t* report);
+uint32_t rfss_file_runs(rfss_fs_t* fs, rfss_inode_t* inode);
+uint32_t rfss_frag_score(uint32_t runs, uint32_t blocks);
+int rfss_frag_stats(rfss_fs_t* fs, rfss_frag_stats_t* stats);
+int rfss_defrag_file(rfss_fs_t* fs, uint32_t inode_num);
+int rfss_defrag_step(rfss_fs_t* fs);
+int rfss_defrag(rfss_fs_t* fs, uint32_t* files);
+rfss_fs_t* rfss_get_mount(uint32_t device_id);
+
+int rfss_icache_init(rfss_fs_t* fs);
+rfss_inode_t* rfss_get_inode(rfss_fs_t* fs, uint32_t inode_num);
+int rfss_write_inode(rfss_fs_t* fs, uint32_t inode_num, rfss_inode_t* inode);
+void rfss_mark_inode_dirty(rfss_fs_t* fs, uint32_t inode_num);
+rfss_inode_t* rfss_iget(rfss_fs_t* fs, uint32_t inode_num);
+void rfss_iput(rfss_fs_t* fs, uint32_t inode_num);
+void rfss_release_inode(rfss_fs_t* fs, uint32_t inode_num);
+int rfss_sync_inodes(rfss_fs_t* fs);
 
 uint32_t rfss_allocate_block(rfss_fs_t* fs);
 void rfss_free_block(rfss_fs_t* fs, uint32_t block);
 uint32_t rfss_allocate_inode(rfss_fs_t* fs);
 void rfss_free_inode(rfss_fs_t* fs, uint32_t inode);
+int rfss_bitmap_init(rfss_fs_t* fs, rfss_bitmap_t* map, uint32_t start_block, uint32_t bits, uint32_t first, uint32_t summary_block);
+void rfss_bitmap_release(rfss_bitmap_t* map);
+uint32_t rfss_bitmap_alloc(rfss_fs_t* fs, rfss_bitmap_t* map);
+int rfss_bitmap_free(rfss_fs_t* fs, rfss_bitmap_t* map, uint32_t bit);
+int rfss_bitmap_claim(rfss_fs_t* fs, rfss_bitmap_t* map, uint32_t bit);
+int rfss_bitmap_sync(rfss_fs_t* fs, rfss_bitmap_t* map);
+uint32_t rfss_allocate_run(rfss_fs_t* fs, uint32_t goal, uint32_t max, uint32_t* count);
+uint32_t rfss_bitmap_find_run(rfss_fs_t* fs, rfss_bitmap_t* map, uint32_t want, uint32_t* runs, uint32_t* largest);
+
+uint32_t rfss_map_block(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t index, uint32_t* run, rfss_map_cache_t* cache);
+uint32_t rfss_extend_file(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t count, rfss_map_cache_t* cache);
+void rfss_shrink_file(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t count, rfss_map_cache_t* cache);
+int rfss_shrink_inode(rfss_fs_t* fs, uint32_t inode_num, rfss_inode_t* inode, uint64_t size, rfss_map_cache_t* cache);
+void rfss_free_file_blocks(rfss_fs_t* fs, rfss_inode_t* inode);
+uint8_t* rfss_delalloc_block(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t inode_num, uint32_t index);
+int rfss_delalloc_flush_inode(rfss_fs_t* fs, rfss_inode_t* inode);
+int rfss_delalloc_flush(rfss_fs_t* fs);
+void rfss_delalloc_drop(rfss_fs_t* fs, rfss_inode_t* inode);
+const uint8_t* rfss_delalloc_inode_block(rfss_fs_t* fs, uint32_t block, const uint8_t* table_block);
+int rfss_inline_fits(rfss_inode_t* inode, uint64_t end);
+int rfss_inline_read(rfss_file_t* file, void* buffer, size_t size);
+int rfss_inline_write(rfss_file_t* file, const void* buffer, size_t size);
+int rfss_inline_truncate(rfss_file_t* file, uint64_t size);
+int rfss_inline_spill(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t inode_num);
+uint32_t rfss_dir_block(rfss_fs_t* fs, rfss_inode_t* dir, uint32_t index);
+uint32_t rfss_dir_lookup(rfss_fs_t* fs, rfss_inode_t* dir, const char* name);
+int rfss_dir_add(rfss_fs_t* fs, rfss_inode_t* dir, const char* name, uint32_t inode, uint8_t type);
+uint32_t rfss_dir_remove(rfss_fs_t* fs, rfss_inode_t* dir, const char* name);
+uint32_t rfss_dir_parent(rfss_fs_t* fs, rfss_inode_t* dir);
+int rfss_dir_set_parent(rfss_fs_t* fs, rfss_inode_t* dir, uint32_t parent);
+uint32_t rfss_dir_block_end(rfss_fs_t* fs);
+void rfss_dir_seal(uint8_t* block);
+int rfss_dir_verify(const uint8_t* block);
+int rfss_dir_write_block(rfss_fs_t* fs, uint32_t block, uint8_t* buffer);
+void rfss_superblock_seal(rfss_superblock_t* sb);
+int rfss_superblock_verify(const rfss_superblock_t* sb);
+void rfss_inode_block_seal(uint8_t* block);
+int rfss_inode_block_verify(const uint8_t* block);
+int rfss_alloc_benchmark(rfss_fs_t* fs, uint32_t operations, rfss_alloc_bench_t* result);
+uint64_t rfss_rdtsc(void);
 int rfss_read_block(rfss_fs_t* fs, uint32_t block, void* buffer);
 int rfss_write_block(rfss_fs_t* fs, uint32_t block, const void* buffer);
 uint32_t rfss_calculate_checksum(const void* data, size_t size);
+uint32_t rfss_crc32c(uint32_t crc, const void* data, size_t size);
 
 int rfss_journal_init(rfss_fs_t* fs);
-int rfss_journal_start_transaction(rfss_fs_t* fs);
-int rfss_journal_log_block(rfss_fs_t* fs, uint32_t block_num, const void* old_data);
+int rfss_journal_start_transaction(rfss_fs_t* fs, uint32_t blocks);
+int rfss_journal_log_block(rfss_fs_t* fs, uint32_t block_num, const void* data);
+int rfss_journal_read_block(rfss_fs_t* fs, uint32_t block_num, void* buffer);
+int rfss_journal_flush(rfss_fs_t* fs);
 int rfss_journal_commit_transaction(rfss_fs_t* fs);
 int rfss_journal_abort_transaction(rfss_fs_t* fs);
 int rfss_journal_replay(rfss_fs_t* fs);
@@ -153,4 +415,23 @@ int rfss_safe_write_inode(rfss_fs_t* fs, uint32_t inode_num, rfss_inode_t* inode
 int rfss_enable_journaling(rfss_fs_t* fs);
 int rfss_disable_journaling(rfss_fs_t* fs);
 
+int rfss_device_read(uint32_t device_id, uint32_t block, uint32_t count, void* buffer);
+int rfss_device_write(uint32_t device_id, uint32_t block, uint32_t count, const void* buffer);
+int rfss_cache_read(rfss_fs_t* fs, uint32_t block, void* buffer);
+int rfss_cache_write(rfss_fs_t* fs, uint32_t block, const void* buffer);
+int rfss_cache_read_blocks(rfss_fs_t* fs, uint32_t block, uint32_t count, void* buffer);
+int rfss_cache_read_range(rfss_fs_t* fs, uint32_t block, uint32_t offset, uint32_t size, void* buffer);
+int rfss_cache_write_blocks(rfss_fs_t* fs, uint32_t block, uint32_t count, const void* buffer);
+int rfss_cache_readahead(rfss_fs_t* fs, uint32_t block, uint32_t count);
+int rfss_cache_sync(rfss_fs_t* fs);
+void rfss_cache_invalidate(uint32_t device_id);
+int rfss_cache_set_size(uint32_t blocks);
+void rfss_cache_get_stats(rfss_cache_stats_t* stats);
+
+int rfss_dcache_lookup(rfss_fs_t* fs, uint32_t parent, const char* name, uint32_t* inode);
+void rfss_dcache_insert(rfss_fs_t* fs, uint32_t parent, const char* name, uint32_t inode);
+void rfss_dcache_invalidate(rfss_fs_t* fs, uint32_t parent, const char* name);
+void rfss_dcache_purge(uint32_t device_id, uint32_t dir);
+void rfss_dcache_get_stats(rfss_dcache_stats_t* stats);
+
 #endif
\ No newline at end of file
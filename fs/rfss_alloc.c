@@ -0,0 +1,550 @@
+#include "rfss.h"
+#include "../kernel/logger.h"
+#include "../mm/memory.h"
+#include <string.h>
+
+// Bitmap allocation for blocks and inodes. A bitmap may span many blocks; each one
+// has a free count (kept in the summary blocks for the block bitmap) so allocation only
+// reads a bitmap block that has room. Inside a block the bitmap is scanned a 32-bit word
+// at a time from a next-fit hint that rotates through the volume, skipping regions whose
+// free count is zero.
+
+#define RFSS_BENCH_BATCH 8192
+
+static uint32_t bench_blocks[RFSS_BENCH_BATCH];
+static uint32_t summary_buffer[RFSS_SUMMARY_ENTRIES];
+
+uint64_t rfss_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Free bits of a bitmap block in [lo, hi), given as offsets within the block
+static uint32_t rfss_bitmap_count_free(const uint32_t* words, uint32_t lo, uint32_t hi) {
+    uint32_t count = 0;
+
+    while (lo < hi) {
+        uint32_t offset = lo % 32;
+        uint32_t n = 32 - offset < hi - lo ? 32 - offset : hi - lo;
+        uint32_t mask = n == 32 ? 0xFFFFFFFF : ((1u << n) - 1) << offset;
+
+        count += __builtin_popcount(~words[lo / 32] & mask);
+        lo += n;
+    }
+
+    return count;
+}
+
+// Allocatable range of a bitmap block as offsets within it
+static void rfss_bitmap_block_range(rfss_bitmap_t* map, uint32_t index, uint32_t* lo, uint32_t* hi) {
+    uint32_t base = index * RFSS_BITMAP_BITS;
+    *lo = map->first > base ? map->first - base : 0;
+    *hi = map->bits - base < RFSS_BITMAP_BITS ? map->bits - base : RFSS_BITMAP_BITS;
+    if (*lo > *hi) {
+        *lo = *hi;
+    }
+}
+
+static int rfss_bitmap_writeback(rfss_fs_t* fs, rfss_bitmap_t* map, rfss_bitmap_slot_t* slot) {
+    if (slot->index == RFSS_BITMAP_NONE || !slot->dirty) {
+        return 0;
+    }
+
+    if (rfss_write_block(fs, map->start_block + slot->index, slot->words) != 0) {
+        log(LOG_ERROR, "Failed to write bitmap block %d", map->start_block + slot->index);
+        return -1;
+    }
+
+    slot->dirty = 0;
+    return 0;
+}
+
+static rfss_bitmap_slot_t* rfss_bitmap_load(rfss_fs_t* fs, rfss_bitmap_t* map, uint32_t index) {
+    for (uint32_t i = 0; i < RFSS_BITMAP_SLOTS; i++) {
+        if (map->slots[i].index == index) {
+            return &map->slots[i];
+        }
+    }
+
+    rfss_bitmap_slot_t* slot = &map->slots[map->next_slot];
+    map->next_slot = (map->next_slot + 1) % RFSS_BITMAP_SLOTS;
+
+    if (rfss_bitmap_writeback(fs, map, slot) != 0) {
+        return NULL;
+    }
+
+    slot->index = RFSS_BITMAP_NONE;
+    if (rfss_read_block(fs, map->start_block + index, slot->words) != 0) {
+        return NULL;
+    }
+
+    uint32_t lo, hi;
+    rfss_bitmap_block_range(map, index, &lo, &hi);
+    for (uint32_t r = 0; r < RFSS_BITMAP_REGIONS; r++) {
+        uint32_t region_lo = r * RFSS_ALLOC_REGION_BITS;
+        uint32_t region_hi = region_lo + RFSS_ALLOC_REGION_BITS;
+        if (region_lo < lo) region_lo = lo < region_hi ? lo : region_hi;
+        if (region_hi > hi) region_hi = hi > region_lo ? hi : region_lo;
+        slot->region_free[r] = rfss_bitmap_count_free(slot->words, region_lo, region_hi);
+    }
+
+    slot->index = index;
+    slot->dirty = 0;
+    return slot;
+}
+
+// First clear bit in [from, end), or RFSS_BITMAP_NONE
+static uint32_t rfss_bitmap_scan(const uint32_t* words, uint32_t from, uint32_t end) {
+    uint32_t word = from / 32;
+    uint32_t free = ~words[word] & (0xFFFFFFFF << (from % 32));
+
+    for (;;) {
+        if (free) {
+            uint32_t bit = word * 32 + __builtin_ctz(free);
+            return bit < end ? bit : RFSS_BITMAP_NONE;
+        }
+
+        word++;
+        if (word * 32 >= end) {
+            return RFSS_BITMAP_NONE;
+        }
+        free = ~words[word];
+    }
+}
+
+// Claims the first free bit at or after `from` inside one resident bitmap block
+static uint32_t rfss_bitmap_slot_alloc(rfss_bitmap_slot_t* slot, uint32_t from, uint32_t end) {
+    for (uint32_t r = from / RFSS_ALLOC_REGION_BITS; r * RFSS_ALLOC_REGION_BITS < end; r++) {
+        if (slot->region_free[r] == 0) {
+            continue;
+        }
+
+        uint32_t lo = r * RFSS_ALLOC_REGION_BITS > from ? r * RFSS_ALLOC_REGION_BITS : from;
+        uint32_t hi = (r + 1) * RFSS_ALLOC_REGION_BITS < end ? (r + 1) * RFSS_ALLOC_REGION_BITS : end;
+
+        uint32_t bit = rfss_bitmap_scan(slot->words, lo, hi);
+        if (bit != RFSS_BITMAP_NONE) {
+            slot->words[bit / 32] |= 1u << (bit % 32);
+            slot->region_free[r]--;
+            slot->dirty = 1;
+            return bit;
+        }
+    }
+
+    return RFSS_BITMAP_NONE;
+}
+
+int rfss_bitmap_init(rfss_fs_t* fs, rfss_bitmap_t* map, uint32_t start_block, uint32_t bits, uint32_t first, uint32_t summary_block) {
+    if (!fs || !map || bits <= first) {
+        return -1;
+    }
+
+    map->start_block = start_block;
+    map->blocks = (bits + RFSS_BITMAP_BITS - 1) / RFSS_BITMAP_BITS;
+    map->bits = bits;
+    map->first = first;
+    map->hint = first;
+    map->summary_block = summary_block;
+    map->next_slot = 0;
+    map->block_free = kmalloc(map->blocks * sizeof(uint32_t));
+    map->slots = kmalloc(RFSS_BITMAP_SLOTS * sizeof(rfss_bitmap_slot_t));
+    if (!map->block_free || !map->slots) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < RFSS_BITMAP_SLOTS; i++) {
+        map->slots[i].index = RFSS_BITMAP_NONE;
+        map->slots[i].dirty = 0;
+    }
+
+    if (summary_block) {
+        for (uint32_t i = 0; i < map->blocks; i++) {
+            if (i % RFSS_SUMMARY_ENTRIES == 0 &&
+                rfss_read_block(fs, summary_block + i / RFSS_SUMMARY_ENTRIES, summary_buffer) != 0) {
+                return -1;
+            }
+            map->block_free[i] = summary_buffer[i % RFSS_SUMMARY_ENTRIES];
+        }
+        return 0;
+    }
+
+    // Without a summary every bitmap block has to be counted once
+    for (uint32_t i = 0; i < map->blocks; i++) {
+        rfss_bitmap_slot_t* slot = rfss_bitmap_load(fs, map, i);
+        if (!slot) {
+            return -1;
+        }
+
+        map->block_free[i] = 0;
+        for (uint32_t r = 0; r < RFSS_BITMAP_REGIONS; r++) {
+            map->block_free[i] += slot->region_free[r];
+        }
+    }
+
+    return 0;
+}
+
+// Frees what rfss_bitmap_init allocated; safe on a map whose init failed part way
+void rfss_bitmap_release(rfss_bitmap_t* map) {
+    kfree(map->block_free);
+    kfree(map->slots);
+    map->block_free = NULL;
+    map->slots = NULL;
+}
+
+uint32_t rfss_bitmap_alloc(rfss_fs_t* fs, rfss_bitmap_t* map) {
+    uint32_t start = map->hint;
+    if (start < map->first || start >= map->bits) {
+        start = map->first;
+    }
+
+    uint32_t index = start / RFSS_BITMAP_BITS;
+
+    // One extra step revisits the start block below the hint after wrapping around
+    for (uint32_t n = 0; n <= map->blocks; n++) {
+        if (map->block_free[index] > 0) {
+            rfss_bitmap_slot_t* slot = rfss_bitmap_load(fs, map, index);
+            if (!slot) {
+                return RFSS_BITMAP_NONE;
+            }
+
+            uint32_t lo, hi;
+            rfss_bitmap_block_range(map, index, &lo, &hi);
+            uint32_t from = n == 0 ? start - index * RFSS_BITMAP_BITS : lo;
+            if (from < lo) from = lo;
+
+            uint32_t bit = rfss_bitmap_slot_alloc(slot, from, hi);
+            if (bit != RFSS_BITMAP_NONE) {
+                map->block_free[index]--;
+                bit += index * RFSS_BITMAP_BITS;
+                map->hint = bit + 1;
+                return bit;
+            }
+
+            if (from == lo) {
+                // The stored count was stale; the whole block is in use
+                map->block_free[index] = 0;
+            }
+        }
+
+        index = index + 1 < map->blocks ? index + 1 : 0;
+    }
+
+    return RFSS_BITMAP_NONE;
+}
+
+int rfss_bitmap_free(rfss_fs_t* fs, rfss_bitmap_t* map, uint32_t bit) {
+    if (bit < map->first || bit >= map->bits) {
+        return 0;
+    }
+
+    uint32_t index = bit / RFSS_BITMAP_BITS;
+    rfss_bitmap_slot_t* slot = rfss_bitmap_load(fs, map, index);
+    if (!slot) {
+        return 0;
+    }
+
+    uint32_t offset = bit % RFSS_BITMAP_BITS;
+    uint32_t mask = 1u << (offset % 32);
+    if (!(slot->words[offset / 32] & mask)) {
+        return 0;
+    }
+
+    slot->words[offset / 32] &= ~mask;
+    slot->region_free[offset / RFSS_ALLOC_REGION_BITS]++;
+    slot->dirty = 1;
+    map->block_free[index]++;
+    return 1;
+}
+
+// Sets one specific bit if it is still clear
+int rfss_bitmap_claim(rfss_fs_t* fs, rfss_bitmap_t* map, uint32_t bit) {
+    if (bit < map->first || bit >= map->bits) {
+        return 0;
+    }
+
+    uint32_t index = bit / RFSS_BITMAP_BITS;
+    rfss_bitmap_slot_t* slot = rfss_bitmap_load(fs, map, index);
+    if (!slot) {
+        return 0;
+    }
+
+    uint32_t offset = bit % RFSS_BITMAP_BITS;
+    uint32_t mask = 1u << (offset % 32);
+    if (slot->words[offset / 32] & mask) {
+        return 0;
+    }
+
+    slot->words[offset / 32] |= mask;
+    slot->region_free[offset / RFSS_ALLOC_REGION_BITS]--;
+    slot->dirty = 1;
+    map->block_free[index]--;
+    return 1;
+}
+
+// Writes resident bitmap blocks and the summary back through the block cache
+int rfss_bitmap_sync(rfss_fs_t* fs, rfss_bitmap_t* map) {
+    if (!fs || !map || !map->slots) {
+        return -1;
+    }
+
+    int result = 0;
+    for (uint32_t i = 0; i < RFSS_BITMAP_SLOTS; i++) {
+        if (rfss_bitmap_writeback(fs, map, &map->slots[i]) != 0) {
+            result = -1;
+        }
+    }
+
+    if (!map->summary_block) {
+        return result;
+    }
+
+    for (uint32_t i = 0; i < map->blocks; i += RFSS_SUMMARY_ENTRIES) {
+        memset(summary_buffer, 0, RFSS_BLOCK_SIZE);
+        for (uint32_t j = 0; j < RFSS_SUMMARY_ENTRIES && i + j < map->blocks; j++) {
+            summary_buffer[j] = map->block_free[i + j];
+        }
+
+        if (rfss_write_block(fs, map->summary_block + i / RFSS_SUMMARY_ENTRIES, summary_buffer) != 0) {
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+uint32_t rfss_allocate_block(rfss_fs_t* fs) {
+    if (!fs || !fs->block_alloc.slots || !fs->superblock) {
+        //log(LOG_ERROR, "Filesystem not properly initialized");
+        return 0;
+    }
+
+    if (fs->superblock->free_blocks == 0) {
+        //log(LOG_ERROR, "No free blocks available");
+        return 0;
+    }
+
+    uint32_t block = rfss_bitmap_alloc(fs, &fs->block_alloc);
+    if (block == RFSS_BITMAP_NONE) {
+        //log(LOG_ERROR, "No free blocks available");
+        return 0;
+    }
+
+    fs->superblock->free_blocks--;
+    fs->dirty = 1;
+    return block;
+}
+
+// Walks the free runs of a bitmap in order, counting them into `runs` and `largest` when
+// those are given. Returns the start of the first run of at least `want` bits, or
+// RFSS_BITMAP_NONE.
+uint32_t rfss_bitmap_find_run(rfss_fs_t* fs, rfss_bitmap_t* map, uint32_t want, uint32_t* runs, uint32_t* largest) {
+    uint32_t found = RFSS_BITMAP_NONE;
+    uint32_t start = 0;
+    uint32_t length = 0;
+    const uint32_t* words = NULL;
+    uint32_t loaded = RFSS_BITMAP_NONE;
+
+    if (runs) *runs = 0;
+    if (largest) *largest = 0;
+
+    uint32_t bit = map->first;
+    while (bit <= map->bits) {
+        uint32_t step = 1;
+        int free = 0;
+
+        if (bit < map->bits) {
+            uint32_t index = bit / RFSS_BITMAP_BITS;
+            if (index != loaded) {
+                words = NULL;
+                if (map->block_free[index] > 0) {
+                    rfss_bitmap_slot_t* slot = rfss_bitmap_load(fs, map, index);
+                    if (!slot) {
+                        return RFSS_BITMAP_NONE;
+                    }
+                    words = slot->words;
+                }
+                loaded = index;
+            }
+
+            if (!words) {
+                // Nothing free in this bitmap block
+                step = (index + 1) * RFSS_BITMAP_BITS - bit;
+            } else {
+                uint32_t word = words[(bit % RFSS_BITMAP_BITS) / 32];
+                if (bit % 32 == 0 && map->bits - bit >= 32 && (word == 0 || word == 0xFFFFFFFF)) {
+                    step = 32;
+                    free = word == 0;
+                } else {
+                    free = !(word & (1u << (bit % 32)));
+                }
+            }
+        }
+
+        if (free) {
+            if (length == 0) {
+                start = bit;
+            }
+            length += step;
+            bit += step;
+            continue;
+        }
+
+        if (length > 0) {
+            if (runs) (*runs)++;
+            if (largest && length > *largest) *largest = length;
+            if (found == RFSS_BITMAP_NONE && length >= want) {
+                found = start;
+                if (!runs && !largest) {
+                    return found;
+                }
+            }
+            length = 0;
+        }
+
+        if (bit >= map->bits) {
+            break;
+        }
+        bit += step;
+    }
+
+    return found;
+}
+
+// Allocates up to `max` contiguous blocks, starting at `goal` when that block is free so
+// a file keeps growing in place. Returns the first block and stores the run length.
+uint32_t rfss_allocate_run(rfss_fs_t* fs, uint32_t goal, uint32_t max, uint32_t* count) {
+    *count = 0;
+    if (!fs || !fs->block_alloc.slots || !fs->superblock || max == 0 || fs->superblock->free_blocks == 0) {
+        return 0;
+    }
+
+    uint32_t start;
+    if (goal && rfss_bitmap_claim(fs, &fs->block_alloc, goal)) {
+        start = goal;
+    } else {
+        start = rfss_bitmap_alloc(fs, &fs->block_alloc);
+        if (start == RFSS_BITMAP_NONE) {
+            return 0;
+        }
+    }
+
+    uint32_t n = 1;
+    while (n < max && n < fs->superblock->free_blocks && rfss_bitmap_claim(fs, &fs->block_alloc, start + n)) {
+        n++;
+    }
+
+    fs->block_alloc.hint = start + n;
+    fs->superblock->free_blocks -= n;
+    fs->dirty = 1;
+    *count = n;
+    return start;
+}
+
+void rfss_free_block(rfss_fs_t* fs, uint32_t block) {
+    if (!fs || !fs->block_alloc.slots || block >= fs->superblock->total_blocks) {
+        return;
+    }
+
+    if (rfss_bitmap_free(fs, &fs->block_alloc, block)) {
+        fs->superblock->free_blocks++;
+        fs->dirty = 1;
+    }
+}
+
+uint32_t rfss_allocate_inode(rfss_fs_t* fs) {
+    if (!fs || !fs->inode_alloc.slots || !fs->superblock) {
+        //log(LOG_ERROR, "Filesystem not properly initialized");
+        return 0;
+    }
+
+    if (fs->superblock->free_inode_count == 0) {
+        //log(LOG_ERROR, "No free inodes available");
+        return 0;
+    }
+
+    uint32_t bit = rfss_bitmap_alloc(fs, &fs->inode_alloc);
+    if (bit == RFSS_BITMAP_NONE) {
+        //log(LOG_ERROR, "No free inodes available");
+        return 0;
+    }
+
+    fs->superblock->free_inode_count--;
+    fs->dirty = 1;
+    return bit + 1;
+}
+
+void rfss_free_inode(rfss_fs_t* fs, uint32_t inode) {
+    if (!fs || !fs->inode_alloc.slots || inode == 0 || inode > fs->superblock->inode_count) {
+        return;
+    }
+
+    if (rfss_bitmap_free(fs, &fs->inode_alloc, inode - 1)) {
+        fs->superblock->free_inode_count++;
+        fs->dirty = 1;
+    }
+}
+
+// Allocates and frees `operations` blocks in batches, punching holes into each batch
+// and refilling them so the scans run against a fragmented bitmap. Every block is
+// released again, so the volume is left as it was found.
+int rfss_alloc_benchmark(rfss_fs_t* fs, uint32_t operations, rfss_alloc_bench_t* result) {
+    if (!fs || !fs->mounted || !result) {
+        return -1;
+    }
+
+    memset(result, 0, sizeof(rfss_alloc_bench_t));
+    uint32_t saved_hint = fs->block_alloc.hint;
+    int saved_dirty = fs->dirty;
+
+    while (result->allocs < operations) {
+        uint32_t count = 0;
+
+        uint64_t start = rfss_rdtsc();
+        while (count < RFSS_BENCH_BATCH && result->allocs < operations) {
+            uint32_t block = rfss_allocate_block(fs);
+            if (block == 0) {
+                break;
+            }
+            bench_blocks[count++] = block;
+            result->allocs++;
+        }
+        result->alloc_cycles += rfss_rdtsc() - start;
+
+        if (count == 0) {
+            log(LOG_WARNING, "Allocator benchmark: volume is full");
+            break;
+        }
+
+        start = rfss_rdtsc();
+        for (uint32_t i = 1; i < count; i += 2) {
+            rfss_free_block(fs, bench_blocks[i]);
+            bench_blocks[i] = 0;
+            result->frees++;
+        }
+        result->free_cycles += rfss_rdtsc() - start;
+
+        start = rfss_rdtsc();
+        for (uint32_t i = 1; i < count && result->allocs < operations; i += 2) {
+            bench_blocks[i] = rfss_allocate_block(fs);
+            if (bench_blocks[i] != 0) {
+                result->allocs++;
+            }
+        }
+        result->alloc_cycles += rfss_rdtsc() - start;
+
+        start = rfss_rdtsc();
+        for (uint32_t i = 0; i < count; i++) {
+            if (bench_blocks[i] != 0) {
+                rfss_free_block(fs, bench_blocks[i]);
+                result->frees++;
+            }
+        }
+        result->free_cycles += rfss_rdtsc() - start;
+    }
+
+    fs->block_alloc.hint = saved_hint;
+    fs->dirty = saved_dirty;
+    return 0;
+}
@@ -0,0 +1,477 @@
+#include "rfss.h"
+#include "../drivers/ata.h"
+#include "../drivers/blkdev.h"
+#include "../kernel/logger.h"
+#include <string.h>
+
+// Write-back block cache sitting between RFSS and the ATA driver.
+// Entries are found through a hash on (device, block) and recycled in LRU order.
+
+#define RFSS_CACHE_HASH_SIZE 512
+
+typedef struct rfss_cache_entry {
+    uint32_t device_id;
+    uint32_t block;
+    int valid;
+    int dirty;
+    uint8_t* data;
+    struct rfss_cache_entry* hash_next;
+    struct rfss_cache_entry* lru_prev;
+    struct rfss_cache_entry* lru_next;
+} rfss_cache_entry_t;
+
+static uint8_t cache_data[RFSS_CACHE_MAX_BLOCKS][RFSS_BLOCK_SIZE];
+static rfss_cache_entry_t cache_entries[RFSS_CACHE_MAX_BLOCKS];
+static rfss_cache_entry_t* cache_hash[RFSS_CACHE_HASH_SIZE];
+static rfss_cache_entry_t* lru_head = NULL;
+static rfss_cache_entry_t* lru_tail = NULL;
+static uint32_t cache_size = RFSS_CACHE_DEFAULT_BLOCKS;
+static int cache_initialized = 0;
+static rfss_cache_stats_t cache_stats;
+static blk_request_t sync_requests[RFSS_CACHE_MAX_BLOCKS];
+static blk_request_t readahead_requests[RFSS_READAHEAD_MAX];
+
+int rfss_device_read(uint32_t device_id, uint32_t block, uint32_t count, void* buffer) {
+    uint32_t sectors_per_block = RFSS_BLOCK_SIZE / ATA_SECTOR_SIZE;
+    return blk_read(device_id, block * sectors_per_block, count * sectors_per_block, buffer);
+}
+
+int rfss_device_write(uint32_t device_id, uint32_t block, uint32_t count, const void* buffer) {
+    uint32_t sectors_per_block = RFSS_BLOCK_SIZE / ATA_SECTOR_SIZE;
+    return blk_write(device_id, block * sectors_per_block, count * sectors_per_block, buffer);
+}
+
+static uint32_t rfss_cache_hash(uint32_t device_id, uint32_t block) {
+    return ((block * 2654435761u) ^ (device_id << 7)) & (RFSS_CACHE_HASH_SIZE - 1);
+}
+
+static void rfss_cache_lru_unlink(rfss_cache_entry_t* entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else lru_tail = entry->lru_prev;
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void rfss_cache_lru_push_front(rfss_cache_entry_t* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = entry;
+    lru_head = entry;
+    if (!lru_tail) lru_tail = entry;
+}
+
+static void rfss_cache_hash_remove(rfss_cache_entry_t* entry) {
+    rfss_cache_entry_t** link = &cache_hash[rfss_cache_hash(entry->device_id, entry->block)];
+    while (*link) {
+        if (*link == entry) {
+            *link = entry->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    entry->hash_next = NULL;
+}
+
+static void rfss_cache_init(void) {
+    memset(cache_entries, 0, sizeof(cache_entries));
+    memset(cache_hash, 0, sizeof(cache_hash));
+    lru_head = NULL;
+    lru_tail = NULL;
+
+    for (uint32_t i = 0; i < cache_size; i++) {
+        cache_entries[i].data = cache_data[i];
+        rfss_cache_lru_push_front(&cache_entries[i]);
+    }
+
+    cache_initialized = 1;
+}
+
+static rfss_cache_entry_t* rfss_cache_lookup(uint32_t device_id, uint32_t block) {
+    rfss_cache_entry_t* entry = cache_hash[rfss_cache_hash(device_id, block)];
+    while (entry) {
+        if (entry->device_id == device_id && entry->block == block) {
+            return entry;
+        }
+        entry = entry->hash_next;
+    }
+    return NULL;
+}
+
+static int rfss_cache_writeback(rfss_cache_entry_t* entry) {
+    if (!entry->valid || !entry->dirty) {
+        return 0;
+    }
+
+    if (rfss_device_write(entry->device_id, entry->block, 1, entry->data) != 0) {
+        log(LOG_ERROR, "Cache write-back failed for block %d", entry->block);
+        return -1;
+    }
+
+    entry->dirty = 0;
+    cache_stats.writebacks++;
+    return 0;
+}
+
+// Takes the least recently used slot, writing it back first if it holds dirty data.
+static rfss_cache_entry_t* rfss_cache_get_free_entry(void) {
+    rfss_cache_entry_t* entry = lru_tail;
+    if (!entry) {
+        return NULL;
+    }
+
+    if (entry->valid) {
+        if (rfss_cache_writeback(entry) != 0) {
+            return NULL;
+        }
+        rfss_cache_hash_remove(entry);
+        entry->valid = 0;
+        cache_stats.evictions++;
+    }
+
+    return entry;
+}
+
+static void rfss_cache_insert(rfss_cache_entry_t* entry, uint32_t device_id, uint32_t block) {
+    uint32_t hash = rfss_cache_hash(device_id, block);
+    entry->device_id = device_id;
+    entry->block = block;
+    entry->valid = 1;
+    entry->dirty = 0;
+    entry->hash_next = cache_hash[hash];
+    cache_hash[hash] = entry;
+}
+
+static void rfss_cache_touch(rfss_cache_entry_t* entry) {
+    if (lru_head != entry) {
+        rfss_cache_lru_unlink(entry);
+        rfss_cache_lru_push_front(entry);
+    }
+}
+
+int rfss_cache_read(rfss_fs_t* fs, uint32_t block, void* buffer) {
+    if (!fs || !buffer) {
+        return -1;
+    }
+
+    if (!cache_initialized) {
+        rfss_cache_init();
+    }
+
+    rfss_cache_entry_t* entry = rfss_cache_lookup(fs->device_id, block);
+    if (entry) {
+        cache_stats.hits++;
+        rfss_cache_touch(entry);
+        memcpy(buffer, entry->data, RFSS_BLOCK_SIZE);
+        return 0;
+    }
+
+    cache_stats.misses++;
+    entry = rfss_cache_get_free_entry();
+    if (!entry) {
+        return rfss_device_read(fs->device_id, block, 1, buffer);
+    }
+
+    if (rfss_device_read(fs->device_id, block, 1, entry->data) != 0) {
+        return -1;
+    }
+
+    rfss_cache_insert(entry, fs->device_id, block);
+    rfss_cache_touch(entry);
+    memcpy(buffer, entry->data, RFSS_BLOCK_SIZE);
+    return 0;
+}
+
+// Copies part of one block to the caller straight from its cache slot, loading it on a miss
+int rfss_cache_read_range(rfss_fs_t* fs, uint32_t block, uint32_t offset, uint32_t size, void* buffer) {
+    if (!fs || !buffer || offset + size > RFSS_BLOCK_SIZE) {
+        return -1;
+    }
+
+    if (!cache_initialized) {
+        rfss_cache_init();
+    }
+
+    rfss_cache_entry_t* entry = rfss_cache_lookup(fs->device_id, block);
+    if (entry) {
+        cache_stats.hits++;
+    } else {
+        cache_stats.misses++;
+        entry = rfss_cache_get_free_entry();
+        if (!entry || rfss_device_read(fs->device_id, block, 1, entry->data) != 0) {
+            return -1;
+        }
+        rfss_cache_insert(entry, fs->device_id, block);
+    }
+
+    rfss_cache_touch(entry);
+    memcpy(buffer, entry->data + offset, size);
+    return 0;
+}
+
+int rfss_cache_write(rfss_fs_t* fs, uint32_t block, const void* buffer) {
+    if (!fs || !buffer) {
+        return -1;
+    }
+
+    if (!cache_initialized) {
+        rfss_cache_init();
+    }
+
+    // Writes stay out of the hit and miss counts, which only describe reads
+    rfss_cache_entry_t* entry = rfss_cache_lookup(fs->device_id, block);
+    if (!entry) {
+        entry = rfss_cache_get_free_entry();
+        if (!entry) {
+            return rfss_device_write(fs->device_id, block, 1, buffer);
+        }
+        rfss_cache_insert(entry, fs->device_id, block);
+    }
+
+    memcpy(entry->data, buffer, RFSS_BLOCK_SIZE);
+    entry->dirty = 1;
+    rfss_cache_touch(entry);
+    return 0;
+}
+
+// Reads a contiguous run with one device request; cached and uncommitted journal copies
+// win over the disk contents. A run that is already fully cached skips the device.
+int rfss_cache_read_blocks(rfss_fs_t* fs, uint32_t block, uint32_t count, void* buffer) {
+    if (!fs || !buffer || count == 0) {
+        return -1;
+    }
+
+    uint32_t cached = 0;
+    while (cache_initialized && cached < count && rfss_cache_lookup(fs->device_id, block + cached)) {
+        cached++;
+    }
+
+    if (cached < count && rfss_device_read(fs->device_id, block, count, buffer) != 0) {
+        return -1;
+    }
+
+    if (!cache_initialized) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        rfss_cache_entry_t* entry = rfss_cache_lookup(fs->device_id, block + i);
+        if (entry) {
+            memcpy((uint8_t*)buffer + i * RFSS_BLOCK_SIZE, entry->data, RFSS_BLOCK_SIZE);
+            if (cached == count) {
+                cache_stats.hits++;
+                rfss_cache_touch(entry);
+            }
+        }
+        if (fs->journaling_enabled) {
+            rfss_journal_read_block(fs, block + i, (uint8_t*)buffer + i * RFSS_BLOCK_SIZE);
+        }
+    }
+
+    return 0;
+}
+
+// Writes a contiguous run straight to the device with one request. Cached copies are
+// refreshed so they stay coherent and are no longer dirty.
+int rfss_cache_write_blocks(rfss_fs_t* fs, uint32_t block, uint32_t count, const void* buffer) {
+    if (!fs || !buffer || count == 0) {
+        return -1;
+    }
+
+    if (rfss_device_write(fs->device_id, block, count, buffer) != 0) {
+        return -1;
+    }
+
+    if (!cache_initialized) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        rfss_cache_entry_t* entry = rfss_cache_lookup(fs->device_id, block + i);
+        if (entry) {
+            memcpy(entry->data, (const uint8_t*)buffer + i * RFSS_BLOCK_SIZE, RFSS_BLOCK_SIZE);
+            entry->dirty = 0;
+        }
+    }
+
+    return 0;
+}
+
+// Loads blocks that are not cached yet straight into free cache slots. Each block is its
+// own request and the block queue merges neighbours, so a window costs one or two commands.
+int rfss_cache_readahead(rfss_fs_t* fs, uint32_t block, uint32_t count) {
+    if (!fs || count == 0) {
+        return -1;
+    }
+
+    if (!cache_initialized) {
+        rfss_cache_init();
+    }
+
+    // Never let one window push out more than half of the cache
+    if (count > cache_size / 2) {
+        count = cache_size / 2;
+    }
+    if (count > RFSS_READAHEAD_MAX) {
+        count = RFSS_READAHEAD_MAX;
+    }
+
+    uint32_t sectors_per_block = RFSS_BLOCK_SIZE / ATA_SECTOR_SIZE;
+    uint32_t submitted = 0;
+
+    blk_plug();
+    for (uint32_t i = 0; i < count; i++) {
+        if (rfss_cache_lookup(fs->device_id, block + i)) {
+            continue;
+        }
+
+        rfss_cache_entry_t* entry = rfss_cache_get_free_entry();
+        if (!entry) {
+            break;
+        }
+        rfss_cache_insert(entry, fs->device_id, block + i);
+        rfss_cache_touch(entry);
+
+        blk_request_t* req = &readahead_requests[submitted++];
+        req->device_id = fs->device_id;
+        req->lba = (block + i) * sectors_per_block;
+        req->count = sectors_per_block;
+        req->buffer = entry->data;
+        req->write = 0;
+        req->callback = NULL;
+        req->private_data = entry;
+        blk_submit(req);
+    }
+    blk_unplug();
+
+    int result = 0;
+    for (uint32_t i = 0; i < submitted; i++) {
+        rfss_cache_entry_t* entry = readahead_requests[i].private_data;
+
+        if (blk_wait(&readahead_requests[i]) != 0) {
+            rfss_cache_hash_remove(entry);
+            entry->valid = 0;
+            result = -1;
+            continue;
+        }
+
+        cache_stats.readahead++;
+    }
+
+    return result;
+}
+
+// Writes back every dirty block as its own request and lets the block queue sort and
+// merge them, then flushes the drive cache
+int rfss_cache_sync(rfss_fs_t* fs) {
+    if (!fs || !cache_initialized) {
+        return 0;
+    }
+
+    uint32_t sectors_per_block = RFSS_BLOCK_SIZE / ATA_SECTOR_SIZE;
+    uint32_t dirty_count = 0;
+
+    blk_plug();
+    for (uint32_t i = 0; i < cache_size; i++) {
+        rfss_cache_entry_t* entry = &cache_entries[i];
+        if (!entry->valid || !entry->dirty || entry->device_id != fs->device_id) {
+            continue;
+        }
+
+        blk_request_t* req = &sync_requests[dirty_count];
+        req->device_id = entry->device_id;
+        req->lba = entry->block * sectors_per_block;
+        req->count = sectors_per_block;
+        req->buffer = entry->data;
+        req->write = 1;
+        req->callback = NULL;
+        req->private_data = entry;
+        blk_submit(req);
+        dirty_count++;
+    }
+    blk_unplug();
+
+    int result = 0;
+    for (uint32_t i = 0; i < dirty_count; i++) {
+        rfss_cache_entry_t* entry = sync_requests[i].private_data;
+
+        if (blk_wait(&sync_requests[i]) != 0) {
+            log(LOG_ERROR, "Cache write-back failed for block %d", entry->block);
+            result = -1;
+            continue;
+        }
+
+        entry->dirty = 0;
+        cache_stats.writebacks++;
+    }
+
+    // Sync is a barrier: nothing written above may linger in the drive's cache
+    if (dirty_count > 0 && ata_flush_cache(fs->device_id) != 0) {
+        result = -1;
+    }
+
+    return result;
+}
+
+void rfss_cache_invalidate(uint32_t device_id) {
+    if (!cache_initialized) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < cache_size; i++) {
+        rfss_cache_entry_t* entry = &cache_entries[i];
+        if (entry->valid && entry->device_id == device_id) {
+            rfss_cache_hash_remove(entry);
+            entry->valid = 0;
+            entry->dirty = 0;
+            rfss_cache_lru_unlink(entry);
+            // Empty slots go to the tail so they are reused before live blocks
+            entry->lru_prev = lru_tail;
+            if (lru_tail) lru_tail->lru_next = entry;
+            lru_tail = entry;
+            if (!lru_head) lru_head = entry;
+        }
+    }
+}
+
+int rfss_cache_set_size(uint32_t blocks) {
+    if (blocks == 0 || blocks > RFSS_CACHE_MAX_BLOCKS) {
+        return -1;
+    }
+
+    if (cache_initialized) {
+        for (uint32_t i = 0; i < cache_size; i++) {
+            if (rfss_cache_writeback(&cache_entries[i]) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    cache_size = blocks;
+    rfss_cache_init();
+    log(LOG_OK, "Block cache resized to %d blocks", blocks);
+    return 0;
+}
+
+void rfss_cache_get_stats(rfss_cache_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+
+    *stats = cache_stats;
+    stats->size = cache_size;
+    stats->used = 0;
+    stats->dirty = 0;
+
+    if (!cache_initialized) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < cache_size; i++) {
+        if (cache_entries[i].valid) {
+            stats->used++;
+            if (cache_entries[i].dirty) stats->dirty++;
+        }
+    }
+}
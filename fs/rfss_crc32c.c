@@ -0,0 +1,92 @@
+#include "rfss.h"
+#include "../kernel/info.h"
+
+// CRC32C (Castagnoli) for journal records and metadata checksums. CPUs with SSE4.2 use
+// the crc32 instruction; everything else uses slice-by-8 tables, eight bytes per step.
+
+#define RFSS_CRC32C_POLY 0x82F63B78
+
+static uint32_t crc32c_table[8][256];
+static uint32_t (*crc32c_update)(uint32_t crc, const uint8_t* data, size_t size) = NULL;
+
+static uint32_t rfss_crc32c_sw(uint32_t crc, const uint8_t* data, size_t size) {
+    while (size > 0 && ((uintptr_t)data & 3)) {
+        crc = crc32c_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        size--;
+    }
+
+    while (size >= 8) {
+        uint32_t low = *(const uint32_t*)data ^ crc;
+        uint32_t high = *(const uint32_t*)(data + 4);
+        crc = crc32c_table[7][low & 0xFF] ^ crc32c_table[6][(low >> 8) & 0xFF] ^
+              crc32c_table[5][(low >> 16) & 0xFF] ^ crc32c_table[4][low >> 24] ^
+              crc32c_table[3][high & 0xFF] ^ crc32c_table[2][(high >> 8) & 0xFF] ^
+              crc32c_table[1][(high >> 16) & 0xFF] ^ crc32c_table[0][high >> 24];
+        data += 8;
+        size -= 8;
+    }
+
+    while (size > 0) {
+        crc = crc32c_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+        size--;
+    }
+
+    return crc;
+}
+
+static uint32_t rfss_crc32c_hw(uint32_t crc, const uint8_t* data, size_t size) {
+    while (size > 0 && ((uintptr_t)data & 3)) {
+        __asm__ ("crc32b %1, %0" : "+r"(crc) : "qm"(*data));
+        data++;
+        size--;
+    }
+
+    while (size >= 4) {
+        __asm__ ("crc32l %1, %0" : "+r"(crc) : "rm"(*(const uint32_t*)data));
+        data += 4;
+        size -= 4;
+    }
+
+    while (size > 0) {
+        __asm__ ("crc32b %1, %0" : "+r"(crc) : "qm"(*data));
+        data++;
+        size--;
+    }
+
+    return crc;
+}
+
+static void rfss_crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t value = i;
+        for (int bit = 0; bit < 8; bit++) {
+            value = (value >> 1) ^ (RFSS_CRC32C_POLY & -(value & 1));
+        }
+        crc32c_table[0][i] = value;
+    }
+
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int slice = 1; slice < 8; slice++) {
+            uint32_t previous = crc32c_table[slice - 1][i];
+            crc32c_table[slice][i] = crc32c_table[0][previous & 0xFF] ^ (previous >> 8);
+        }
+    }
+
+    crc32c_update = cpu_has_sse42() ? rfss_crc32c_hw : rfss_crc32c_sw;
+}
+
+// Pass 0 to start a checksum, or a previous result to continue it over more data
+uint32_t rfss_crc32c(uint32_t crc, const void* data, size_t size) {
+    if (!crc32c_update) {
+        rfss_crc32c_init();
+    }
+
+    return ~crc32c_update(~crc, (const uint8_t*)data, size);
+}
+
+uint32_t rfss_calculate_checksum(const void* data, size_t size) {
+    if (!data) {
+        return 0;
+    }
+    return rfss_crc32c(0, data, size);
+}
@@ -0,0 +1,217 @@
+#include "rfss.h"
+#include <string.h>
+
+// Path-lookup cache mapping (device, parent directory, name) to an inode. An inode of 0
+// records that the name is known to be absent, so repeated misses skip the directory too.
+// Entries are found through a hash and recycled in LRU order.
+
+#define RFSS_DCACHE_HASH_SIZE 256
+
+typedef struct rfss_dcache_entry {
+    uint32_t device_id;
+    uint32_t parent;
+    uint32_t inode;
+    uint32_t hash;
+    uint8_t name_len;
+    int valid;
+    char name[RFSS_DCACHE_NAME_MAX];
+    struct rfss_dcache_entry* hash_next;
+    struct rfss_dcache_entry* lru_prev;
+    struct rfss_dcache_entry* lru_next;
+} rfss_dcache_entry_t;
+
+static rfss_dcache_entry_t dcache_entries[RFSS_DCACHE_SIZE];
+static rfss_dcache_entry_t* dcache_hash[RFSS_DCACHE_HASH_SIZE];
+static rfss_dcache_entry_t* lru_head = NULL;
+static rfss_dcache_entry_t* lru_tail = NULL;
+static int dcache_initialized = 0;
+static rfss_dcache_stats_t dcache_stats;
+
+static uint32_t rfss_dcache_hash(uint32_t device_id, uint32_t parent, const char* name, uint32_t len) {
+    uint32_t hash = 2166136261u ^ (parent * 2654435761u) ^ (device_id << 24);
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void rfss_dcache_lru_unlink(rfss_dcache_entry_t* entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else lru_tail = entry->lru_prev;
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void rfss_dcache_lru_push_front(rfss_dcache_entry_t* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head) lru_head->lru_prev = entry;
+    lru_head = entry;
+    if (!lru_tail) lru_tail = entry;
+}
+
+static void rfss_dcache_lru_push_back(rfss_dcache_entry_t* entry) {
+    entry->lru_next = NULL;
+    entry->lru_prev = lru_tail;
+    if (lru_tail) lru_tail->lru_next = entry;
+    lru_tail = entry;
+    if (!lru_head) lru_head = entry;
+}
+
+static void rfss_dcache_init(void) {
+    memset(dcache_entries, 0, sizeof(dcache_entries));
+    memset(dcache_hash, 0, sizeof(dcache_hash));
+    lru_head = NULL;
+    lru_tail = NULL;
+
+    for (uint32_t i = 0; i < RFSS_DCACHE_SIZE; i++) {
+        rfss_dcache_lru_push_front(&dcache_entries[i]);
+    }
+
+    dcache_initialized = 1;
+}
+
+static void rfss_dcache_drop(rfss_dcache_entry_t* entry) {
+    rfss_dcache_entry_t** link = &dcache_hash[entry->hash % RFSS_DCACHE_HASH_SIZE];
+    while (*link) {
+        if (*link == entry) {
+            *link = entry->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+
+    entry->hash_next = NULL;
+    entry->valid = 0;
+
+    // Empty slots go to the tail so they are reused first
+    rfss_dcache_lru_unlink(entry);
+    rfss_dcache_lru_push_back(entry);
+}
+
+static rfss_dcache_entry_t* rfss_dcache_find(uint32_t device_id, uint32_t parent, const char* name, uint32_t len, uint32_t hash) {
+    rfss_dcache_entry_t* entry = dcache_hash[hash % RFSS_DCACHE_HASH_SIZE];
+    while (entry) {
+        if (entry->hash == hash && entry->parent == parent && entry->device_id == device_id &&
+            entry->name_len == len && memcmp(entry->name, name, len) == 0) {
+            return entry;
+        }
+        entry = entry->hash_next;
+    }
+    return NULL;
+}
+
+// Returns 1 on a hit with the cached inode (0 for a negative entry) in *inode
+int rfss_dcache_lookup(rfss_fs_t* fs, uint32_t parent, const char* name, uint32_t* inode) {
+    uint32_t len = strlen(name);
+    if (!dcache_initialized || len >= RFSS_DCACHE_NAME_MAX) {
+        dcache_stats.misses++;
+        return 0;
+    }
+
+    uint32_t hash = rfss_dcache_hash(fs->device_id, parent, name, len);
+    rfss_dcache_entry_t* entry = rfss_dcache_find(fs->device_id, parent, name, len, hash);
+    if (!entry) {
+        dcache_stats.misses++;
+        return 0;
+    }
+
+    if (lru_head != entry) {
+        rfss_dcache_lru_unlink(entry);
+        rfss_dcache_lru_push_front(entry);
+    }
+
+    dcache_stats.hits++;
+    if (entry->inode == 0) {
+        dcache_stats.negative_hits++;
+    }
+    *inode = entry->inode;
+    return 1;
+}
+
+void rfss_dcache_insert(rfss_fs_t* fs, uint32_t parent, const char* name, uint32_t inode) {
+    uint32_t len = strlen(name);
+    if (len >= RFSS_DCACHE_NAME_MAX) {
+        return;
+    }
+
+    if (!dcache_initialized) {
+        rfss_dcache_init();
+    }
+
+    uint32_t hash = rfss_dcache_hash(fs->device_id, parent, name, len);
+    rfss_dcache_entry_t* entry = rfss_dcache_find(fs->device_id, parent, name, len, hash);
+    if (!entry) {
+        entry = lru_tail;
+        if (entry->valid) {
+            rfss_dcache_drop(entry);
+            dcache_stats.evictions++;
+        }
+
+        entry->device_id = fs->device_id;
+        entry->parent = parent;
+        entry->hash = hash;
+        entry->name_len = len;
+        memcpy(entry->name, name, len);
+        entry->valid = 1;
+        entry->hash_next = dcache_hash[hash % RFSS_DCACHE_HASH_SIZE];
+        dcache_hash[hash % RFSS_DCACHE_HASH_SIZE] = entry;
+    }
+
+    entry->inode = inode;
+    if (lru_head != entry) {
+        rfss_dcache_lru_unlink(entry);
+        rfss_dcache_lru_push_front(entry);
+    }
+}
+
+void rfss_dcache_invalidate(rfss_fs_t* fs, uint32_t parent, const char* name) {
+    uint32_t len = strlen(name);
+    if (!dcache_initialized || len >= RFSS_DCACHE_NAME_MAX) {
+        return;
+    }
+
+    uint32_t hash = rfss_dcache_hash(fs->device_id, parent, name, len);
+    rfss_dcache_entry_t* entry = rfss_dcache_find(fs->device_id, parent, name, len, hash);
+    if (entry) {
+        rfss_dcache_drop(entry);
+    }
+}
+
+// Forgets everything cached under a directory, or the whole device when `dir` is 0.
+// Needed once a directory inode goes away, since its number will be reused.
+void rfss_dcache_purge(uint32_t device_id, uint32_t dir) {
+    if (!dcache_initialized) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < RFSS_DCACHE_SIZE; i++) {
+        rfss_dcache_entry_t* entry = &dcache_entries[i];
+        if (entry->valid && entry->device_id == device_id &&
+            (dir == 0 || entry->parent == dir || entry->inode == dir)) {
+            rfss_dcache_drop(entry);
+        }
+    }
+}
+
+void rfss_dcache_get_stats(rfss_dcache_stats_t* stats) {
+    if (!stats) {
+        return;
+    }
+
+    *stats = dcache_stats;
+    stats->size = RFSS_DCACHE_SIZE;
+    stats->used = 0;
+
+    if (!dcache_initialized) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < RFSS_DCACHE_SIZE; i++) {
+        if (dcache_entries[i].valid) {
+            stats->used++;
+        }
+    }
+}
@@ -0,0 +1,241 @@
+#include "rfss.h"
+#include "../drivers/ata.h"
+#include "../kernel/logger.h"
+#include <string.h>
+
+// Online defragmentation. A file is moved whole: its data is copied into a free run big
+// enough for all of it, then the inode is switched to a single extent and the old blocks
+// (and any pointer blocks) are freed. On a journaled volume the data bypasses the log:
+// the log is emptied first so replay can't write old contents over the new run, the copy
+// is made stable, and only then are the switch and the bitmap change committed together,
+// so after a crash the file is either entirely in its old place or entirely in the new
+// one.
+//
+// Files that are already contiguous still move when a fitting run opens up lower on the
+// volume, which packs data towards the start and leaves the free space in one piece at
+// the end.
+
+static uint8_t move_buffer[RFSS_DEFRAG_CHUNK_BLOCKS * RFSS_BLOCK_SIZE];
+
+// Number of contiguous runs the file's data is split into
+uint32_t rfss_file_runs(rfss_fs_t* fs, rfss_inode_t* inode) {
+    uint32_t runs = 0;
+    uint32_t next = 0;
+    uint32_t index = 0;
+
+    while (index < inode->blocks_count) {
+        uint32_t run = 0;
+        uint32_t block = rfss_map_block(fs, inode, index, &run, NULL);
+        if (block == 0 || run == 0) {
+            // Holes count as a break
+            runs++;
+            next = 0;
+            index++;
+            continue;
+        }
+
+        // Lookups stop at the end of an indirect block even when the data goes on
+        if (block != next) {
+            runs++;
+        }
+        next = block + run;
+        index += run;
+    }
+
+    return runs;
+}
+
+// 0 for a contiguous file up to 100 when no two neighbouring blocks are adjacent on disk
+uint32_t rfss_frag_score(uint32_t runs, uint32_t blocks) {
+    if (blocks < 2 || runs < 2) {
+        return 0;
+    }
+    return (runs - 1) * 100 / (blocks - 1);
+}
+
+int rfss_frag_stats(rfss_fs_t* fs, rfss_frag_stats_t* stats) {
+    if (!fs || !fs->mounted || !stats) {
+        return -1;
+    }
+
+    memset(stats, 0, sizeof(rfss_frag_stats_t));
+    for (uint32_t inode_num = 1; inode_num <= fs->superblock->inode_count; inode_num++) {
+        rfss_inode_t* inode = rfss_get_inode(fs, inode_num);
+        if (!inode || inode->links_count == 0 || ((inode->mode >> 12) & 0xF) != RFSS_FILE_REGULAR) {
+            continue;
+        }
+
+        uint32_t runs = rfss_file_runs(fs, inode);
+        stats->files++;
+        stats->blocks += inode->blocks_count;
+        if (runs > 1) {
+            stats->fragmented++;
+            stats->breaks += runs - 1;
+        }
+        if (inode->blocks_count > 1) {
+            stats->joins += inode->blocks_count - 1;
+        }
+    }
+
+    stats->free_blocks = fs->superblock->free_blocks;
+    rfss_bitmap_find_run(fs, &fs->block_alloc, RFSS_BITMAP_NONE, &stats->free_runs, &stats->largest_free);
+    return 0;
+}
+
+// Copies the file's data to `target` and points the inode at it as one extent
+static int rfss_defrag_move(rfss_fs_t* fs, uint32_t inode_num, rfss_inode_t* inode, uint32_t target) {
+    uint32_t count = inode->blocks_count;
+
+    // The claims and frees may each log a different bitmap block
+    uint32_t bitmaps = 2 * count + 4;
+    if (bitmaps > fs->block_alloc.blocks) {
+        bitmaps = fs->block_alloc.blocks;
+    }
+    if (fs->journaling_enabled && rfss_journal_clear(fs) != 0) {
+        return -1;
+    }
+    if (rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS + bitmaps) != 0) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!rfss_bitmap_claim(fs, &fs->block_alloc, target + i)) {
+            while (i-- > 0) {
+                rfss_bitmap_free(fs, &fs->block_alloc, target + i);
+            }
+            rfss_journal_commit_transaction(fs);
+            return -1;
+        }
+    }
+    fs->dirty = 1;
+
+    uint32_t index = 0;
+    while (index < count) {
+        uint32_t run = 0;
+        uint32_t block = rfss_map_block(fs, inode, index, &run, NULL);
+        uint32_t n = count - index;
+        if (n > RFSS_DEFRAG_CHUNK_BLOCKS) n = RFSS_DEFRAG_CHUNK_BLOCKS;
+
+        int result;
+        if (block == 0) {
+            n = 1;
+            memset(move_buffer, 0, RFSS_BLOCK_SIZE);
+            result = 0;
+        } else {
+            if (n > run) n = run;
+            result = rfss_cache_read_blocks(fs, block, n, move_buffer);
+        }
+
+        if (result == 0) {
+            result = rfss_cache_write_blocks(fs, target + index, n, move_buffer);
+        }
+        index += n;
+
+        if (result == 0 && index == count && fs->journaling_enabled) {
+            result = ata_flush_cache(fs->device_id);
+        }
+        if (result != 0) {
+            for (uint32_t i = 0; i < count; i++) {
+                rfss_bitmap_free(fs, &fs->block_alloc, target + i);
+            }
+            rfss_journal_commit_transaction(fs);
+            return -1;
+        }
+    }
+
+    // Freeing the old data and pointer blocks adds them to the free count, which the
+    // claims above never took the new run from
+    rfss_free_file_blocks(fs, inode);
+    fs->superblock->free_blocks -= count;
+
+    inode->flags |= RFSS_INODE_FLAG_EXTENTS;
+    inode->extents[0].start_block = target;
+    inode->extents[0].length = count;
+    inode->extent_count = 1;
+    inode->blocks_count = count;
+    rfss_write_inode(fs, inode_num, inode);
+
+    rfss_journal_commit_transaction(fs);
+    if (fs->journaling_enabled && rfss_journal_flush(fs) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Moves one regular file into a single run if it is fragmented, or further down the volume
+// if it fits there. Returns the number of blocks moved, 0 if the file was left alone.
+int rfss_defrag_file(rfss_fs_t* fs, uint32_t inode_num) {
+    rfss_inode_t* inode = rfss_get_inode(fs, inode_num);
+    if (!fs || !fs->mounted || !inode) {
+        return -1;
+    }
+    if (inode->links_count == 0 || ((inode->mode >> 12) & 0xF) != RFSS_FILE_REGULAR || inode->blocks_count == 0) {
+        return 0;
+    }
+
+    if (rfss_delalloc_flush_inode(fs, inode) != 0) {
+        return -1;
+    }
+
+    uint32_t run = 0;
+    uint32_t first = rfss_map_block(fs, inode, 0, &run, NULL);
+    int fragmented = rfss_file_runs(fs, inode) > 1;
+
+    uint32_t target = rfss_bitmap_find_run(fs, &fs->block_alloc, inode->blocks_count, NULL, NULL);
+    if (target == RFSS_BITMAP_NONE || (!fragmented && first != 0 && target > first)) {
+        return 0;
+    }
+
+    if (rfss_defrag_move(fs, inode_num, inode, target) != 0) {
+        log(LOG_ERROR, "Failed to move inode %d", inode_num);
+        return -1;
+    }
+    return inode->blocks_count;
+}
+
+// One slice of background work: looks at up to RFSS_DEFRAG_SCAN inodes from where the last
+// call stopped and moves at most one file. Returns the number of blocks moved.
+int rfss_defrag_step(rfss_fs_t* fs) {
+    if (!fs || !fs->mounted) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < RFSS_DEFRAG_SCAN; i++) {
+        if (fs->defrag_next == 0 || fs->defrag_next > fs->superblock->inode_count) {
+            fs->defrag_next = 1;
+        }
+
+        int moved = rfss_defrag_file(fs, fs->defrag_next++);
+        if (moved != 0) {
+            return moved;
+        }
+    }
+    return 0;
+}
+
+// Passes over every file until a pass has nothing left to move. The first pass often has
+// to park files in the free space at the end; the next one brings them back down into
+// the room they left. Every move goes to a lower block than the file had, or makes it
+// contiguous, so this ends. Returns the number of blocks moved and, in `files`, the
+// number of moves.
+int rfss_defrag(rfss_fs_t* fs, uint32_t* files) {
+    if (!fs || !fs->mounted) {
+        return -1;
+    }
+
+    int total = 0;
+    *files = 0;
+    int moved_any = 1;
+    while (moved_any) {
+        moved_any = 0;
+        for (uint32_t inode_num = 1; inode_num <= fs->superblock->inode_count; inode_num++) {
+            int moved = rfss_defrag_file(fs, inode_num);
+            if (moved > 0) {
+                total += moved;
+                (*files)++;
+                moved_any = 1;
+            }
+        }
+    }
+    return total;
+}
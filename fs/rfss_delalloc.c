@@ -0,0 +1,204 @@
+#include "rfss.h"
+#include "../kernel/logger.h"
+#include <string.h>
+
+// Delayed allocation. Blocks appended to a file are held here without disk blocks and
+// only get them when the file is flushed (sync, a read, a truncate, or when its buffer
+// fills up). By then the length is known, so the whole tail is allocated as one run
+// right after the file's last block and written with one request, and small writes to
+// several files at once no longer interleave on disk.
+//
+// A slot buffers file blocks blocks_count.. of one inode. Slots are shared by all volumes
+// and taken over in LRU order.
+
+typedef struct {
+    rfss_fs_t* fs;
+    rfss_inode_t* inode;
+    uint32_t inode_num;
+    uint32_t count;
+    uint32_t last_used;
+} rfss_delalloc_slot_t;
+
+static rfss_delalloc_slot_t slots[RFSS_DELALLOC_FILES];
+static uint8_t slot_data[RFSS_DELALLOC_FILES][RFSS_DELALLOC_BLOCKS][RFSS_BLOCK_SIZE];
+static uint32_t delalloc_clock = 0;
+
+static rfss_delalloc_slot_t* rfss_delalloc_find(rfss_fs_t* fs, rfss_inode_t* inode) {
+    for (int i = 0; i < RFSS_DELALLOC_FILES; i++) {
+        if (slots[i].fs == fs && slots[i].inode == inode) {
+            return &slots[i];
+        }
+    }
+    return NULL;
+}
+
+// Blocks the volume has promised to buffered data but not handed out yet
+static uint32_t rfss_delalloc_reserved(rfss_fs_t* fs) {
+    uint32_t reserved = 0;
+    for (int i = 0; i < RFSS_DELALLOC_FILES; i++) {
+        if (slots[i].fs == fs) {
+            reserved += slots[i].count;
+        }
+    }
+    return reserved;
+}
+
+static int rfss_delalloc_write_slot(rfss_delalloc_slot_t* slot) {
+    // The slot is released first: the transaction this runs in can commit as soon as it
+    // ends, and a commit must not see these blocks as still buffered
+    rfss_delalloc_slot_t pending = *slot;
+    uint8_t (*data)[RFSS_BLOCK_SIZE] = slot_data[slot - slots];
+    memset(slot, 0, sizeof(rfss_delalloc_slot_t));
+
+    rfss_fs_t* fs = pending.fs;
+    rfss_inode_t* inode = pending.inode;
+    uint32_t first = inode->blocks_count;
+    int result = 0;
+
+    uint32_t added = rfss_extend_file(fs, inode, pending.count, NULL);
+    if (added < pending.count) {
+        log(LOG_ERROR, "Inode %d: no space for %d buffered blocks", pending.inode_num, pending.count - added);
+        if (inode->size > (uint64_t)inode->blocks_count * RFSS_BLOCK_SIZE) {
+            inode->size = (uint64_t)inode->blocks_count * RFSS_BLOCK_SIZE;
+        }
+        result = -1;
+    }
+
+    uint32_t done = 0;
+    while (done < added) {
+        uint32_t run = 0;
+        uint32_t block = rfss_map_block(fs, inode, first + done, &run, NULL);
+        if (block == 0) {
+            result = -1;
+            break;
+        }
+        if (run > added - done) {
+            run = added - done;
+        }
+
+        // The journal takes data a block at a time
+        if (fs->journaling_enabled) {
+            for (uint32_t i = 0; i < run; i++) {
+                if (rfss_write_block(fs, block + i, data[done + i]) != 0) {
+                    result = -1;
+                }
+            }
+        } else if (rfss_cache_write_blocks(fs, block, run, data[done]) != 0) {
+            result = -1;
+        }
+        done += run;
+    }
+
+    rfss_write_inode(fs, pending.inode_num, inode);
+    return result;
+}
+
+// Runs as one operation of its own, or as part of the write that filled the buffer
+static int rfss_delalloc_write_back(rfss_delalloc_slot_t* slot) {
+    rfss_fs_t* fs = slot->fs;
+    if (rfss_journal_start_transaction(fs, slot->count + RFSS_JOURNAL_OP_BLOCKS) != 0) {
+        return -1;
+    }
+
+    int result = rfss_delalloc_write_slot(slot);
+    rfss_journal_commit_transaction(fs);
+    return result;
+}
+
+// Returns the buffer for file block `index`, which must not have a disk block yet. Blocks
+// between the end of the file and `index` read back as zeros. Returns NULL when the block
+// is too far out for the buffer or the volume couldn't hold it once flushed.
+uint8_t* rfss_delalloc_block(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t inode_num, uint32_t index) {
+    if (index < inode->blocks_count || index - inode->blocks_count >= RFSS_DELALLOC_BLOCKS) {
+        return NULL;
+    }
+
+    uint32_t wanted = index - inode->blocks_count + 1;
+    rfss_delalloc_slot_t* slot = rfss_delalloc_find(fs, inode);
+    uint32_t count = slot ? slot->count : 0;
+
+    if (wanted > count && rfss_delalloc_reserved(fs) + (wanted - count) > fs->superblock->free_blocks) {
+        return NULL;
+    }
+
+    if (!slot) {
+        slot = &slots[0];
+        for (int i = 1; i < RFSS_DELALLOC_FILES && slot->fs; i++) {
+            if (!slots[i].fs || slots[i].last_used < slot->last_used) {
+                slot = &slots[i];
+            }
+        }
+        if (slot->fs && rfss_delalloc_write_back(slot) != 0) {
+            return NULL;
+        }
+
+        slot->fs = fs;
+        slot->inode = inode;
+        slot->inode_num = inode_num;
+        slot->count = 0;
+    }
+
+    uint8_t (*data)[RFSS_BLOCK_SIZE] = slot_data[slot - slots];
+    while (slot->count < wanted) {
+        memset(data[slot->count++], 0, RFSS_BLOCK_SIZE);
+    }
+
+    slot->last_used = ++delalloc_clock;
+    return data[index - inode->blocks_count];
+}
+
+// Gives the buffered blocks of `inode` their disk blocks and writes them out
+int rfss_delalloc_flush_inode(rfss_fs_t* fs, rfss_inode_t* inode) {
+    rfss_delalloc_slot_t* slot = rfss_delalloc_find(fs, inode);
+    return slot ? rfss_delalloc_write_back(slot) : 0;
+}
+
+int rfss_delalloc_flush(rfss_fs_t* fs) {
+    int result = 0;
+    for (int i = 0; i < RFSS_DELALLOC_FILES; i++) {
+        if (slots[i].fs == fs && rfss_delalloc_write_back(&slots[i]) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// Forgets the buffered blocks of a file whose data is going away anyway
+void rfss_delalloc_drop(rfss_fs_t* fs, rfss_inode_t* inode) {
+    rfss_delalloc_slot_t* slot = rfss_delalloc_find(fs, inode);
+    if (slot) {
+        memset(slot, 0, sizeof(rfss_delalloc_slot_t));
+    }
+}
+
+// Returns inode table block `block` the way it should be logged: files with buffered
+// blocks only claim the part of their data that has disk blocks, so a replayed journal
+// never shows a size covering blocks that were never written. `table_block` is returned
+// as is when none of its inodes has buffered blocks.
+const uint8_t* rfss_delalloc_inode_block(rfss_fs_t* fs, uint32_t block, const uint8_t* table_block) {
+    static uint8_t copy[RFSS_BLOCK_SIZE];
+    uint32_t per_block = RFSS_BLOCK_SIZE / sizeof(rfss_inode_t);
+    const uint8_t* result = table_block;
+
+    for (int i = 0; i < RFSS_DELALLOC_FILES; i++) {
+        if (slots[i].fs != fs || (slots[i].inode_num - 1) / per_block != block) {
+            continue;
+        }
+
+        if (result == table_block) {
+            memcpy(copy, table_block, RFSS_BLOCK_SIZE);
+            result = copy;
+        }
+
+        rfss_inode_t* inode = (rfss_inode_t*)copy + (slots[i].inode_num - 1) % per_block;
+        uint64_t allocated = (uint64_t)inode->blocks_count * RFSS_BLOCK_SIZE;
+        if (inode->size > allocated) {
+            inode->size = allocated;
+        }
+    }
+
+    if (result != table_block && (fs->superblock->features & RFSS_FEATURE_METADATA_CSUM)) {
+        rfss_inode_block_seal(copy);
+    }
+    return result;
+}
@@ -0,0 +1,608 @@
+#include "rfss.h"
+#include "../kernel/logger.h"
+#include <string.h>
+
+// Directory entry blocks. Legacy directories are plain lists of rfss_dir_entry_t records
+// scanned block by block. Indexed directories (RFSS_INODE_FLAG_INDEX) keep a hash index
+// whose root sits in block 0 behind the '..' entry. Every leaf is an ordinary entry block
+// holding one hash range, and interior index blocks look like empty entry blocks, so a
+// linear scan still finds every entry. On checksummed volumes each block ends with an
+// rfss_dir_tail_t, so entries stop at rfss_dir_block_end instead of the block size.
+
+#define RFSS_DIR_REC_LEN(name_len) ((sizeof(rfss_dir_entry_t) + (name_len) + 3) & ~3u)
+#define RFSS_DIR_MAX_ENTRIES (RFSS_BLOCK_SIZE / RFSS_DIR_REC_LEN(1))
+#define RFSS_DX_ROOT_OFFSET ((12 + sizeof(rfss_dir_entry_t) + 3) & ~3u)
+#define RFSS_DX_NODE_OFFSET 8
+#define RFSS_DX_LIMIT(end, offset) (((end) - (offset) - sizeof(rfss_dx_header_t)) / sizeof(rfss_dx_entry_t))
+#define RFSS_DIR_TAIL_TYPE 0xDE
+
+// One index block on the path from the root to a leaf
+typedef struct {
+    uint32_t block;
+    uint8_t* buffer;
+    rfss_dx_header_t* header;
+    rfss_dx_entry_t* entries;
+    uint32_t position;
+} rfss_dx_frame_t;
+
+static uint8_t root_buffer[RFSS_BLOCK_SIZE];
+static uint8_t node_buffer[RFSS_BLOCK_SIZE];
+static uint8_t leaf_buffer[RFSS_BLOCK_SIZE];
+static uint8_t split_buffer[RFSS_BLOCK_SIZE];
+static uint8_t split_source[RFSS_BLOCK_SIZE];
+
+static uint32_t rfss_dir_hash(const char* name, uint32_t len) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint32_t rfss_dir_block(rfss_fs_t* fs, rfss_inode_t* dir, uint32_t index) {
+    uint32_t run = 0;
+    return rfss_map_block(fs, dir, index, &run, NULL);
+}
+
+uint32_t rfss_dir_block_end(rfss_fs_t* fs) {
+    if (fs->superblock->features & RFSS_FEATURE_METADATA_CSUM) {
+        return RFSS_BLOCK_SIZE - sizeof(rfss_dir_tail_t);
+    }
+    return RFSS_BLOCK_SIZE;
+}
+
+void rfss_dir_seal(uint8_t* block) {
+    rfss_dir_tail_t* tail = (rfss_dir_tail_t*)(block + RFSS_BLOCK_SIZE - sizeof(rfss_dir_tail_t));
+    tail->inode = 0;
+    tail->rec_len = sizeof(rfss_dir_tail_t);
+    tail->name_len = 0;
+    tail->file_type = RFSS_DIR_TAIL_TYPE;
+    tail->checksum = rfss_crc32c(0, block, RFSS_BLOCK_SIZE - sizeof(uint32_t));
+}
+
+int rfss_dir_verify(const uint8_t* block) {
+    const rfss_dir_tail_t* tail = (const rfss_dir_tail_t*)(block + RFSS_BLOCK_SIZE - sizeof(rfss_dir_tail_t));
+    if (tail->rec_len != sizeof(rfss_dir_tail_t) || tail->file_type != RFSS_DIR_TAIL_TYPE) {
+        return -1;
+    }
+    return tail->checksum == rfss_crc32c(0, block, RFSS_BLOCK_SIZE - sizeof(uint32_t)) ? 0 : -1;
+}
+
+int rfss_dir_write_block(rfss_fs_t* fs, uint32_t block, uint8_t* buffer) {
+    if (fs->superblock->features & RFSS_FEATURE_METADATA_CSUM) {
+        rfss_dir_seal(buffer);
+    }
+    return rfss_write_block(fs, block, buffer);
+}
+
+static int rfss_dir_entry_ok(rfss_dir_entry_t* entry, uint32_t offset, uint32_t end) {
+    return entry->rec_len != 0 && entry->rec_len <= end - offset &&
+           entry->rec_len >= sizeof(rfss_dir_entry_t);
+}
+
+static void rfss_dir_init_block(uint8_t* block, uint32_t end) {
+    memset(block, 0, RFSS_BLOCK_SIZE);
+    rfss_dir_entry_t* entry = (rfss_dir_entry_t*)block;
+    entry->rec_len = end;
+}
+
+static int rfss_dir_is_index_node(uint8_t* block, uint32_t end) {
+    rfss_dir_entry_t* entry = (rfss_dir_entry_t*)block;
+    rfss_dx_header_t* header = (rfss_dx_header_t*)(block + RFSS_DX_NODE_OFFSET);
+    return entry->inode == 0 && entry->rec_len == end && header->magic == RFSS_DX_MAGIC;
+}
+
+static uint32_t rfss_dir_scan_block(uint8_t* block, uint32_t end, const char* name, uint32_t len) {
+    uint32_t offset = 0;
+    while (offset < end) {
+        rfss_dir_entry_t* entry = (rfss_dir_entry_t*)(block + offset);
+        if (!rfss_dir_entry_ok(entry, offset, end)) {
+            break;
+        }
+
+        if (entry->inode != 0 && entry->name_len == len && memcmp(entry->name, name, len) == 0) {
+            return entry->inode;
+        }
+
+        offset += entry->rec_len;
+    }
+    return 0;
+}
+
+// Puts the entry into the first gap big enough for it; -1 if the block is full
+static int rfss_dir_insert_entry(uint8_t* block, uint32_t end, const char* name, uint32_t len, uint32_t inode, uint8_t type) {
+    uint32_t needed = RFSS_DIR_REC_LEN(len);
+    uint32_t offset = 0;
+
+    while (offset < end) {
+        rfss_dir_entry_t* entry = (rfss_dir_entry_t*)(block + offset);
+        if (!rfss_dir_entry_ok(entry, offset, end)) {
+            return -1;
+        }
+
+        uint32_t used = entry->inode ? RFSS_DIR_REC_LEN(entry->name_len) : 0;
+        if (entry->rec_len >= used + needed) {
+            uint16_t rec_len = entry->rec_len - used;
+            if (used) {
+                entry->rec_len = used;
+                entry = (rfss_dir_entry_t*)(block + offset + used);
+            }
+
+            entry->inode = inode;
+            entry->rec_len = rec_len;
+            entry->name_len = len;
+            entry->file_type = type;
+            memcpy(entry->name, name, len);
+            memset(entry->name + len, 0, RFSS_MAX_FILENAME - len);
+            return 0;
+        }
+
+        offset += entry->rec_len;
+    }
+
+    return -1;
+}
+
+// Drops the entry, folding its space into the previous record. Returns its inode.
+static uint32_t rfss_dir_remove_entry(uint8_t* block, uint32_t end, const char* name, uint32_t len) {
+    rfss_dir_entry_t* prev = NULL;
+    uint32_t offset = 0;
+
+    while (offset < end) {
+        rfss_dir_entry_t* entry = (rfss_dir_entry_t*)(block + offset);
+        if (!rfss_dir_entry_ok(entry, offset, end)) {
+            break;
+        }
+
+        if (entry->inode != 0 && entry->name_len == len && memcmp(entry->name, name, len) == 0) {
+            uint32_t inode = entry->inode;
+            if (prev) {
+                prev->rec_len += entry->rec_len;
+            } else {
+                entry->inode = 0;
+            }
+            return inode;
+        }
+
+        prev = entry;
+        offset += entry->rec_len;
+    }
+
+    return 0;
+}
+
+// Appends an empty block to the directory and returns it
+static uint32_t rfss_dir_grow(rfss_fs_t* fs, rfss_inode_t* dir) {
+    if (rfss_extend_file(fs, dir, 1, NULL) != 1) {
+        return 0;
+    }
+    dir->size += RFSS_BLOCK_SIZE;
+    return rfss_dir_block(fs, dir, dir->blocks_count - 1);
+}
+
+// Last entry whose hash is <= `hash`; entry 0 catches everything below entry 1
+static uint32_t rfss_dx_search(rfss_dx_entry_t* entries, uint32_t count, uint32_t hash) {
+    uint32_t lo = 1, hi = count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (entries[mid].hash <= hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+static int rfss_dx_load(rfss_fs_t* fs, rfss_dx_frame_t* frame, uint32_t block, uint8_t* buffer, uint32_t offset, uint32_t hash) {
+    if (block == 0 || rfss_read_block(fs, block, buffer) != 0) {
+        return -1;
+    }
+
+    frame->block = block;
+    frame->buffer = buffer;
+    frame->header = (rfss_dx_header_t*)(buffer + offset);
+    frame->entries = (rfss_dx_entry_t*)(frame->header + 1);
+
+    rfss_dx_header_t* header = frame->header;
+    uint32_t limit = RFSS_DX_LIMIT(rfss_dir_block_end(fs), offset);
+    if (header->magic != RFSS_DX_MAGIC || header->count == 0 || header->count > header->limit || header->limit != limit) {
+        //log(LOG_ERROR, "Bad directory index block %d", block);
+        return -1;
+    }
+
+    frame->position = rfss_dx_search(frame->entries, header->count, hash);
+    return 0;
+}
+
+// Walks the index down to the leaf covering `hash`, one frame per index level
+static uint32_t rfss_dx_probe(rfss_fs_t* fs, rfss_inode_t* dir, uint32_t hash, rfss_dx_frame_t* frames, uint32_t* depth) {
+    if (rfss_dx_load(fs, &frames[0], rfss_dir_block(fs, dir, 0), root_buffer, RFSS_DX_ROOT_OFFSET, hash) != 0 ||
+        frames[0].header->levels > 1) {
+        return 0;
+    }
+
+    *depth = 1;
+    uint32_t block = frames[0].entries[frames[0].position].block;
+
+    if (frames[0].header->levels == 1) {
+        if (rfss_dx_load(fs, &frames[1], block, node_buffer, RFSS_DX_NODE_OFFSET, hash) != 0 ||
+            frames[1].header->levels != 0) {
+            return 0;
+        }
+        *depth = 2;
+        block = frames[1].entries[frames[1].position].block;
+    }
+
+    return block;
+}
+
+static void rfss_dx_insert_at(rfss_dx_frame_t* frame, uint32_t position, uint32_t hash, uint32_t block) {
+    rfss_dx_entry_t* entries = frame->entries;
+    memmove(&entries[position + 1], &entries[position], (frame->header->count - position) * sizeof(rfss_dx_entry_t));
+    entries[position].hash = hash;
+    entries[position].block = block;
+    frame->header->count++;
+}
+
+static void rfss_dx_init_node(uint8_t* buffer, uint32_t end, uint32_t count) {
+    rfss_dir_init_block(buffer, end);
+    rfss_dx_header_t* header = (rfss_dx_header_t*)(buffer + RFSS_DX_NODE_OFFSET);
+    header->magic = RFSS_DX_MAGIC;
+    header->levels = 0;
+    header->count = count;
+    header->limit = RFSS_DX_LIMIT(end, RFSS_DX_NODE_OFFSET);
+}
+
+// Adds the (hash, block) pair for a freshly split leaf to the deepest index block,
+// growing or splitting the index when that block is full
+static int rfss_dx_insert_index(rfss_fs_t* fs, rfss_inode_t* dir, rfss_dx_frame_t* frames, uint32_t depth, uint32_t hash, uint32_t block) {
+    rfss_dx_frame_t* frame = &frames[depth - 1];
+    uint32_t end = rfss_dir_block_end(fs);
+
+    if (frame->header->count < frame->header->limit) {
+        rfss_dx_insert_at(frame, frame->position + 1, hash, block);
+        return rfss_dir_write_block(fs, frame->block, frame->buffer);
+    }
+
+    if (depth == 1) {
+        // Root is full: move its entries into a new index block one level down
+        uint32_t node = rfss_dir_grow(fs, dir);
+        if (node == 0) {
+            return -1;
+        }
+
+        rfss_dx_frame_t* root = &frames[0];
+        rfss_dx_init_node(node_buffer, end, root->header->count);
+        rfss_dx_frame_t child = { node, node_buffer, (rfss_dx_header_t*)(node_buffer + RFSS_DX_NODE_OFFSET), NULL, root->position };
+        child.entries = (rfss_dx_entry_t*)(child.header + 1);
+        memcpy(child.entries, root->entries, root->header->count * sizeof(rfss_dx_entry_t));
+        rfss_dx_insert_at(&child, child.position + 1, hash, block);
+
+        root->header->levels = 1;
+        root->header->count = 1;
+        root->entries[0].hash = 0;
+        root->entries[0].block = node;
+
+        if (rfss_dir_write_block(fs, node, node_buffer) != 0) {
+            return -1;
+        }
+        return rfss_dir_write_block(fs, root->block, root->buffer);
+    }
+
+    rfss_dx_frame_t* root = &frames[0];
+    if (root->header->count >= root->header->limit) {
+        log(LOG_ERROR, "Directory index is full");
+        return -1;
+    }
+
+    // Interior block is full: move its upper half into a new sibling
+    uint32_t sibling = rfss_dir_grow(fs, dir);
+    if (sibling == 0) {
+        return -1;
+    }
+
+    uint32_t keep = frame->header->count / 2;
+    uint32_t moved = frame->header->count - keep;
+    rfss_dx_init_node(split_buffer, end, moved);
+    rfss_dx_frame_t upper = { sibling, split_buffer, (rfss_dx_header_t*)(split_buffer + RFSS_DX_NODE_OFFSET), NULL, 0 };
+    upper.entries = (rfss_dx_entry_t*)(upper.header + 1);
+    memcpy(upper.entries, &frame->entries[keep], moved * sizeof(rfss_dx_entry_t));
+    frame->header->count = keep;
+
+    if (frame->position + 1 >= keep) {
+        rfss_dx_insert_at(&upper, frame->position + 1 - keep, hash, block);
+    } else {
+        rfss_dx_insert_at(frame, frame->position + 1, hash, block);
+    }
+
+    if (rfss_dir_write_block(fs, sibling, split_buffer) != 0 || rfss_dir_write_block(fs, frame->block, frame->buffer) != 0) {
+        return -1;
+    }
+
+    rfss_dx_insert_at(root, root->position + 1, upper.entries[0].hash, sibling);
+    return rfss_dir_write_block(fs, root->block, root->buffer);
+}
+
+// Moves the entries of `leaf` with the higher hashes into `upper`. Returns the lowest
+// hash that moved, or 0 when every entry shares one hash and the leaf can't be split.
+static uint32_t rfss_dx_split_leaf(uint8_t* leaf, uint8_t* upper, uint32_t end) {
+    struct {
+        uint32_t hash;
+        uint32_t offset;
+    } sorted[RFSS_DIR_MAX_ENTRIES];
+    uint32_t count = 0;
+
+    uint32_t offset = 0;
+    while (offset < end && count < RFSS_DIR_MAX_ENTRIES) {
+        rfss_dir_entry_t* entry = (rfss_dir_entry_t*)(leaf + offset);
+        if (!rfss_dir_entry_ok(entry, offset, end)) {
+            break;
+        }
+
+        if (entry->inode != 0) {
+            uint32_t hash = rfss_dir_hash(entry->name, entry->name_len);
+            uint32_t i = count++;
+            while (i > 0 && sorted[i - 1].hash > hash) {
+                sorted[i] = sorted[i - 1];
+                i--;
+            }
+            sorted[i].hash = hash;
+            sorted[i].offset = offset;
+        }
+
+        offset += entry->rec_len;
+    }
+
+    // Split as close to the middle as possible without separating equal hashes
+    uint32_t split = 0;
+    for (uint32_t d = 0; d <= count / 2 && split == 0; d++) {
+        uint32_t candidates[2] = { count / 2 + d, count / 2 - d };
+        for (int c = 0; c < 2; c++) {
+            uint32_t m = candidates[c];
+            if (m > 0 && m < count && sorted[m - 1].hash != sorted[m].hash) {
+                split = m;
+                break;
+            }
+        }
+    }
+
+    if (split == 0) {
+        return 0;
+    }
+
+    memcpy(split_source, leaf, RFSS_BLOCK_SIZE);
+    uint8_t* targets[2] = { leaf, upper };
+    uint32_t ranges[3] = { 0, split, count };
+
+    for (int t = 0; t < 2; t++) {
+        uint8_t* block = targets[t];
+        memset(block, 0, RFSS_BLOCK_SIZE);
+
+        uint32_t position = 0;
+        rfss_dir_entry_t* last = NULL;
+        for (uint32_t i = ranges[t]; i < ranges[t + 1]; i++) {
+            rfss_dir_entry_t* source = (rfss_dir_entry_t*)(split_source + sorted[i].offset);
+            last = (rfss_dir_entry_t*)(block + position);
+            memcpy(last, source, sizeof(rfss_dir_entry_t));
+            last->rec_len = RFSS_DIR_REC_LEN(source->name_len);
+            position += last->rec_len;
+        }
+        last->rec_len += end - position;
+    }
+
+    return sorted[split].hash;
+}
+
+// Turns a directory with at most one entry block into an indexed one
+static int rfss_dx_create(rfss_fs_t* fs, rfss_inode_t* dir) {
+    uint32_t root = rfss_dir_block(fs, dir, 0);
+    if (root == 0 || rfss_read_block(fs, root, root_buffer) != 0) {
+        return -1;
+    }
+
+    // The root needs the standard '.' and '..' layout, with '..' covering the rest of the block
+    uint32_t end = rfss_dir_block_end(fs);
+    rfss_dir_entry_t* dot = (rfss_dir_entry_t*)root_buffer;
+    rfss_dir_entry_t* dotdot = (rfss_dir_entry_t*)(root_buffer + 12);
+    if (dot->rec_len != 12 || dotdot->rec_len != end - 12) {
+        return -1;
+    }
+
+    uint32_t leaf;
+    if (dir->blocks_count >= 2) {
+        leaf = rfss_dir_block(fs, dir, 1);
+    } else {
+        leaf = rfss_dir_grow(fs, dir);
+        rfss_dir_init_block(leaf_buffer, end);
+        if (leaf != 0 && rfss_dir_write_block(fs, leaf, leaf_buffer) != 0) {
+            return -1;
+        }
+    }
+
+    if (leaf == 0) {
+        return -1;
+    }
+
+    memset(root_buffer + RFSS_DX_ROOT_OFFSET, 0, end - RFSS_DX_ROOT_OFFSET);
+    rfss_dx_header_t* header = (rfss_dx_header_t*)(root_buffer + RFSS_DX_ROOT_OFFSET);
+    rfss_dx_entry_t* entries = (rfss_dx_entry_t*)(header + 1);
+    header->magic = RFSS_DX_MAGIC;
+    header->levels = 0;
+    header->count = 1;
+    header->limit = RFSS_DX_LIMIT(end, RFSS_DX_ROOT_OFFSET);
+    entries[0].hash = 0;
+    entries[0].block = leaf;
+
+    if (rfss_dir_write_block(fs, root, root_buffer) != 0) {
+        return -1;
+    }
+
+    dir->flags |= RFSS_INODE_FLAG_INDEX;
+    return 0;
+}
+
+// Returns 1 if the index can't be used and the caller should fall back to a linear add
+static int rfss_dx_add(rfss_fs_t* fs, rfss_inode_t* dir, const char* name, uint32_t len, uint32_t inode, uint8_t type) {
+    uint32_t hash = rfss_dir_hash(name, len);
+    uint32_t end = rfss_dir_block_end(fs);
+    rfss_dx_frame_t frames[2];
+    uint32_t depth = 0;
+
+    uint32_t leaf = rfss_dx_probe(fs, dir, hash, frames, &depth);
+    if (leaf == 0 || rfss_read_block(fs, leaf, leaf_buffer) != 0) {
+        return 1;
+    }
+
+    if (rfss_dir_insert_entry(leaf_buffer, end, name, len, inode, type) == 0) {
+        return rfss_dir_write_block(fs, leaf, leaf_buffer);
+    }
+
+    uint32_t split_hash = rfss_dx_split_leaf(leaf_buffer, split_buffer, end);
+    if (split_hash == 0) {
+        log(LOG_ERROR, "Directory leaf full of colliding names");
+        return -1;
+    }
+
+    uint32_t upper = rfss_dir_grow(fs, dir);
+    if (upper == 0) {
+        return -1;
+    }
+
+    uint8_t* target = hash >= split_hash ? split_buffer : leaf_buffer;
+    if (rfss_dir_insert_entry(target, end, name, len, inode, type) != 0 ||
+        rfss_dir_write_block(fs, upper, split_buffer) != 0 ||
+        rfss_dir_write_block(fs, leaf, leaf_buffer) != 0) {
+        return -1;
+    }
+
+    return rfss_dx_insert_index(fs, dir, frames, depth, split_hash, upper);
+}
+
+uint32_t rfss_dir_lookup(rfss_fs_t* fs, rfss_inode_t* dir, const char* name) {
+    uint32_t len = strlen(name);
+    uint32_t end = rfss_dir_block_end(fs);
+
+    if (dir->flags & RFSS_INODE_FLAG_INDEX) {
+        rfss_dx_frame_t frames[2];
+        uint32_t depth = 0;
+        uint32_t leaf = rfss_dx_probe(fs, dir, rfss_dir_hash(name, len), frames, &depth);
+        if (leaf != 0 && rfss_read_block(fs, leaf, leaf_buffer) == 0) {
+            return rfss_dir_scan_block(leaf_buffer, end, name, len);
+        }
+    }
+
+    for (uint32_t i = 0; i < dir->blocks_count; i++) {
+        uint32_t block = rfss_dir_block(fs, dir, i);
+        if (block == 0 || rfss_read_block(fs, block, leaf_buffer) != 0) {
+            continue;
+        }
+
+        uint32_t inode = rfss_dir_scan_block(leaf_buffer, end, name, len);
+        if (inode != 0) {
+            return inode;
+        }
+    }
+
+    return 0;
+}
+
+// May grow the directory; the caller writes `dir` back afterwards
+int rfss_dir_add(rfss_fs_t* fs, rfss_inode_t* dir, const char* name, uint32_t inode, uint8_t type) {
+    uint32_t len = strlen(name);
+    uint32_t end = rfss_dir_block_end(fs);
+
+    if (!(dir->flags & RFSS_INODE_FLAG_INDEX) && dir->blocks_count <= 2) {
+        rfss_dx_create(fs, dir);
+    }
+
+    if (dir->flags & RFSS_INODE_FLAG_INDEX) {
+        int result = rfss_dx_add(fs, dir, name, len, inode, type);
+        if (result <= 0) {
+            return result;
+        }
+    }
+
+    for (uint32_t i = 0; i < dir->blocks_count; i++) {
+        uint32_t block = rfss_dir_block(fs, dir, i);
+        if (block == 0 || rfss_read_block(fs, block, leaf_buffer) != 0) {
+            continue;
+        }
+
+        if (!rfss_dir_is_index_node(leaf_buffer, end) &&
+            rfss_dir_insert_entry(leaf_buffer, end, name, len, inode, type) == 0) {
+            return rfss_dir_write_block(fs, block, leaf_buffer);
+        }
+    }
+
+    uint32_t block = rfss_dir_grow(fs, dir);
+    if (block == 0) {
+        //log(LOG_ERROR, "Failed to allocate block for directory");
+        return -1;
+    }
+
+    rfss_dir_init_block(leaf_buffer, end);
+    rfss_dir_insert_entry(leaf_buffer, end, name, len, inode, type);
+    return rfss_dir_write_block(fs, block, leaf_buffer);
+}
+
+// Returns the inode the removed entry pointed at, or 0 if there was none
+uint32_t rfss_dir_remove(rfss_fs_t* fs, rfss_inode_t* dir, const char* name) {
+    uint32_t len = strlen(name);
+    uint32_t end = rfss_dir_block_end(fs);
+
+    if (dir->flags & RFSS_INODE_FLAG_INDEX) {
+        rfss_dx_frame_t frames[2];
+        uint32_t depth = 0;
+        uint32_t leaf = rfss_dx_probe(fs, dir, rfss_dir_hash(name, len), frames, &depth);
+        if (leaf != 0 && rfss_read_block(fs, leaf, leaf_buffer) == 0) {
+            uint32_t inode = rfss_dir_remove_entry(leaf_buffer, end, name, len);
+            if (inode != 0 && rfss_dir_write_block(fs, leaf, leaf_buffer) != 0) {
+                return 0;
+            }
+            return inode;
+        }
+    }
+
+    for (uint32_t i = 0; i < dir->blocks_count; i++) {
+        uint32_t block = rfss_dir_block(fs, dir, i);
+        if (block == 0 || rfss_read_block(fs, block, leaf_buffer) != 0) {
+            continue;
+        }
+
+        uint32_t inode = rfss_dir_remove_entry(leaf_buffer, end, name, len);
+        if (inode != 0) {
+            return rfss_dir_write_block(fs, block, leaf_buffer) == 0 ? inode : 0;
+        }
+    }
+
+    return 0;
+}
+
+// Reads the '..' entry that rfss_format and rfss_create_directory put in block 0
+uint32_t rfss_dir_parent(rfss_fs_t* fs, rfss_inode_t* dir) {
+    uint32_t block = rfss_dir_block(fs, dir, 0);
+    if (block == 0 || rfss_read_block(fs, block, leaf_buffer) != 0) {
+        return 0;
+    }
+
+    rfss_dir_entry_t* dotdot = (rfss_dir_entry_t*)(leaf_buffer + 12);
+    if (dotdot->name_len != 2 || dotdot->name[0] != '.' || dotdot->name[1] != '.') {
+        return 0;
+    }
+    return dotdot->inode;
+}
+
+int rfss_dir_set_parent(rfss_fs_t* fs, rfss_inode_t* dir, uint32_t parent) {
+    uint32_t block = rfss_dir_block(fs, dir, 0);
+    if (block == 0 || rfss_read_block(fs, block, leaf_buffer) != 0) {
+        return -1;
+    }
+
+    rfss_dir_entry_t* dotdot = (rfss_dir_entry_t*)(leaf_buffer + 12);
+    if (dotdot->name_len != 2 || dotdot->name[0] != '.' || dotdot->name[1] != '.') {
+        return -1;
+    }
+    dotdot->inode = parent;
+    return rfss_dir_write_block(fs, block, leaf_buffer);
+}
@@ -0,0 +1,457 @@
+#include "rfss.h"
+#include "../kernel/logger.h"
+#include <string.h>
+
+// Maps file block indexes to disk blocks. Files carrying RFSS_INODE_FLAG_EXTENTS keep
+// their data in runs of contiguous blocks listed in order in inode->extents. Everything
+// else (older files, directories, and files whose extent list overflowed) uses the
+// classic block map: direct_blocks, then single, double and triple indirect blocks.
+
+#define RFSS_PTRS_PER_BLOCK (RFSS_BLOCK_SIZE / sizeof(uint32_t))
+
+static uint32_t map_buffer[RFSS_PTRS_PER_BLOCK];
+static uint32_t free_buffers[3][RFSS_PTRS_PER_BLOCK];
+
+static int rfss_uses_extents(rfss_inode_t* inode) {
+    return (inode->flags & RFSS_INODE_FLAG_EXTENTS) != 0;
+}
+
+static uint32_t rfss_map_new_pointer_block(rfss_fs_t* fs) {
+    static uint8_t zero_block[RFSS_BLOCK_SIZE];
+
+    uint32_t block = rfss_allocate_block(fs);
+    if (block != 0 && rfss_write_block(fs, block, zero_block) != 0) {
+        rfss_free_block(fs, block);
+        return 0;
+    }
+    return block;
+}
+
+// Reference entry of an inode in the inode table, NULL for a copy kept anywhere else
+static rfss_inode_ref_t* rfss_map_ref(rfss_fs_t* fs, rfss_inode_t* inode) {
+    if (!fs->inode_table || !fs->inode_refs || (uintptr_t)inode < (uintptr_t)fs->inode_table) {
+        return NULL;
+    }
+
+    uintptr_t offset = (uintptr_t)inode - (uintptr_t)fs->inode_table;
+    uint32_t index = offset % RFSS_BLOCK_SIZE / sizeof(rfss_inode_t);
+    uint32_t inode_num = offset / RFSS_BLOCK_SIZE * RFSS_INODES_PER_BLOCK + index + 1;
+    if (offset % RFSS_BLOCK_SIZE % sizeof(rfss_inode_t) != 0 || index >= RFSS_INODES_PER_BLOCK ||
+        inode_num > fs->superblock->inode_count) {
+        return NULL;
+    }
+    return &fs->inode_refs[inode_num - 1];
+}
+
+// Called whenever the file gains or loses blocks. Map windows of every open handle on
+// the inode are stale from here on, not just the one of the caller.
+static void rfss_map_changed(rfss_fs_t* fs, rfss_inode_t* inode, rfss_map_cache_t* cache) {
+    rfss_inode_ref_t* ref = rfss_map_ref(fs, inode);
+    if (ref) {
+        ref->map_generation++;
+    }
+    if (cache) {
+        cache->leaf = 0;
+    }
+}
+
+// Follows entry `slot` of pointer block `block`, allocating the child when `create` is set
+static uint32_t rfss_map_child(rfss_fs_t* fs, uint32_t block, uint32_t slot, int create) {
+    if (rfss_read_block(fs, block, map_buffer) != 0) {
+        return 0;
+    }
+
+    uint32_t child = map_buffer[slot];
+    if (child != 0 || !create) {
+        return child;
+    }
+
+    child = rfss_map_new_pointer_block(fs);
+    if (child == 0) {
+        return 0;
+    }
+
+    map_buffer[slot] = child;
+    if (rfss_write_block(fs, block, map_buffer) != 0) {
+        rfss_free_block(fs, child);
+        return 0;
+    }
+    return child;
+}
+
+// Returns the indirect block whose entry `slot` maps file block `index`, which must be
+// past the direct blocks. Returns 0 if that part of the tree doesn't exist.
+static uint32_t rfss_map_leaf(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t index, int create, uint32_t* slot) {
+    const uint32_t per_block = RFSS_PTRS_PER_BLOCK;
+    uint32_t root;
+    int depth;
+
+    index -= RFSS_DIRECT_BLOCKS;
+    if (index < per_block) {
+        root = inode->indirect_block;
+        depth = 1;
+    } else if ((index -= per_block) < per_block * per_block) {
+        root = inode->double_indirect_block;
+        depth = 2;
+    } else {
+        index -= per_block * per_block;
+        if (index / (per_block * per_block) >= per_block) {
+            return 0;
+        }
+        root = inode->triple_indirect_block;
+        depth = 3;
+    }
+
+    if (root == 0) {
+        if (!create) {
+            return 0;
+        }
+        root = rfss_map_new_pointer_block(fs);
+        if (root == 0) {
+            return 0;
+        }
+
+        if (depth == 1) {
+            inode->indirect_block = root;
+        } else if (depth == 2) {
+            inode->double_indirect_block = root;
+        } else {
+            inode->triple_indirect_block = root;
+        }
+    }
+
+    uint32_t block = root;
+    for (int level = depth - 1; level > 0 && block != 0; level--) {
+        uint32_t span = level == 2 ? per_block * per_block : per_block;
+        block = rfss_map_child(fs, block, (index / span) % per_block, create);
+    }
+
+    *slot = index % per_block;
+    return block;
+}
+
+// Points file blocks index.. at disk blocks start.. through the block map. Returns how
+// many entries were set; fewer than `count` means a pointer block couldn't be allocated.
+static uint32_t rfss_map_set_run(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t index, uint32_t start, uint32_t count) {
+    uint32_t done = 0;
+
+    while (done < count && index + done < RFSS_DIRECT_BLOCKS) {
+        inode->direct_blocks[index + done] = start + done;
+        done++;
+    }
+
+    while (done < count) {
+        uint32_t slot = 0;
+        uint32_t leaf = rfss_map_leaf(fs, inode, index + done, 1, &slot);
+        if (leaf == 0 || rfss_read_block(fs, leaf, map_buffer) != 0) {
+            break;
+        }
+
+        uint32_t first = done;
+        while (done < count && slot < RFSS_PTRS_PER_BLOCK) {
+            map_buffer[slot++] = start + done;
+            done++;
+        }
+
+        if (rfss_write_block(fs, leaf, map_buffer) != 0) {
+            done = first;
+            break;
+        }
+    }
+
+    return done;
+}
+
+// Returns the disk block holding file block `index` (0 if unmapped) and, in `run`, how
+// many blocks from there on are contiguous on disk. Block-map lookups go through
+// `cache` when given, so sequential access reads each indirect block once per window.
+uint32_t rfss_map_block(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t index, uint32_t* run, rfss_map_cache_t* cache) {
+    *run = 0;
+    if (inode->flags & RFSS_INODE_FLAG_INLINE) {
+        return 0;
+    }
+
+    if (rfss_uses_extents(inode)) {
+        uint32_t logical = 0;
+        for (uint32_t i = 0; i < inode->extent_count && i < RFSS_MAX_EXTENTS; i++) {
+            rfss_extent_t extent = inode->extents[i];
+            if (index < logical + extent.length) {
+                *run = logical + extent.length - index;
+                return extent.start_block + (index - logical);
+            }
+            logical += extent.length;
+        }
+        return 0;
+    }
+
+    if (index < RFSS_DIRECT_BLOCKS) {
+        uint32_t block = inode->direct_blocks[index];
+        if (block == 0) {
+            return 0;
+        }
+        *run = 1;
+        while (index + *run < RFSS_DIRECT_BLOCKS && inode->direct_blocks[index + *run] == block + *run) {
+            (*run)++;
+        }
+        return block;
+    }
+
+    const uint32_t* entries;
+    uint32_t available;
+
+    // Only inodes in the table have a generation to check windows against
+    rfss_inode_ref_t* ref = cache ? rfss_map_ref(fs, inode) : NULL;
+    if (!ref) {
+        cache = NULL;
+    }
+
+    if (cache && cache->leaf != 0 && cache->generation == ref->map_generation &&
+        index >= cache->first && index - cache->first < cache->count && cache->entries[index - cache->first] != 0) {
+        entries = &cache->entries[index - cache->first];
+        available = cache->count - (index - cache->first);
+        cache->hits++;
+    } else {
+        uint32_t slot = 0;
+        uint32_t leaf = rfss_map_leaf(fs, inode, index, 0, &slot);
+        if (leaf == 0 || rfss_read_block(fs, leaf, map_buffer) != 0) {
+            return 0;
+        }
+
+        if (cache) {
+            // Keep the aligned window around this entry rather than the whole block
+            uint32_t window = slot - slot % RFSS_MAP_CACHE_ENTRIES;
+            cache->leaf = leaf;
+            cache->generation = ref->map_generation;
+            cache->first = index - (slot - window);
+            cache->count = RFSS_PTRS_PER_BLOCK - window;
+            if (cache->count > RFSS_MAP_CACHE_ENTRIES) {
+                cache->count = RFSS_MAP_CACHE_ENTRIES;
+            }
+            memcpy(cache->entries, &map_buffer[window], cache->count * sizeof(uint32_t));
+            cache->misses++;
+        }
+
+        entries = &map_buffer[slot];
+        available = RFSS_PTRS_PER_BLOCK - slot;
+    }
+
+    uint32_t block = entries[0];
+    if (block == 0) {
+        return 0;
+    }
+    *run = 1;
+    while (*run < available && entries[*run] == block + *run) {
+        (*run)++;
+    }
+    return block;
+}
+
+// Frees the pointer tree under `block`; data blocks are released too when `data` is set
+static void rfss_free_tree(rfss_fs_t* fs, uint32_t block, int depth, int data) {
+    if (block == 0) {
+        return;
+    }
+
+    uint32_t* entries = free_buffers[depth - 1];
+    if (rfss_read_block(fs, block, entries) == 0) {
+        for (uint32_t i = 0; i < RFSS_PTRS_PER_BLOCK; i++) {
+            if (entries[i] == 0) {
+                continue;
+            }
+            if (depth > 1) {
+                rfss_free_tree(fs, entries[i], depth - 1, data);
+            } else if (data) {
+                rfss_free_block(fs, entries[i]);
+            }
+        }
+    }
+
+    rfss_free_block(fs, block);
+}
+
+static void rfss_free_block_map(rfss_fs_t* fs, rfss_inode_t* inode, int data) {
+    for (int i = 0; i < RFSS_DIRECT_BLOCKS; i++) {
+        if (data && inode->direct_blocks[i]) {
+            rfss_free_block(fs, inode->direct_blocks[i]);
+        }
+        inode->direct_blocks[i] = 0;
+    }
+
+    rfss_free_tree(fs, inode->indirect_block, 1, data);
+    rfss_free_tree(fs, inode->double_indirect_block, 2, data);
+    rfss_free_tree(fs, inode->triple_indirect_block, 3, data);
+    inode->indirect_block = 0;
+    inode->double_indirect_block = 0;
+    inode->triple_indirect_block = 0;
+}
+
+// Rewrites an extent-mapped inode as a block map so it can keep growing once all
+// extent slots are used
+static int rfss_convert_to_block_map(rfss_fs_t* fs, rfss_inode_t* inode) {
+    rfss_extent_t extents[RFSS_MAX_EXTENTS];
+    uint32_t extent_count = inode->extent_count;
+    memcpy(extents, inode->extents, sizeof(extents));
+
+    inode->flags &= ~RFSS_INODE_FLAG_EXTENTS;
+    memset(inode->extents, 0, sizeof(inode->extents));
+    inode->extent_count = 0;
+
+    uint32_t index = 0;
+    for (uint32_t i = 0; i < extent_count && i < RFSS_MAX_EXTENTS; i++) {
+        if (rfss_map_set_run(fs, inode, index, extents[i].start_block, extents[i].length) != extents[i].length) {
+            //log(LOG_ERROR, "No space for block map, keeping extents");
+            rfss_free_block_map(fs, inode, 0);
+            memcpy(inode->extents, extents, sizeof(extents));
+            inode->extent_count = extent_count;
+            inode->flags |= RFSS_INODE_FLAG_EXTENTS;
+            return -1;
+        }
+        index += extents[i].length;
+    }
+
+    return 0;
+}
+
+// Appends up to `count` blocks to the file, preferring the blocks right after its last
+// one so extents just grow. Returns how many blocks were added.
+uint32_t rfss_extend_file(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t count, rfss_map_cache_t* cache) {
+    uint32_t added = 0;
+    if (inode->flags & RFSS_INODE_FLAG_INLINE) {
+        return 0;
+    }
+
+    while (added < count) {
+        uint32_t goal = 0;
+        if (inode->blocks_count > 0) {
+            uint32_t run = 0;
+            uint32_t last = rfss_map_block(fs, inode, inode->blocks_count - 1, &run, NULL);
+            goal = last ? last + 1 : 0;
+        }
+
+        uint32_t n = 0;
+        uint32_t start = rfss_allocate_run(fs, goal, count - added, &n);
+        if (start == 0) {
+            break;
+        }
+
+        uint32_t mapped = 0;
+        if (rfss_uses_extents(inode)) {
+            if (inode->extent_count > 0 && start == goal) {
+                inode->extents[inode->extent_count - 1].length += n;
+                mapped = n;
+            } else if (inode->extent_count < RFSS_MAX_EXTENTS) {
+                inode->extents[inode->extent_count].start_block = start;
+                inode->extents[inode->extent_count].length = n;
+                inode->extent_count++;
+                mapped = n;
+            } else {
+                rfss_convert_to_block_map(fs, inode);
+            }
+        }
+
+        if (!rfss_uses_extents(inode)) {
+            mapped = rfss_map_set_run(fs, inode, inode->blocks_count, start, n);
+        }
+
+        for (uint32_t i = mapped; i < n; i++) {
+            rfss_free_block(fs, start + i);
+        }
+
+        inode->blocks_count += mapped;
+        added += mapped;
+        if (mapped < n) {
+            break;
+        }
+    }
+
+    rfss_map_changed(fs, inode, cache);
+    return added;
+}
+
+// Drops every file block from `count` on. Pointer blocks of a block-mapped file stay
+// with the inode until it is deleted.
+void rfss_shrink_file(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t count, rfss_map_cache_t* cache) {
+    if (count >= inode->blocks_count) {
+        return;
+    }
+
+    if (rfss_uses_extents(inode)) {
+        uint32_t logical = 0;
+        uint32_t kept = 0;
+        for (uint32_t i = 0; i < inode->extent_count && i < RFSS_MAX_EXTENTS; i++) {
+            rfss_extent_t extent = inode->extents[i];
+            uint32_t keep = count > logical ? count - logical : 0;
+            if (keep > extent.length) {
+                keep = extent.length;
+            }
+
+            for (uint32_t j = keep; j < extent.length; j++) {
+                rfss_free_block(fs, extent.start_block + j);
+            }
+            logical += extent.length;
+            inode->extents[i].length = keep;
+            if (keep > 0) {
+                kept = i + 1;
+            }
+        }
+
+        for (uint32_t i = kept; i < RFSS_MAX_EXTENTS; i++) {
+            memset(&inode->extents[i], 0, sizeof(rfss_extent_t));
+        }
+        inode->extent_count = kept;
+    } else {
+        uint32_t index = count;
+        while (index < inode->blocks_count) {
+            if (index < RFSS_DIRECT_BLOCKS) {
+                if (inode->direct_blocks[index]) {
+                    rfss_free_block(fs, inode->direct_blocks[index]);
+                }
+                inode->direct_blocks[index++] = 0;
+                continue;
+            }
+
+            // Slots line up across levels since every level spans a multiple of a block
+            uint32_t slot = (index - RFSS_DIRECT_BLOCKS) % RFSS_PTRS_PER_BLOCK;
+            uint32_t leaf = rfss_map_leaf(fs, inode, index, 0, &slot);
+            if (leaf == 0 || rfss_read_block(fs, leaf, map_buffer) != 0) {
+                index += RFSS_PTRS_PER_BLOCK - slot;
+                continue;
+            }
+
+            while (slot < RFSS_PTRS_PER_BLOCK && index < inode->blocks_count) {
+                if (map_buffer[slot]) {
+                    rfss_free_block(fs, map_buffer[slot]);
+                }
+                map_buffer[slot++] = 0;
+                index++;
+            }
+            rfss_write_block(fs, leaf, map_buffer);
+        }
+    }
+
+    inode->blocks_count = count;
+    rfss_map_changed(fs, inode, cache);
+}
+
+void rfss_free_file_blocks(rfss_fs_t* fs, rfss_inode_t* inode) {
+    rfss_delalloc_drop(fs, inode);
+
+    // Inline data goes with the inode; what is left is an empty extent file
+    if (inode->flags & RFSS_INODE_FLAG_INLINE) {
+        memset(RFSS_INLINE_DATA(inode), 0, RFSS_INLINE_DATA_SIZE);
+        inode->flags = (inode->flags & ~RFSS_INODE_FLAG_INLINE) | RFSS_INODE_FLAG_EXTENTS;
+    } else if (rfss_uses_extents(inode)) {
+        for (uint32_t i = 0; i < inode->extent_count && i < RFSS_MAX_EXTENTS; i++) {
+            for (uint32_t j = 0; j < inode->extents[i].length; j++) {
+                rfss_free_block(fs, inode->extents[i].start_block + j);
+            }
+        }
+        memset(inode->extents, 0, sizeof(inode->extents));
+        inode->extent_count = 0;
+    } else {
+        rfss_free_block_map(fs, inode, 1);
+    }
+
+    inode->blocks_count = 0;
+    rfss_map_changed(fs, inode, NULL);
+}
@@ -0,0 +1,531 @@
+#include "rfss.h"
+#include "../kernel/logger.h"
+#include "../mm/memory.h"
+#include <string.h>
+
+// Consistency checker. The volume is synced first, so it can stay mounted (journaled
+// or not): the running transaction is committed and every dirty inode, bitmap and
+// block is written back before anything is read. The passes then build their own view
+// of the volume and compare it with what the allocator wrote down:
+//   superblock:  identity, layout and checksum
+//   inodes:      the inode table read in large runs; every block an inode maps (and every
+//                pointer block it needs) is claimed in an in-memory block bitmap, so out of
+//                range and doubly used blocks show up
+//   directories: every entry block of every directory, giving each inode's references
+//                and each directory's parent
+//   bitmaps:     the on-disk block and inode bitmaps, the summary blocks and the
+//                superblock counters against what the earlier passes found
+
+#define RFSS_FSCK_READ_BLOCKS 32
+#define RFSS_FSCK_LOG_LIMIT 16
+#define RFSS_FSCK_PTRS (RFSS_BLOCK_SIZE / sizeof(uint32_t))
+#define RFSS_FSCK_INODES_PER_BLOCK (RFSS_BLOCK_SIZE / sizeof(rfss_inode_t))
+#define RFSS_FSCK_ENTRY_HEADER 8
+
+#define RFSS_FSCK_ERROR(check, ...) do { \
+    if ((check)->report->errors[(check)->pass]++ < RFSS_FSCK_LOG_LIMIT) log(LOG_ERROR, __VA_ARGS__); \
+} while (0)
+
+typedef struct {
+    rfss_fs_t* fs;
+    rfss_fsck_report_t* report;
+    uint32_t pass;
+    uint32_t metadata_end;
+    uint32_t* claimed;
+    uint8_t* types;
+    uint16_t* refs;
+    uint32_t* parents;
+    uint32_t* dotdot;
+} rfss_fsck_t;
+
+const char* const rfss_fsck_pass_names[RFSS_FSCK_PASSES] = {
+    "superblock", "inodes", "directories", "bitmaps"
+};
+
+static uint8_t scan_buffer[RFSS_FSCK_READ_BLOCKS * RFSS_BLOCK_SIZE];
+static uint32_t pointer_buffers[3][RFSS_FSCK_PTRS];
+
+// kfree doesn't give memory back, so the working set is kept between runs and only
+// replaced when a bigger volume needs more
+static uint8_t* fsck_arena = NULL;
+static uint32_t fsck_arena_size = 0;
+
+static int rfss_fsck_read(rfss_fsck_t* check, uint32_t block, uint32_t count) {
+    check->report->reads++;
+    return rfss_cache_read_blocks(check->fs, block, count, scan_buffer);
+}
+
+// Marks `block` as used by `inode_num`. Returns 0 when the block can't be trusted.
+static int rfss_fsck_claim(rfss_fsck_t* check, uint32_t inode_num, uint32_t block) {
+    if (block < check->metadata_end || block >= check->fs->superblock->total_blocks) {
+        RFSS_FSCK_ERROR(check, "Inode %d: block %d is outside the data area", inode_num, block);
+        return 0;
+    }
+
+    uint32_t mask = 1u << (block % 32);
+    if (check->claimed[block / 32] & mask) {
+        RFSS_FSCK_ERROR(check, "Inode %d: block %d is already in use", inode_num, block);
+        return 0;
+    }
+
+    check->claimed[block / 32] |= mask;
+    return 1;
+}
+
+// Claims the pointer tree under `block` and every data block it maps; `index` is the
+// file block its first entry maps. Returns the number of data blocks found.
+static uint32_t rfss_fsck_walk_tree(rfss_fsck_t* check, uint32_t inode_num, uint32_t block, int depth, uint32_t index, uint32_t blocks_count) {
+    if (block == 0 || !rfss_fsck_claim(check, inode_num, block)) {
+        return 0;
+    }
+
+    uint32_t* entries = pointer_buffers[depth - 1];
+    if (rfss_read_block(check->fs, block, entries) != 0) {
+        RFSS_FSCK_ERROR(check, "Inode %d: can't read pointer block %d", inode_num, block);
+        return 0;
+    }
+
+    uint32_t span = depth == 1 ? 1 : depth == 2 ? RFSS_FSCK_PTRS : RFSS_FSCK_PTRS * RFSS_FSCK_PTRS;
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < RFSS_FSCK_PTRS; i++) {
+        if (entries[i] == 0) {
+            continue;
+        }
+        if (depth > 1) {
+            found += rfss_fsck_walk_tree(check, inode_num, entries[i], depth - 1, index + i * span, blocks_count);
+            continue;
+        }
+        if (index + i >= blocks_count) {
+            RFSS_FSCK_ERROR(check, "Inode %d: block %d mapped past the end of the file", inode_num, index + i);
+        }
+        found += rfss_fsck_claim(check, inode_num, entries[i]);
+    }
+    return found;
+}
+
+static uint32_t rfss_fsck_inode_blocks(rfss_fsck_t* check, uint32_t inode_num, rfss_inode_t* inode) {
+    uint32_t found = 0;
+
+    if (inode->flags & RFSS_INODE_FLAG_INLINE) {
+        if (((inode->mode >> 12) & 0xF) != RFSS_FILE_REGULAR || inode->size > RFSS_INLINE_DATA_SIZE) {
+            RFSS_FSCK_ERROR(check, "Inode %d: bad inline data (%d bytes)", inode_num, (uint32_t)inode->size);
+        }
+        return 0;
+    }
+
+    if (inode->flags & RFSS_INODE_FLAG_EXTENTS) {
+        if (inode->extent_count > RFSS_MAX_EXTENTS) {
+            RFSS_FSCK_ERROR(check, "Inode %d: %d extents", inode_num, inode->extent_count);
+            return 0;
+        }
+        for (uint32_t i = 0; i < inode->extent_count; i++) {
+            for (uint32_t j = 0; j < inode->extents[i].length; j++) {
+                if (!rfss_fsck_claim(check, inode_num, inode->extents[i].start_block + j)) {
+                    break;
+                }
+                found++;
+            }
+        }
+        return found;
+    }
+
+    for (uint32_t i = 0; i < RFSS_DIRECT_BLOCKS; i++) {
+        if (inode->direct_blocks[i] == 0) {
+            continue;
+        }
+        if (i >= inode->blocks_count) {
+            RFSS_FSCK_ERROR(check, "Inode %d: block %d mapped past the end of the file", inode_num, i);
+        }
+        found += rfss_fsck_claim(check, inode_num, inode->direct_blocks[i]);
+    }
+
+    uint32_t base = RFSS_DIRECT_BLOCKS;
+    found += rfss_fsck_walk_tree(check, inode_num, inode->indirect_block, 1, base, inode->blocks_count);
+    base += RFSS_FSCK_PTRS;
+    found += rfss_fsck_walk_tree(check, inode_num, inode->double_indirect_block, 2, base, inode->blocks_count);
+    base += RFSS_FSCK_PTRS * RFSS_FSCK_PTRS;
+    found += rfss_fsck_walk_tree(check, inode_num, inode->triple_indirect_block, 3, base, inode->blocks_count);
+    return found;
+}
+
+static int rfss_fsck_superblock(rfss_fsck_t* check) {
+    rfss_superblock_t* sb = check->fs->superblock;
+    if (sb->magic != RFSS_MAGIC || sb->version != RFSS_VERSION || sb->block_size != RFSS_BLOCK_SIZE) {
+        RFSS_FSCK_ERROR(check, "Not an Rfss+ volume this checker understands");
+        return -1;
+    }
+
+    uint32_t inode_blocks = (sb->inode_count + RFSS_FSCK_INODES_PER_BLOCK - 1) / RFSS_FSCK_INODES_PER_BLOCK;
+    if (sb->inode_count == 0 || sb->root_inode == 0 || sb->root_inode > sb->inode_count ||
+        sb->inode_table_block + inode_blocks > sb->first_data_block ||
+        sb->bitmap_block + sb->bitmap_blocks > sb->first_data_block ||
+        sb->inode_bitmap_block >= sb->first_data_block ||
+        sb->first_data_block >= sb->total_blocks) {
+        RFSS_FSCK_ERROR(check, "Superblock layout is inconsistent");
+        return -1;
+    }
+
+    // The root directory's first block sits between the fixed regions and first_data_block
+    uint32_t ends[] = {
+        sb->inode_table_block + inode_blocks, sb->bitmap_block + sb->bitmap_blocks, sb->inode_bitmap_block + 1,
+        sb->summary_block + sb->summary_blocks, sb->journal_block + sb->journal_size
+    };
+    for (uint32_t i = 0; i < sizeof(ends) / sizeof(ends[0]); i++) {
+        if (ends[i] > check->metadata_end) {
+            check->metadata_end = ends[i];
+        }
+    }
+
+    if ((sb->features & RFSS_FEATURE_METADATA_CSUM) &&
+        (rfss_fsck_read(check, 0, 1) != 0 || rfss_superblock_verify((rfss_superblock_t*)scan_buffer) != 0)) {
+        RFSS_FSCK_ERROR(check, "Superblock checksum mismatch");
+    }
+    return 0;
+}
+
+static void rfss_fsck_inodes(rfss_fsck_t* check) {
+    rfss_superblock_t* sb = check->fs->superblock;
+    uint32_t inode_blocks = (sb->inode_count + RFSS_FSCK_INODES_PER_BLOCK - 1) / RFSS_FSCK_INODES_PER_BLOCK;
+
+    for (uint32_t first = 0; first < inode_blocks; first += RFSS_FSCK_READ_BLOCKS) {
+        uint32_t count = inode_blocks - first < RFSS_FSCK_READ_BLOCKS ? inode_blocks - first : RFSS_FSCK_READ_BLOCKS;
+        if (rfss_fsck_read(check, sb->inode_table_block + first, count) != 0) {
+            RFSS_FSCK_ERROR(check, "Can't read inode table blocks %d-%d", first, first + count - 1);
+            continue;
+        }
+
+        for (uint32_t b = 0; b < count; b++) {
+            uint8_t* block = scan_buffer + b * RFSS_BLOCK_SIZE;
+            if ((sb->features & RFSS_FEATURE_METADATA_CSUM) && rfss_inode_block_verify(block) != 0) {
+                RFSS_FSCK_ERROR(check, "Inode table block %d checksum mismatch", first + b);
+            }
+
+            for (uint32_t i = 0; i < RFSS_FSCK_INODES_PER_BLOCK; i++) {
+                uint32_t inode_num = (first + b) * RFSS_FSCK_INODES_PER_BLOCK + i + 1;
+                rfss_inode_t* inode = (rfss_inode_t*)block + i;
+                if (inode_num > sb->inode_count) {
+                    break;
+                }
+                if (inode->mode == 0 && inode->links_count == 0) {
+                    continue;
+                }
+
+                uint32_t type = (inode->mode >> 12) & 0xF;
+                if (type < RFSS_FILE_REGULAR || type > RFSS_FILE_DEVICE) {
+                    RFSS_FSCK_ERROR(check, "Inode %d: unknown type %d", inode_num, type);
+                    continue;
+                }
+                if (inode->links_count == 0) {
+                    RFSS_FSCK_ERROR(check, "Inode %d is in use with no links", inode_num);
+                }
+
+                check->types[inode_num] = type;
+                check->report->inodes++;
+                if (type == RFSS_FILE_DIRECTORY) {
+                    check->report->directories++;
+                }
+
+                uint32_t found = rfss_fsck_inode_blocks(check, inode_num, inode);
+                check->report->blocks += found;
+                if (found != inode->blocks_count) {
+                    RFSS_FSCK_ERROR(check, "Inode %d: %d blocks recorded, %d mapped", inode_num, inode->blocks_count, found);
+                }
+                if (!(inode->flags & RFSS_INODE_FLAG_INLINE) && inode->size > (uint64_t)inode->blocks_count * RFSS_BLOCK_SIZE) {
+                    RFSS_FSCK_ERROR(check, "Inode %d: size is past its last block", inode_num);
+                }
+            }
+        }
+    }
+
+    if (check->types[sb->root_inode] != RFSS_FILE_DIRECTORY) {
+        RFSS_FSCK_ERROR(check, "Root inode %d is not a directory", sb->root_inode);
+    }
+}
+
+static void rfss_fsck_dir_block(rfss_fsck_t* check, uint32_t dir, uint32_t index, uint8_t* block) {
+    rfss_superblock_t* sb = check->fs->superblock;
+    uint32_t end = rfss_dir_block_end(check->fs);
+    if ((sb->features & RFSS_FEATURE_METADATA_CSUM) && rfss_dir_verify(block) != 0) {
+        RFSS_FSCK_ERROR(check, "Directory block %d of inode %d checksum mismatch", index, dir);
+    }
+
+    uint32_t offset = 0;
+    while (offset < end) {
+        rfss_dir_entry_t* entry = (rfss_dir_entry_t*)(block + offset);
+        if (entry->rec_len < RFSS_FSCK_ENTRY_HEADER || entry->rec_len % 4 != 0 || entry->rec_len > end - offset ||
+            (entry->inode != 0 && RFSS_FSCK_ENTRY_HEADER + entry->name_len > entry->rec_len)) {
+            RFSS_FSCK_ERROR(check, "Directory block %d of inode %d: broken entry at offset %d", index, dir, offset);
+            return;
+        }
+        offset += entry->rec_len;
+        if (entry->inode == 0) {
+            continue;
+        }
+
+        char name[RFSS_MAX_FILENAME + 1];
+        memcpy(name, entry->name, entry->name_len);
+        name[entry->name_len] = '\0';
+
+        uint32_t target = entry->inode;
+        if (target > sb->inode_count || check->types[target] == 0) {
+            RFSS_FSCK_ERROR(check, "Directory %d: '%s' points to unused inode %d", dir, name, target);
+            continue;
+        }
+        if (entry->file_type != check->types[target]) {
+            RFSS_FSCK_ERROR(check, "Directory %d: '%s' has the wrong file type", dir, name);
+        }
+
+        if (strcmp(name, ".") == 0) {
+            if (target != dir) {
+                RFSS_FSCK_ERROR(check, "Directory %d: '.' points to inode %d", dir, target);
+            }
+        } else if (strcmp(name, "..") == 0) {
+            check->dotdot[dir] = target;
+        } else {
+            check->refs[target]++;
+            if (check->types[target] == RFSS_FILE_DIRECTORY) {
+                check->parents[target] = dir;
+            }
+        }
+    }
+}
+
+static void rfss_fsck_directories(rfss_fsck_t* check) {
+    rfss_fs_t* fs = check->fs;
+    rfss_superblock_t* sb = fs->superblock;
+
+    for (uint32_t dir = 1; dir <= sb->inode_count; dir++) {
+        if (check->types[dir] != RFSS_FILE_DIRECTORY) {
+            continue;
+        }
+
+        rfss_inode_t* inode = rfss_get_inode(fs, dir);
+        uint32_t index = 0;
+        while (inode && index < inode->blocks_count) {
+            uint32_t run = 0;
+            uint32_t block = rfss_map_block(fs, inode, index, &run, NULL);
+            if (block == 0) {
+                RFSS_FSCK_ERROR(check, "Directory %d: block %d is not mapped", dir, index);
+                index++;
+                continue;
+            }
+
+            uint32_t count = run < RFSS_FSCK_READ_BLOCKS ? run : RFSS_FSCK_READ_BLOCKS;
+            if (count > inode->blocks_count - index) {
+                count = inode->blocks_count - index;
+            }
+            if (rfss_fsck_read(check, block, count) != 0) {
+                RFSS_FSCK_ERROR(check, "Directory %d: can't read block %d", dir, index);
+            } else {
+                for (uint32_t i = 0; i < count; i++) {
+                    rfss_fsck_dir_block(check, dir, index + i, scan_buffer + i * RFSS_BLOCK_SIZE);
+                }
+            }
+            index += count;
+        }
+    }
+
+    // Every name is one link. Directories hang off exactly one parent, which their '..'
+    // names, and following parents leads to the root.
+    for (uint32_t inode_num = 1; inode_num <= sb->inode_count; inode_num++) {
+        uint32_t type = check->types[inode_num];
+        if (type == 0) {
+            continue;
+        }
+
+        if (type != RFSS_FILE_DIRECTORY) {
+            rfss_inode_t* inode = rfss_get_inode(fs, inode_num);
+            uint32_t links = inode ? inode->links_count : 0;
+            int orphan = check->refs[inode_num] == 0 && fs->inode_refs[inode_num - 1].orphan;
+            if (check->refs[inode_num] != links && !orphan) {
+                RFSS_FSCK_ERROR(check, "Inode %d has %d links but %d names", inode_num, links, check->refs[inode_num]);
+            }
+            continue;
+        }
+
+        if (inode_num == sb->root_inode) {
+            if (check->refs[inode_num] != 0 || check->dotdot[inode_num] != inode_num) {
+                RFSS_FSCK_ERROR(check, "Root directory has a parent");
+            }
+            continue;
+        }
+
+        if (check->refs[inode_num] != 1) {
+            RFSS_FSCK_ERROR(check, "Directory %d has %d names", inode_num, check->refs[inode_num]);
+            continue;
+        }
+        if (check->dotdot[inode_num] != check->parents[inode_num]) {
+            RFSS_FSCK_ERROR(check, "Directory %d: '..' is %d, parent is %d", inode_num, check->dotdot[inode_num], check->parents[inode_num]);
+        }
+
+        uint32_t current = inode_num;
+        uint32_t steps = 0;
+        while (current != sb->root_inode && current != 0 && steps++ < sb->inode_count) {
+            current = check->parents[current];
+        }
+        if (current != sb->root_inode) {
+            RFSS_FSCK_ERROR(check, "Directory %d can't be reached from the root", inode_num);
+        }
+    }
+}
+
+static void rfss_fsck_bitmaps(rfss_fsck_t* check) {
+    rfss_fs_t* fs = check->fs;
+    rfss_superblock_t* sb = fs->superblock;
+
+    uint32_t block_bits = sb->total_blocks;
+    if (block_bits > sb->bitmap_blocks * RFSS_BITMAP_BITS) {
+        block_bits = sb->bitmap_blocks * RFSS_BITMAP_BITS;
+    }
+
+    uint32_t missing = 0;
+    uint32_t leaked = 0;
+    uint32_t disk_free = 0;
+    static uint32_t summary[RFSS_SUMMARY_ENTRIES];
+
+    for (uint32_t first = 0; first < sb->bitmap_blocks; first += RFSS_FSCK_READ_BLOCKS) {
+        uint32_t count = sb->bitmap_blocks - first < RFSS_FSCK_READ_BLOCKS ? sb->bitmap_blocks - first : RFSS_FSCK_READ_BLOCKS;
+        if (rfss_fsck_read(check, sb->bitmap_block + first, count) != 0) {
+            RFSS_FSCK_ERROR(check, "Can't read block bitmap blocks %d-%d", first, first + count - 1);
+            continue;
+        }
+
+        for (uint32_t b = first; b < first + count; b++) {
+            const uint32_t* words = (const uint32_t*)(scan_buffer + (b - first) * RFSS_BLOCK_SIZE);
+            uint32_t base = b * RFSS_BITMAP_BITS;
+            uint32_t block_free = 0;
+
+            for (uint32_t w = 0; w < RFSS_BITMAP_BITS / 32; w++) {
+                uint32_t bit = base + w * 32;
+                if (bit >= block_bits) {
+                    break;
+                }
+
+                // Bits below first_data_block are metadata and must stay set; the rest
+                // are the allocator's
+                uint32_t first = sb->first_data_block;
+                uint32_t valid = bit + 32 > block_bits ? (1u << (block_bits - bit)) - 1 : 0xFFFFFFFF;
+                uint32_t reserved = bit >= first ? 0 : first - bit >= 32 ? valid : valid & ((1u << (first - bit)) - 1);
+                uint32_t mask = valid & ~reserved;
+                if ((words[w] & reserved) != reserved) {
+                    RFSS_FSCK_ERROR(check, "Metadata blocks near %d are marked free", bit);
+                }
+
+                uint32_t used = check->claimed[bit / 32] & mask;
+                missing += __builtin_popcount(used & ~words[w]);
+                leaked += __builtin_popcount(words[w] & mask & ~used);
+                block_free += __builtin_popcount(~words[w] & mask);
+            }
+
+            disk_free += block_free;
+            if (sb->summary_block) {
+                if (b % RFSS_SUMMARY_ENTRIES == 0 && rfss_read_block(fs, sb->summary_block + b / RFSS_SUMMARY_ENTRIES, summary) != 0) {
+                    memset(summary, 0xFF, sizeof(summary));
+                }
+                if (summary[b % RFSS_SUMMARY_ENTRIES] != block_free) {
+                    RFSS_FSCK_ERROR(check, "Bitmap block %d: summary says %d free, bitmap has %d", b, summary[b % RFSS_SUMMARY_ENTRIES], block_free);
+                }
+            }
+        }
+    }
+
+    if (missing) {
+        RFSS_FSCK_ERROR(check, "%d blocks in use are marked free", missing);
+    }
+    if (leaked) {
+        RFSS_FSCK_ERROR(check, "%d blocks are marked used but nothing owns them", leaked);
+    }
+    if (sb->free_blocks != disk_free) {
+        RFSS_FSCK_ERROR(check, "Superblock counts %d free blocks, bitmap has %d", sb->free_blocks, disk_free);
+    }
+
+    uint32_t inode_bitmap_blocks = (sb->inode_count + RFSS_BITMAP_BITS - 1) / RFSS_BITMAP_BITS;
+    uint32_t inodes_free = 0;
+    missing = 0;
+    leaked = 0;
+    if (rfss_fsck_read(check, sb->inode_bitmap_block, inode_bitmap_blocks) != 0) {
+        RFSS_FSCK_ERROR(check, "Can't read the inode bitmap");
+        return;
+    }
+
+    const uint32_t* words = (const uint32_t*)scan_buffer;
+    for (uint32_t bit = 0; bit < sb->inode_count; bit++) {
+        int marked = (words[bit / 32] >> (bit % 32)) & 1;
+        int used = check->types[bit + 1] != 0;
+        inodes_free += !marked;
+        missing += used && !marked;
+        leaked += marked && !used;
+    }
+
+    if (missing) {
+        RFSS_FSCK_ERROR(check, "%d inodes in use are marked free", missing);
+    }
+    if (leaked) {
+        RFSS_FSCK_ERROR(check, "%d inodes are marked used but empty", leaked);
+    }
+    if (sb->free_inode_count != inodes_free) {
+        RFSS_FSCK_ERROR(check, "Superblock counts %d free inodes, bitmap has %d", sb->free_inode_count, inodes_free);
+    }
+}
+
+// Runs every pass and fills `report` with per-pass error counts and timings. Returns 0
+// when the volume is consistent.
+int rfss_fsck(rfss_fs_t* fs, rfss_fsck_report_t* report) {
+    static rfss_fsck_report_t scratch;
+    if (!report) {
+        report = &scratch;
+    }
+    memset(report, 0, sizeof(rfss_fsck_report_t));
+
+    if (!fs || !fs->mounted || rfss_sync(fs) != 0) {
+        return -1;
+    }
+
+    rfss_fsck_t check;
+    memset(&check, 0, sizeof(check));
+    check.fs = fs;
+    check.report = report;
+
+    uint64_t start = rfss_rdtsc();
+    int usable = rfss_fsck_superblock(&check) == 0;
+    report->cycles[0] = rfss_rdtsc() - start;
+    if (!usable) {
+        return -1;
+    }
+
+    rfss_superblock_t* sb = fs->superblock;
+    uint32_t inodes = sb->inode_count + 1;
+    uint32_t claimed_bytes = ((sb->total_blocks + 31) / 32) * sizeof(uint32_t);
+    uint32_t needed = claimed_bytes + inodes * (sizeof(uint8_t) + sizeof(uint16_t) + 2 * sizeof(uint32_t)) + 16;
+    if (needed > fsck_arena_size) {
+        fsck_arena = kmalloc(needed);
+        fsck_arena_size = fsck_arena ? needed : 0;
+        if (!fsck_arena) {
+            return -1;
+        }
+    }
+    memset(fsck_arena, 0, needed);
+
+    check.claimed = (uint32_t*)fsck_arena;
+    check.parents = (uint32_t*)(fsck_arena + claimed_bytes);
+    check.dotdot = check.parents + inodes;
+    check.refs = (uint16_t*)(check.dotdot + inodes);
+    check.types = (uint8_t*)(check.refs + inodes);
+
+    void (*passes[])(rfss_fsck_t*) = { NULL, rfss_fsck_inodes, rfss_fsck_directories, rfss_fsck_bitmaps };
+    for (uint32_t pass = 1; pass < RFSS_FSCK_PASSES; pass++) {
+        check.pass = pass;
+        start = rfss_rdtsc();
+        passes[pass](&check);
+        report->cycles[pass] = rfss_rdtsc() - start;
+    }
+
+    for (uint32_t pass = 0; pass < RFSS_FSCK_PASSES; pass++) {
+        report->total_errors += report->errors[pass];
+    }
+    return report->total_errors == 0 ? 0 : -1;
+}
+
+int rfss_check_filesystem(rfss_fs_t* fs) {
+    return rfss_fsck(fs, NULL);
+}
@@ -0,0 +1,90 @@
+#include "rfss.h"
+#include "../kernel/logger.h"
+#include <string.h>
+
+// Inline data. A regular file small enough to fit in the space its block map and extent
+// list would take keeps its bytes there (RFSS_INODE_FLAG_INLINE) and has no data blocks
+// at all, so reading it costs nothing past the inode table. Bytes past the end of the
+// file are kept zero. A file that outgrows the inode spills into an ordinary extent
+// file and doesn't come back.
+
+// Whether the file can hold `end` bytes inline: it is inline already, or an empty extent
+// file. Emptied block-map files may still own pointer blocks and stay as they are.
+int rfss_inline_fits(rfss_inode_t* inode, uint64_t end) {
+    if (end > RFSS_INLINE_DATA_SIZE || ((inode->mode >> 12) & 0xF) != RFSS_FILE_REGULAR) {
+        return 0;
+    }
+    if (inode->flags & RFSS_INODE_FLAG_INLINE) {
+        return 1;
+    }
+    return (inode->flags & RFSS_INODE_FLAG_EXTENTS) && inode->blocks_count == 0 && inode->size == 0;
+}
+
+int rfss_inline_read(rfss_file_t* file, void* buffer, size_t size) {
+    memcpy(buffer, RFSS_INLINE_DATA(file->inode) + file->position, size);
+    file->position += size;
+    file->ra_pos = file->position;
+    return size;
+}
+
+// Caller has checked rfss_inline_fits for the end of the write
+int rfss_inline_write(rfss_file_t* file, const void* buffer, size_t size) {
+    rfss_inode_t* inode = file->inode;
+    if (!(inode->flags & RFSS_INODE_FLAG_INLINE)) {
+        memset(RFSS_INLINE_DATA(inode), 0, RFSS_INLINE_DATA_SIZE);
+        inode->flags = (inode->flags & ~RFSS_INODE_FLAG_EXTENTS) | RFSS_INODE_FLAG_INLINE;
+    }
+
+    memcpy(RFSS_INLINE_DATA(inode) + file->position, buffer, size);
+    file->position += size;
+    if (file->position > inode->size) {
+        inode->size = file->position;
+    }
+
+    rfss_write_inode(file->fs, file->inode_num, inode);
+    return size;
+}
+
+int rfss_inline_truncate(rfss_file_t* file, uint64_t size) {
+    rfss_inode_t* inode = file->inode;
+    memset(RFSS_INLINE_DATA(inode) + size, 0, RFSS_INLINE_DATA_SIZE - size);
+    inode->size = size;
+    if (file->position > size) {
+        file->position = size;
+    }
+
+    rfss_write_inode(file->fs, file->inode_num, inode);
+    return 0;
+}
+
+// Turns an inline file into an extent file with the same contents. The data becomes
+// file block 0, buffered for delayed allocation when there is room, so a file growing
+// past the inode still ends up in one run.
+int rfss_inline_spill(rfss_fs_t* fs, rfss_inode_t* inode, uint32_t inode_num) {
+    static uint8_t block_buffer[RFSS_BLOCK_SIZE];
+
+    memset(block_buffer, 0, RFSS_BLOCK_SIZE);
+    memcpy(block_buffer, RFSS_INLINE_DATA(inode), inode->size);
+    memset(RFSS_INLINE_DATA(inode), 0, RFSS_INLINE_DATA_SIZE);
+    inode->flags = (inode->flags & ~RFSS_INODE_FLAG_INLINE) | RFSS_INODE_FLAG_EXTENTS;
+
+    if (inode->size > 0) {
+        uint8_t* pending = rfss_delalloc_block(fs, inode, inode_num, 0);
+        if (pending) {
+            memcpy(pending, block_buffer, RFSS_BLOCK_SIZE);
+        } else {
+            uint32_t run = 0;
+            uint32_t block = rfss_extend_file(fs, inode, 1, NULL) == 1 ? rfss_map_block(fs, inode, 0, &run, NULL) : 0;
+            if (block == 0 || rfss_write_block(fs, block, block_buffer) != 0) {
+                log(LOG_ERROR, "Inode %d: no room to move inline data out", inode_num);
+                rfss_free_file_blocks(fs, inode);
+                memcpy(RFSS_INLINE_DATA(inode), block_buffer, RFSS_INLINE_DATA_SIZE);
+                inode->flags = (inode->flags & ~RFSS_INODE_FLAG_EXTENTS) | RFSS_INODE_FLAG_INLINE;
+                return -1;
+            }
+        }
+    }
+
+    rfss_write_inode(fs, inode_num, inode);
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include "rfss.h"
+#include "../mm/memory.h"
+#include "../kernel/logger.h"
+#include <string.h>
+
+// Inode cache. rfss_mount loads the whole inode table block by block, so an inode is a
+// lookup into fs->inode_table and pointers to different inodes never alias. Updates only
+// mark their table block dirty; rfss_sync_inodes pushes dirty blocks out. Open files
+// hold a reference, and an inode deleted while referenced is freed by the last rfss_iput.
+
+int rfss_icache_init(rfss_fs_t* fs) {
+    uint32_t inode_blocks = (fs->superblock->inode_count + RFSS_INODES_PER_BLOCK - 1) / RFSS_INODES_PER_BLOCK;
+
+    fs->inode_refs = kmalloc(fs->superblock->inode_count * sizeof(rfss_inode_ref_t));
+    fs->inode_dirty = kmalloc(inode_blocks);
+    if (!fs->inode_refs || !fs->inode_dirty) {
+        kfree(fs->inode_refs);
+        kfree(fs->inode_dirty);
+        fs->inode_refs = NULL;
+        fs->inode_dirty = NULL;
+        return -1;
+    }
+
+    memset(fs->inode_refs, 0, fs->superblock->inode_count * sizeof(rfss_inode_ref_t));
+    memset(fs->inode_dirty, 0, inode_blocks);
+    return 0;
+}
+
+rfss_inode_t* rfss_get_inode(rfss_fs_t* fs, uint32_t inode_num) {
+    if (!fs || !fs->inode_table || inode_num == 0 || inode_num > fs->superblock->inode_count) {
+        //log(LOG_ERROR, "Invalid inode number: %d", inode_num);
+        return NULL;
+    }
+
+    uint32_t block = (inode_num - 1) / RFSS_INODES_PER_BLOCK;
+    uint32_t index = (inode_num - 1) % RFSS_INODES_PER_BLOCK;
+    return (rfss_inode_t*)((uint8_t*)fs->inode_table + block * RFSS_BLOCK_SIZE) + index;
+}
+
+void rfss_mark_inode_dirty(rfss_fs_t* fs, uint32_t inode_num) {
+    fs->inode_dirty[(inode_num - 1) / RFSS_INODES_PER_BLOCK] = 1;
+    fs->dirty = 1;
+}
+
+int rfss_write_inode(rfss_fs_t* fs, uint32_t inode_num, rfss_inode_t* inode) {
+    rfss_inode_t* cached = rfss_get_inode(fs, inode_num);
+    if (!cached || !inode) {
+        //log(LOG_ERROR, "Invalid parameters for write inode");
+        return -1;
+    }
+
+    if (cached != inode) {
+        memcpy(cached, inode, sizeof(rfss_inode_t));
+    }
+
+    if (fs->journaling_enabled) {
+        return rfss_safe_write_inode(fs, inode_num, cached);
+    }
+
+    rfss_mark_inode_dirty(fs, inode_num);
+    return 0;
+}
+
+rfss_inode_t* rfss_iget(rfss_fs_t* fs, uint32_t inode_num) {
+    rfss_inode_t* inode = rfss_get_inode(fs, inode_num);
+    if (inode) {
+        fs->inode_refs[inode_num - 1].count++;
+    }
+    return inode;
+}
+
+void rfss_iput(rfss_fs_t* fs, uint32_t inode_num) {
+    if (!rfss_get_inode(fs, inode_num)) {
+        return;
+    }
+
+    rfss_inode_ref_t* ref = &fs->inode_refs[inode_num - 1];
+    if (ref->count > 0 && --ref->count == 0 && ref->orphan) {
+        ref->orphan = 0;
+        rfss_release_inode(fs, inode_num);
+    }
+}
+
+// Frees the inode and its blocks, or defers that to the last rfss_iput while it is open
+void rfss_release_inode(rfss_fs_t* fs, uint32_t inode_num) {
+    rfss_inode_t* inode = rfss_get_inode(fs, inode_num);
+    if (!inode) {
+        return;
+    }
+
+    if (fs->inode_refs[inode_num - 1].count > 0) {
+        fs->inode_refs[inode_num - 1].orphan = 1;
+        return;
+    }
+
+    // A big file goes back a transaction at a time before the inode itself
+    if (rfss_shrink_inode(fs, inode_num, inode, 0, NULL) != 0 ||
+        rfss_journal_start_transaction(fs, RFSS_JOURNAL_OP_BLOCKS) != 0) {
+        log(LOG_ERROR, "Failed to free inode %d", inode_num);
+        return;
+    }
+
+    rfss_free_file_blocks(fs, inode);
+    memset(inode, 0, sizeof(rfss_inode_t));
+    rfss_write_inode(fs, inode_num, inode);
+    rfss_free_inode(fs, inode_num);
+    rfss_journal_commit_transaction(fs);
+}
+
+// Inode table blocks keep a CRC32C in their last four bytes, which no inode reaches
+void rfss_inode_block_seal(uint8_t* block) {
+    *(uint32_t*)(block + RFSS_BLOCK_SIZE - sizeof(uint32_t)) = rfss_crc32c(0, block, RFSS_BLOCK_SIZE - sizeof(uint32_t));
+}
+
+int rfss_inode_block_verify(const uint8_t* block) {
+    uint32_t stored = *(const uint32_t*)(block + RFSS_BLOCK_SIZE - sizeof(uint32_t));
+    return stored == rfss_crc32c(0, block, RFSS_BLOCK_SIZE - sizeof(uint32_t)) ? 0 : -1;
+}
+
+int rfss_sync_inodes(rfss_fs_t* fs) {
+    uint32_t inode_blocks = (fs->superblock->inode_count + RFSS_INODES_PER_BLOCK - 1) / RFSS_INODES_PER_BLOCK;
+    int result = 0;
+
+    for (uint32_t i = 0; i < inode_blocks; i++) {
+        if (!fs->inode_dirty[i]) {
+            continue;
+        }
+
+        uint8_t* block = (uint8_t*)fs->inode_table + i * RFSS_BLOCK_SIZE;
+        if (fs->superblock->features & RFSS_FEATURE_METADATA_CSUM) {
+            rfss_inode_block_seal(block);
+        }
+
+        if (rfss_write_block(fs, fs->superblock->inode_table_block + i, block) != 0) {
+            log(LOG_ERROR, "Failed to write back inode table block %d", i);
+            result = -1;
+            continue;
+        }
+        fs->inode_dirty[i] = 0;
+    }
+
+    return result;
+}
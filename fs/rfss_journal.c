@@ -1,295 +1,509 @@
 #include "rfss.h"
 #include "../drivers/ata.h"
-#include "../mm/memory.h"
 #include "../kernel/logger.h"
 #include <string.h>
 
-static uint32_t current_transaction_id = 1;
+// Redo write-ahead log. The first journal block holds the journal superblock; the rest is
+// a circular log of transactions, each a descriptor listing the home blocks, the new
+// contents of those blocks and a commit record with a CRC32C over all of it.
+//
+// Block writes made while journaling join the running transaction in log_buffer and are
+// served from there to readers. Every operation that changes the filesystem runs between
+// rfss_journal_start_transaction and rfss_journal_commit_transaction, reserving the log
+// space it may use up front, and the running transaction is only written out when no
+// operation is open. Several operations are grouped and written with one sequential
+// request, together with the allocation bitmaps, their summary and the superblock, so a
+// commit always describes a whole filesystem. Only then are the blocks handed to the
+// block cache for their home locations. Log space is reclaimed by flushing the cache and
+// moving the journal start forward.
 
-typedef struct {
-    uint32_t transaction_id;
-    uint32_t block_count;
-    uint32_t blocks[64];
-    uint8_t* backup_data[64];
-} rfss_transaction_t;
+#define RFSS_JOURNAL_MAGIC 0x4C4E524A
+#define RFSS_JOURNAL_SUPER 1
+#define RFSS_JOURNAL_DESCRIPTOR 2
+#define RFSS_JOURNAL_COMMIT 3
+// Descriptor, one block and commit record
+#define RFSS_JOURNAL_MIN_RECORDS 3
 
-static rfss_transaction_t* current_transaction = NULL;
+// Descriptor, up to RFSS_JOURNAL_MAX_BLOCKS data blocks, commit record. The volume that
+// last used it is log_owner; only that volume can have a running transaction.
+static uint8_t log_buffer[(RFSS_JOURNAL_MAX_BLOCKS + 2) * RFSS_BLOCK_SIZE];
+static rfss_journal_header_t* descriptor = (rfss_journal_header_t*)log_buffer;
+static rfss_fs_t* log_owner = NULL;
+// Set while rfss_journal_flush logs the allocation state into the space kept for it
+static int logging_allocation = 0;
 
-int rfss_journal_init(rfss_fs_t* fs) {
-    if (!fs || !fs->mounted) {
+static uint32_t rfss_journal_log_size(rfss_fs_t* fs) {
+    return fs->superblock->journal_size - 1;
+}
+
+// Log blocks every transaction leaves free for what rfss_journal_flush adds: the resident
+// bitmap blocks, the summary blocks and the superblock
+static uint32_t rfss_journal_reserve(rfss_fs_t* fs) {
+    uint32_t reserve = 2 * RFSS_BITMAP_SLOTS + 1;
+    if (fs->block_alloc.summary_block) {
+        reserve += (fs->block_alloc.blocks + RFSS_SUMMARY_ENTRIES - 1) / RFSS_SUMMARY_ENTRIES;
+    }
+    if (fs->inode_alloc.summary_block) {
+        reserve += (fs->inode_alloc.blocks + RFSS_SUMMARY_ENTRIES - 1) / RFSS_SUMMARY_ENTRIES;
+    }
+    return reserve;
+}
+
+// Hands log_buffer to `fs`, committing whatever another volume left running in it
+static int rfss_journal_claim(rfss_fs_t* fs) {
+    if (log_owner && log_owner != fs && log_owner->journal.count > 0 && rfss_journal_flush(log_owner) != 0) {
         return -1;
     }
-    
-    uint8_t journal_buffer[RFSS_BLOCK_SIZE];
-    memset(journal_buffer, 0, RFSS_BLOCK_SIZE);
-    
-    for (uint32_t i = 0; i < fs->superblock->journal_size; i++) {
-        if (rfss_write_block(fs, fs->superblock->journal_block + i, journal_buffer) != 0) {
+
+    log_owner = fs;
+    return 0;
+}
+
+// Reads or writes `count` log blocks starting at `pos`, splitting where the log wraps
+static int rfss_journal_io(rfss_fs_t* fs, uint32_t pos, uint32_t count, uint8_t* buffer, int write) {
+    uint32_t log_size = rfss_journal_log_size(fs);
+    uint32_t log_first = fs->superblock->journal_block + 1;
+
+    while (count > 0) {
+        uint32_t run = log_size - pos;
+        if (run > count) {
+            run = count;
+        }
+
+        int result = write ? rfss_device_write(fs->device_id, log_first + pos, run, buffer)
+                           : rfss_device_read(fs->device_id, log_first + pos, run, buffer);
+        if (result != 0) {
             return -1;
         }
+
+        buffer += run * RFSS_BLOCK_SIZE;
+        count -= run;
+        pos = (pos + run) % log_size;
     }
-    
-    log(LOG_OK, "Journal initialized");
+
     return 0;
 }
 
-int rfss_journal_start_transaction(rfss_fs_t* fs) {
-    if (!fs || current_transaction) {
+static int rfss_journal_write_super(rfss_fs_t* fs) {
+    static uint8_t super_buffer[RFSS_BLOCK_SIZE];
+    memset(super_buffer, 0, RFSS_BLOCK_SIZE);
+
+    rfss_journal_super_t* super = (rfss_journal_super_t*)super_buffer;
+    super->magic = RFSS_JOURNAL_MAGIC;
+    super->type = RFSS_JOURNAL_SUPER;
+    super->sequence = fs->journal.sequence;
+    super->start = fs->journal.start;
+    super->checksum = rfss_crc32c(0, super, sizeof(rfss_journal_super_t) - sizeof(uint32_t));
+
+    if (rfss_device_write(fs->device_id, fs->superblock->journal_block, 1, super_buffer) != 0) {
+        return -1;
+    }
+
+    return ata_flush_cache(fs->device_id);
+}
+
+// Makes every committed block durable at home so the whole log can be reused
+static int rfss_journal_checkpoint(rfss_fs_t* fs) {
+    if (rfss_cache_sync(fs) != 0) {
         return -1;
     }
-    
-    current_transaction = kmalloc(sizeof(rfss_transaction_t));
-    if (!current_transaction) {
+
+    fs->journal.start = fs->journal.head;
+    return rfss_journal_write_super(fs);
+}
+
+int rfss_journal_init(rfss_fs_t* fs) {
+    if (!fs || !fs->mounted || fs->superblock->journal_size < RFSS_JOURNAL_MAX_BLOCKS + 3) {
         return -1;
     }
-    
-    current_transaction->transaction_id = current_transaction_id++;
-    current_transaction->block_count = 0;
-    
-    for (int i = 0; i < 64; i++) {
-        current_transaction->backup_data[i] = NULL;
+
+    if (!fs->journal.ready && rfss_journal_replay(fs) < 0) {
+        return -1;
     }
-    
+
+    fs->journal.count = 0;
+    fs->journal.handles = 0;
+
+    log(LOG_OK, "Journal initialized");
     return 0;
 }
 
-int rfss_journal_log_block(rfss_fs_t* fs, uint32_t block_num, const void* old_data) {
-    if (!fs || !current_transaction || current_transaction->block_count >= 64) {
+// Opens an operation that will log at most `blocks` blocks. The running transaction is
+// written out first if it can't take that many more. An operation started inside another
+// joins it; the outer reservation has to cover it. Does nothing when not journaling.
+int rfss_journal_start_transaction(rfss_fs_t* fs, uint32_t blocks) {
+    if (!fs) {
+        return -1;
+    }
+    if (!fs->journaling_enabled) {
+        return 0;
+    }
+
+    if (fs->journal.handles > 0) {
+        fs->journal.handles++;
+        return 0;
+    }
+
+    uint32_t room = RFSS_JOURNAL_MAX_BLOCKS - rfss_journal_reserve(fs);
+    if (blocks > room || rfss_journal_claim(fs) != 0) {
         return -1;
     }
-    
-    uint32_t index = current_transaction->block_count;
-    current_transaction->blocks[index] = block_num;
-    current_transaction->backup_data[index] = kmalloc(RFSS_BLOCK_SIZE);
-    
-    if (!current_transaction->backup_data[index]) {
+    if (fs->journal.count + blocks > room && rfss_journal_flush(fs) != 0) {
         return -1;
     }
-    
-    memcpy(current_transaction->backup_data[index], old_data, RFSS_BLOCK_SIZE);
-    current_transaction->block_count++;
-    
+
+    fs->journal.handles = 1;
     return 0;
 }
 
-int rfss_journal_commit_transaction(rfss_fs_t* fs) {
-    if (!fs || !current_transaction) {
+// Adds the new contents of a block to the running transaction
+int rfss_journal_log_block(rfss_fs_t* fs, uint32_t block_num, const void* data) {
+    if (!fs || !data || !fs->journal.ready || rfss_journal_claim(fs) != 0) {
         return -1;
     }
-    
-    rfss_journal_header_t header;
-    header.transaction_id = current_transaction->transaction_id;
-    header.block_count = current_transaction->block_count;
-    header.timestamp = 0;
-    header.checksum = rfss_calculate_checksum(&header, sizeof(rfss_journal_header_t) - sizeof(uint32_t));
-    
-    uint8_t journal_buffer[RFSS_BLOCK_SIZE];
-    memset(journal_buffer, 0, RFSS_BLOCK_SIZE);
-    memcpy(journal_buffer, &header, sizeof(rfss_journal_header_t));
-    
-    uint32_t journal_offset = sizeof(rfss_journal_header_t);
-    for (uint32_t i = 0; i < current_transaction->block_count; i++) {
-        rfss_journal_block_t journal_block;
-        journal_block.block_num = current_transaction->blocks[i];
-        journal_block.old_checksum = rfss_calculate_checksum(current_transaction->backup_data[i], RFSS_BLOCK_SIZE);
-        
-        uint8_t new_data[RFSS_BLOCK_SIZE];
-        if (rfss_read_block(fs, current_transaction->blocks[i], new_data) == 0) {
-            journal_block.new_checksum = rfss_calculate_checksum(new_data, RFSS_BLOCK_SIZE);
-        } else {
-            journal_block.new_checksum = 0;
-        }
-        
-        memcpy(journal_block.data, current_transaction->backup_data[i], RFSS_BLOCK_SIZE);
-        
-        if (journal_offset + sizeof(rfss_journal_block_t) > RFSS_BLOCK_SIZE) {
-            if (rfss_write_block(fs, fs->superblock->journal_block, journal_buffer) != 0) {
-                return -1;
-            }
-            memset(journal_buffer, 0, RFSS_BLOCK_SIZE);
-            journal_offset = 0;
+
+    for (uint32_t i = 0; i < fs->journal.count; i++) {
+        if (descriptor->blocks[i] == block_num) {
+            memcpy(log_buffer + (i + 1) * RFSS_BLOCK_SIZE, data, RFSS_BLOCK_SIZE);
+            return 0;
         }
-        
-        memcpy(journal_buffer + journal_offset, &journal_block, sizeof(rfss_journal_block_t));
-        journal_offset += sizeof(rfss_journal_block_t);
     }
-    
-    if (journal_offset > 0) {
-        if (rfss_write_block(fs, fs->superblock->journal_block, journal_buffer) != 0) {
+
+    // Blocks logged outside any operation may start a new transaction; an operation that
+    // runs out of room has logged more than it reserved, and fails rather than split
+    uint32_t limit = RFSS_JOURNAL_MAX_BLOCKS - (logging_allocation ? 0 : rfss_journal_reserve(fs));
+    if (fs->journal.count >= limit) {
+        if (fs->journal.handles > 0 || logging_allocation) {
+            log(LOG_ERROR, "Journal transaction full, block %d not logged", block_num);
             return -1;
         }
-    }
-    
-    for (uint32_t i = 0; i < current_transaction->block_count; i++) {
-        if (current_transaction->backup_data[i]) {
-            kfree(current_transaction->backup_data[i]);
+        if (rfss_journal_flush(fs) != 0) {
+            return -1;
         }
     }
-    
-    kfree(current_transaction);
-    current_transaction = NULL;
-    
+
+    if (fs->journal.count == 0) {
+        memset(descriptor, 0, RFSS_BLOCK_SIZE);
+    }
+
+    descriptor->blocks[fs->journal.count] = block_num;
+    memcpy(log_buffer + (fs->journal.count + 1) * RFSS_BLOCK_SIZE, data, RFSS_BLOCK_SIZE);
+    fs->journal.count++;
     return 0;
 }
 
-int rfss_journal_abort_transaction(rfss_fs_t* fs) {
-    if (!fs || !current_transaction) {
+// Returns 0 and fills `buffer` when the running transaction holds a newer copy of the block
+int rfss_journal_read_block(rfss_fs_t* fs, uint32_t block_num, void* buffer) {
+    if (!fs || !fs->journal.ready || log_owner != fs) {
         return -1;
     }
-    
-    for (uint32_t i = 0; i < current_transaction->block_count; i++) {
-        if (current_transaction->backup_data[i]) {
-            rfss_write_block(fs, current_transaction->blocks[i], current_transaction->backup_data[i]);
-            kfree(current_transaction->backup_data[i]);
+
+    for (uint32_t i = 0; i < fs->journal.count; i++) {
+        if (descriptor->blocks[i] == block_num) {
+            memcpy(buffer, log_buffer + (i + 1) * RFSS_BLOCK_SIZE, RFSS_BLOCK_SIZE);
+            return 0;
         }
     }
-    
-    kfree(current_transaction);
-    current_transaction = NULL;
-    
-    return 0;
+
+    return -1;
 }
 
-int rfss_journal_replay(rfss_fs_t* fs) {
-    if (!fs || !fs->mounted) {
+// Ends a start/commit pair. The work stays in the running transaction so that several
+// pairs share one log write, unless enough has piled up to be worth writing now.
+int rfss_journal_commit_transaction(rfss_fs_t* fs) {
+    if (!fs) {
         return -1;
     }
-    
-    uint8_t journal_buffer[RFSS_BLOCK_SIZE];
-    if (rfss_read_block(fs, fs->superblock->journal_block, journal_buffer) != 0) {
+    if (!fs->journaling_enabled) {
+        return 0;
+    }
+
+    if (fs->journal.handles > 0) {
+        fs->journal.handles--;
+    }
+
+    if (fs->journal.handles == 0 && fs->journal.count >= RFSS_JOURNAL_GROUP_BLOCKS) {
+        return rfss_journal_flush(fs);
+    }
+
+    return 0;
+}
+
+// Nothing reaches the disk before commit, so aborting just drops everything logged since
+// the last flush, including work of other pairs grouped with it
+int rfss_journal_abort_transaction(rfss_fs_t* fs) {
+    if (!fs || !fs->journal.ready) {
         return -1;
     }
-    
-    rfss_journal_header_t* header = (rfss_journal_header_t*)journal_buffer;
-    if (header->transaction_id == 0) {
+
+    if (fs->journal.handles > 0) {
+        fs->journal.handles--;
+    }
+
+    fs->journal.count = 0;
+    return 0;
+}
+
+// Writes the running transaction to the log with one request, waits for it to be stable,
+// then passes the blocks on to the cache for write-back to their home locations
+int rfss_journal_flush(rfss_fs_t* fs) {
+    if (!fs || !fs->journal.ready || fs->journal.count == 0) {
         return 0;
     }
-    
-    uint32_t calculated_checksum = rfss_calculate_checksum(header, sizeof(rfss_journal_header_t) - sizeof(uint32_t));
-    if (calculated_checksum != header->checksum) {
-        log(LOG_ERROR, "Journal header checksum mismatch");
+    if (fs->journal.handles > 0) {
+        log(LOG_ERROR, "Journal flush with an operation still open");
         return -1;
     }
-    
-    log(LOG_LOG, "Replaying journal transaction %d with %d blocks", header->transaction_id, header->block_count);
-    
-    uint32_t journal_offset = sizeof(rfss_journal_header_t);
-    for (uint32_t i = 0; i < header->block_count; i++) {
-        if (journal_offset + sizeof(rfss_journal_block_t) > RFSS_BLOCK_SIZE) {
-            if (rfss_read_block(fs, fs->superblock->journal_block + 1, journal_buffer) != 0) {
-                return -1;
-            }
-            journal_offset = 0;
+
+    // The blocks logged so far point at blocks these say are in use, so they commit together
+    if (fs->journaling_enabled) {
+        logging_allocation = 1;
+        int result = 0;
+        if (rfss_bitmap_sync(fs, &fs->block_alloc) != 0 || rfss_bitmap_sync(fs, &fs->inode_alloc) != 0) {
+            result = -1;
+        }
+        rfss_superblock_seal(fs->superblock);
+        if (rfss_journal_log_block(fs, 0, fs->superblock) != 0) {
+            result = -1;
+        }
+        logging_allocation = 0;
+        if (result != 0) {
+            return -1;
         }
-        
-        rfss_journal_block_t* journal_block = (rfss_journal_block_t*)(journal_buffer + journal_offset);
-        
-        uint8_t current_data[RFSS_BLOCK_SIZE];
-        if (rfss_read_block(fs, journal_block->block_num, current_data) == 0) {
-            uint32_t current_checksum = rfss_calculate_checksum(current_data, RFSS_BLOCK_SIZE);
-            
-            if (current_checksum == journal_block->new_checksum) {
-                log(LOG_LOG, "Block %d already updated, skipping", journal_block->block_num);
-            } else if (current_checksum == journal_block->old_checksum) {
-                log(LOG_LOG, "Restoring block %d from journal", journal_block->block_num);
-                rfss_write_block(fs, journal_block->block_num, journal_block->data);
-            } else {
-                log(LOG_WARNING, "Block %d checksum mismatch, potential corruption", journal_block->block_num);
+    }
+
+    uint32_t log_size = rfss_journal_log_size(fs);
+    uint32_t records = fs->journal.count + 2;
+    uint32_t used = (fs->journal.head + log_size - fs->journal.start) % log_size;
+    if (used + records >= log_size && rfss_journal_checkpoint(fs) != 0) {
+        return -1;
+    }
+
+    descriptor->magic = RFSS_JOURNAL_MAGIC;
+    descriptor->type = RFSS_JOURNAL_DESCRIPTOR;
+    descriptor->sequence = fs->journal.sequence;
+    descriptor->count = fs->journal.count;
+    descriptor->checksum = 0;
+
+    rfss_journal_header_t* commit = (rfss_journal_header_t*)(log_buffer + (fs->journal.count + 1) * RFSS_BLOCK_SIZE);
+    memset(commit, 0, RFSS_BLOCK_SIZE);
+    commit->magic = RFSS_JOURNAL_MAGIC;
+    commit->type = RFSS_JOURNAL_COMMIT;
+    commit->sequence = fs->journal.sequence;
+    commit->count = fs->journal.count;
+    commit->checksum = rfss_crc32c(0, log_buffer, (fs->journal.count + 1) * RFSS_BLOCK_SIZE);
+
+    if (rfss_journal_io(fs, fs->journal.head, records, log_buffer, 1) != 0 ||
+        ata_flush_cache(fs->device_id) != 0) {
+        log(LOG_ERROR, "Journal commit %d failed", fs->journal.sequence);
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < fs->journal.count; i++) {
+        if (rfss_cache_write(fs, descriptor->blocks[i], log_buffer + (i + 1) * RFSS_BLOCK_SIZE) != 0) {
+            log(LOG_ERROR, "Failed to checkpoint block %d", descriptor->blocks[i]);
+        }
+    }
+
+    fs->journal.head = (fs->journal.head + records) % log_size;
+    fs->journal.sequence++;
+    fs->journal.count = 0;
+    return 0;
+}
+
+// Walks the committed transactions from the journal start. Each is checked against its
+// commit record and, when `apply` is set, written home. The walk stops at the first
+// record that is missing, torn or out of sequence, so it never covers more than one lap
+// of the log. Returns the number of transactions found, or -1 on a device error.
+static int rfss_journal_scan(rfss_fs_t* fs, uint32_t* end, uint32_t* sequence, int apply) {
+    uint32_t log_size = rfss_journal_log_size(fs);
+    uint32_t pos = *end;
+    uint32_t scanned = 0;
+    int found = 0;
+
+    while (scanned + RFSS_JOURNAL_MIN_RECORDS <= log_size) {
+        if (rfss_journal_io(fs, pos, 1, log_buffer, 0) != 0) {
+            return -1;
+        }
+
+        uint32_t count = descriptor->count;
+        if (descriptor->magic != RFSS_JOURNAL_MAGIC || descriptor->type != RFSS_JOURNAL_DESCRIPTOR ||
+            descriptor->sequence != *sequence || count == 0 || count > RFSS_JOURNAL_MAX_BLOCKS ||
+            scanned + count + 2 > log_size) {
+            break;
+        }
+
+        if (rfss_journal_io(fs, (pos + 1) % log_size, count + 1, log_buffer + RFSS_BLOCK_SIZE, 0) != 0) {
+            return -1;
+        }
+
+        rfss_journal_header_t* commit = (rfss_journal_header_t*)(log_buffer + (count + 1) * RFSS_BLOCK_SIZE);
+        if (commit->magic != RFSS_JOURNAL_MAGIC || commit->type != RFSS_JOURNAL_COMMIT ||
+            commit->sequence != *sequence || commit->count != count ||
+            commit->checksum != rfss_crc32c(0, log_buffer, (count + 1) * RFSS_BLOCK_SIZE)) {
+            break;
+        }
+
+        if (apply) {
+            for (uint32_t i = 0; i < count; i++) {
+                if (rfss_cache_write_blocks(fs, descriptor->blocks[i], 1, log_buffer + (i + 1) * RFSS_BLOCK_SIZE) != 0) {
+                    return -1;
+                }
             }
         }
-        
-        journal_offset += sizeof(rfss_journal_block_t);
-    }
-    
-    memset(journal_buffer, 0, RFSS_BLOCK_SIZE);
-    rfss_write_block(fs, fs->superblock->journal_block, journal_buffer);
-    
-    log(LOG_OK, "Journal replay completed");
+
+        pos = (pos + count + 2) % log_size;
+        scanned += count + 2;
+        (*sequence)++;
+        found++;
+    }
+
+    *end = pos;
+    return found;
+}
+
+static int rfss_journal_read_super(rfss_fs_t* fs, rfss_journal_super_t* super) {
+    if (rfss_journal_claim(fs) != 0 || rfss_device_read(fs->device_id, fs->superblock->journal_block, 1, log_buffer) != 0) {
+        return -1;
+    }
+
+    memcpy(super, log_buffer, sizeof(rfss_journal_super_t));
+    if (super->magic != RFSS_JOURNAL_MAGIC || super->type != RFSS_JOURNAL_SUPER ||
+        super->checksum != rfss_crc32c(0, super, sizeof(rfss_journal_super_t) - sizeof(uint32_t)) ||
+        super->start >= rfss_journal_log_size(fs)) {
+        return 1;
+    }
+
     return 0;
 }
 
-int rfss_journal_clear(rfss_fs_t* fs) {
-    if (!fs || !fs->mounted) {
+// Runs at mount before anything else is read. Returns how many transactions were redone.
+int rfss_journal_replay(rfss_fs_t* fs) {
+    if (!fs || !fs->superblock || fs->superblock->journal_size < RFSS_JOURNAL_MAX_BLOCKS + 3) {
+        return -1;
+    }
+
+    fs->journal.count = 0;
+    fs->journal.handles = 0;
+    fs->journal.ready = 0;
+
+    rfss_journal_super_t super;
+    int status = rfss_journal_read_super(fs, &super);
+    if (status < 0) {
         return -1;
     }
-    
-    uint8_t journal_buffer[RFSS_BLOCK_SIZE];
-    memset(journal_buffer, 0, RFSS_BLOCK_SIZE);
-    
-    for (uint32_t i = 0; i < fs->superblock->journal_size; i++) {
-        if (rfss_write_block(fs, fs->superblock->journal_block + i, journal_buffer) != 0) {
+
+    uint32_t end = 0;
+    uint32_t sequence = 1;
+    int replayed = 0;
+
+    if (status == 0) {
+        end = super.start;
+        sequence = super.sequence;
+        replayed = rfss_journal_scan(fs, &end, &sequence, 1);
+        if (replayed < 0) {
+            log(LOG_ERROR, "Journal replay failed");
             return -1;
         }
+    } else if (super.magic != 0) {
+        log(LOG_WARNING, "Journal superblock invalid, starting an empty journal");
+    }
+
+    // The replayed blocks have to be stable at home before the new start stops the log
+    // from covering them
+    if (replayed > 0) {
+        if (ata_flush_cache(fs->device_id) != 0) {
+            log(LOG_ERROR, "Journal replay failed");
+            return -1;
+        }
+        log(LOG_LOG, "Replayed %d journal transactions", replayed);
+    }
+
+    fs->journal.head = end;
+    fs->journal.start = end;
+    fs->journal.sequence = sequence;
+    fs->journal.ready = 1;
+
+    if (rfss_journal_write_super(fs) != 0) {
+        fs->journal.ready = 0;
+        return -1;
+    }
+
+    return replayed;
+}
+
+// Commits the running transaction and checkpoints, leaving nothing for replay
+int rfss_journal_clear(rfss_fs_t* fs) {
+    if (!fs || !fs->journal.ready) {
+        return -1;
+    }
+
+    if (rfss_journal_flush(fs) != 0 || rfss_journal_checkpoint(fs) != 0) {
+        return -1;
+    }
+
+    if (log_owner == fs) {
+        log_owner = NULL;
     }
-    
     return 0;
 }
 
+// Returns the number of committed transactions still waiting for checkpoint, or -1 when
+// the journal superblock is damaged
 int rfss_journal_check_consistency(rfss_fs_t* fs) {
-    if (!fs || !fs->mounted) {
+    if (!fs || !fs->mounted || fs->superblock->journal_size < RFSS_JOURNAL_MAX_BLOCKS + 3) {
         return -1;
     }
-    
-    uint8_t journal_buffer[RFSS_BLOCK_SIZE];
-    if (rfss_read_block(fs, fs->superblock->journal_block, journal_buffer) != 0) {
+
+    // The scan reuses log_buffer, so the running transaction goes out first
+    if (fs->journal.ready && rfss_journal_flush(fs) != 0) {
         return -1;
     }
-    
-    rfss_journal_header_t* header = (rfss_journal_header_t*)journal_buffer;
-    if (header->transaction_id == 0) {
-        return 0;
-    }
-    
-    uint32_t calculated_checksum = rfss_calculate_checksum(header, sizeof(rfss_journal_header_t) - sizeof(uint32_t));
-    if (calculated_checksum != header->checksum) {
+
+    rfss_journal_super_t super;
+    if (rfss_journal_read_super(fs, &super) != 0) {
         log(LOG_ERROR, "Journal inconsistency detected");
         return -1;
     }
-    
-    return 0;
+
+    uint32_t end = super.start;
+    uint32_t sequence = super.sequence;
+    return rfss_journal_scan(fs, &end, &sequence, 0);
 }
 
 int rfss_safe_write_block(rfss_fs_t* fs, uint32_t block_num, const void* data) {
     if (!fs || !data) {
         return -1;
     }
-    
-    uint8_t old_data[RFSS_BLOCK_SIZE];
-    if (rfss_read_block(fs, block_num, old_data) != 0) {
-        memset(old_data, 0, RFSS_BLOCK_SIZE);
-    }
-    
-    if (current_transaction) {
-        if (rfss_journal_log_block(fs, block_num, old_data) != 0) {
-            return -1;
-        }
+
+    if (fs->superblock && block_num >= fs->superblock->total_blocks && block_num != 0) {
+        return -1;
     }
-    
-    return rfss_write_block(fs, block_num, data);
+
+    return rfss_journal_log_block(fs, block_num, data);
 }
 
+// Logs the inode table block holding the inode, taken from the in-memory table
 int rfss_safe_write_inode(rfss_fs_t* fs, uint32_t inode_num, rfss_inode_t* inode) {
-    if (!fs || !inode || inode_num == 0 || inode_num > fs->superblock->inode_count) {
+    rfss_inode_t* cached = rfss_get_inode(fs, inode_num);
+    if (!cached || !inode) {
         return -1;
     }
-    
-    uint32_t inodes_per_block = RFSS_BLOCK_SIZE / sizeof(rfss_inode_t);
-    uint32_t block = (inode_num - 1) / inodes_per_block;
-    uint32_t index = (inode_num - 1) % inodes_per_block;
-    
-    uint8_t old_block_data[RFSS_BLOCK_SIZE];
-    if (rfss_read_block(fs, fs->superblock->inode_table_block + block, old_block_data) != 0) {
-        return -1;
+
+    if (cached != inode) {
+        memcpy(cached, inode, sizeof(rfss_inode_t));
     }
-    
-    if (current_transaction) {
-        if (rfss_journal_log_block(fs, fs->superblock->inode_table_block + block, old_block_data) != 0) {
-            return -1;
-        }
+
+    uint32_t block = (inode_num - 1) / (RFSS_BLOCK_SIZE / sizeof(rfss_inode_t));
+    uint8_t* table_block = (uint8_t*)fs->inode_table + block * RFSS_BLOCK_SIZE;
+    if (fs->superblock->features & RFSS_FEATURE_METADATA_CSUM) {
+        rfss_inode_block_seal(table_block);
+    }
+
+    if (rfss_safe_write_block(fs, fs->superblock->inode_table_block + block, rfss_delalloc_inode_block(fs, block, table_block)) != 0) {
+        return -1;
     }
-    
-    rfss_inode_t* inodes = (rfss_inode_t*)old_block_data;
-    memcpy(&inodes[index], inode, sizeof(rfss_inode_t));
-    
-    return rfss_write_block(fs, fs->superblock->inode_table_block + block, old_block_data);
-}
\ No newline at end of file
+
+    fs->inode_dirty[block] = 0;
+    return 0;
+}
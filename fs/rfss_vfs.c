@@ -0,0 +1,140 @@
+#include "vfs.h"
+#include "../drivers/ata.h"
+#include "../mm/memory.h"
+#include <string.h>
+
+// RFSS behind the VFS. Volumes live here, one slot per ATA device.
+
+static rfss_fs_t volumes[RFSS_MAX_MOUNTS];
+
+static int rfss_vfs_open(void* fs, const char* path, int flags, vfs_file_t* file) {
+    return rfss_open_file(fs, path, flags, &file->rfss);
+}
+
+static int rfss_vfs_close(vfs_file_t* file) {
+    return rfss_close_file(&file->rfss);
+}
+
+static int rfss_vfs_read(vfs_file_t* file, void* buffer, size_t size) {
+    return rfss_read_file(&file->rfss, buffer, size);
+}
+
+static int rfss_vfs_write(vfs_file_t* file, const void* buffer, size_t size) {
+    return rfss_write_file(&file->rfss, buffer, size);
+}
+
+static int rfss_vfs_seek(vfs_file_t* file, uint64_t position) {
+    file->rfss.position = position;
+    return 0;
+}
+
+static int rfss_vfs_truncate(vfs_file_t* file, uint64_t size) {
+    return rfss_truncate_file(&file->rfss, size);
+}
+
+static int rfss_vfs_copy_range(vfs_file_t* src, vfs_file_t* dst, size_t size) {
+    return rfss_copy_file_range(&src->rfss, &dst->rfss, size);
+}
+
+static int rfss_vfs_create(void* fs, const char* path, uint32_t mode) {
+    return rfss_create_file(fs, path, mode);
+}
+
+static int rfss_vfs_unlink(void* fs, const char* path) {
+    return rfss_delete_file(fs, path);
+}
+
+static int rfss_vfs_mkdir(void* fs, const char* path) {
+    return rfss_create_directory(fs, path);
+}
+
+static int rfss_vfs_rmdir(void* fs, const char* path) {
+    return rfss_remove_directory(fs, path);
+}
+
+static int rfss_vfs_rename(void* fs, const char* old_path, const char* new_path) {
+    return rfss_rename(fs, old_path, new_path);
+}
+
+static int rfss_vfs_readdir(void* fs, const char* path, vfs_filldir_t fill, void* ctx) {
+    rfss_dir_entry_t* entries;
+    int count;
+    if (rfss_list_directory(fs, path, &entries, &count) != 0) {
+        return -1;
+    }
+
+    char name[RFSS_MAX_FILENAME + 1];
+    for (int i = 0; i < count; i++) {
+        memcpy(name, entries[i].name, entries[i].name_len);
+        name[entries[i].name_len] = '\0';
+        if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+
+        uint32_t type = entries[i].file_type == RFSS_FILE_DIRECTORY ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+        if (fill(ctx, name, type) != 0) {
+            break;
+        }
+    }
+
+    if (entries) kfree(entries);
+    return 0;
+}
+
+static int rfss_vfs_stat(void* fs, const char* path, vfs_stat_t* st) {
+    rfss_inode_t* inode = rfss_get_inode(fs, rfss_resolve_path(fs, path));
+    if (!inode) {
+        return -1;
+    }
+
+    st->type = ((inode->mode >> 12) & 0xF) == RFSS_FILE_DIRECTORY ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+    st->size = inode->size;
+    return 0;
+}
+
+static int rfss_vfs_sync(void* fs) {
+    return rfss_sync(fs);
+}
+
+static int rfss_vfs_unmount(void* fs) {
+    return rfss_unmount(fs);
+}
+
+const vfs_ops_t rfss_vfs_ops = {
+    .name = "rfss",
+    .open = rfss_vfs_open,
+    .close = rfss_vfs_close,
+    .read = rfss_vfs_read,
+    .write = rfss_vfs_write,
+    .seek = rfss_vfs_seek,
+    .truncate = rfss_vfs_truncate,
+    .copy_range = rfss_vfs_copy_range,
+    .create = rfss_vfs_create,
+    .unlink = rfss_vfs_unlink,
+    .mkdir = rfss_vfs_mkdir,
+    .rmdir = rfss_vfs_rmdir,
+    .rename = rfss_vfs_rename,
+    .readdir = rfss_vfs_readdir,
+    .stat = rfss_vfs_stat,
+    .sync = rfss_vfs_sync,
+    .unmount = rfss_vfs_unmount,
+};
+
+// Mounts the RFSS volume on an ATA device at `path`
+int rfss_vfs_mount(uint32_t device_id, const char* path) {
+    if (device_id >= RFSS_MAX_MOUNTS || !ata_drive_exists(device_id)) {
+        return -1;
+    }
+
+    rfss_fs_t* fs = &volumes[device_id];
+    if (rfss_mount(device_id, fs) != 0) {
+        return -1;
+    }
+
+    if (vfs_mount(path, &rfss_vfs_ops, fs) != 0) {
+        rfss_unmount(fs);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,517 @@
+#include "tmpfs.h"
+#include "vfs.h"
+#include "../kernel/logger.h"
+#include <string.h>
+
+// Filesystem kept entirely in memory. File contents live in pages taken from a static
+// pool shared by every tmpfs mount and go back to it when the file shrinks or is deleted.
+// Nodes are a fixed table per mount; a directory's entries are the nodes naming it as
+// their parent.
+
+static uint8_t page_pool[TMPFS_POOL_PAGES][TMPFS_PAGE_SIZE];
+static uint16_t free_pages[TMPFS_POOL_PAGES];
+static uint32_t free_count = 0;
+static int pool_ready = 0;
+
+static tmpfs_t instances[TMPFS_MAX_MOUNTS];
+
+static void tmpfs_pool_init(void) {
+    for (uint32_t i = 0; i < TMPFS_POOL_PAGES; i++) {
+        free_pages[i] = TMPFS_POOL_PAGES - 1 - i;
+    }
+    free_count = TMPFS_POOL_PAGES;
+    pool_ready = 1;
+}
+
+// Returns a zeroed page as its slot number (page index plus one), or 0 when none is left
+static uint16_t tmpfs_page_alloc(void) {
+    if (free_count == 0) {
+        return 0;
+    }
+
+    uint16_t page = free_pages[--free_count];
+    memset(page_pool[page], 0, TMPFS_PAGE_SIZE);
+    return page + 1;
+}
+
+static void tmpfs_page_free(uint16_t slot) {
+    free_pages[free_count++] = slot - 1;
+}
+
+// Returns the pages past `size` to the pool and clears the rest of the last one
+static void tmpfs_truncate(tmpfs_node_t* node, uint32_t size) {
+    uint32_t keep = (size + TMPFS_PAGE_SIZE - 1) / TMPFS_PAGE_SIZE;
+    for (uint32_t i = keep; i < TMPFS_FILE_PAGES; i++) {
+        if (node->pages[i]) {
+            tmpfs_page_free(node->pages[i]);
+            node->pages[i] = 0;
+        }
+    }
+
+    uint32_t tail = size % TMPFS_PAGE_SIZE;
+    if (tail != 0 && node->pages[keep - 1]) {
+        memset(page_pool[node->pages[keep - 1] - 1] + tail, 0, TMPFS_PAGE_SIZE - tail);
+    }
+    node->size = size;
+}
+
+static void tmpfs_release_node(tmpfs_t* fs, int index) {
+    tmpfs_truncate(&fs->nodes[index], 0);
+    memset(&fs->nodes[index], 0, sizeof(tmpfs_node_t));
+}
+
+static int tmpfs_find_child(tmpfs_t* fs, int dir, const char* name) {
+    for (int i = 1; i < TMPFS_MAX_NODES; i++) {
+        tmpfs_node_t* node = &fs->nodes[i];
+        if (node->type != TMPFS_NODE_FREE && !node->orphan && node->parent == dir && strcmp(node->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Copies the next path component into `name` and returns where the one after it starts
+static const char* tmpfs_next_component(const char* path, char* name) {
+    while (*path == '/') path++;
+
+    int length = 0;
+    while (*path && *path != '/') {
+        if (length < TMPFS_NAME_MAX) {
+            name[length] = *path;
+        }
+        length++;
+        path++;
+    }
+    name[length <= TMPFS_NAME_MAX ? length : 0] = '\0';
+    return path;
+}
+
+int tmpfs_lookup(tmpfs_t* fs, const char* path) {
+    if (!fs || !path) {
+        return -1;
+    }
+
+    char name[TMPFS_NAME_MAX + 1];
+    int current = 0;
+    while (*path) {
+        path = tmpfs_next_component(path, name);
+        if (name[0] == '\0') {
+            if (*path) {
+                return -1;
+            }
+            break;
+        }
+
+        if (fs->nodes[current].type != TMPFS_NODE_DIR) {
+            return -1;
+        }
+        current = tmpfs_find_child(fs, current, name);
+        if (current < 0) {
+            return -1;
+        }
+    }
+
+    return current;
+}
+
+// Finds the directory that will hold the last component of `path` and copies that
+// component into `name`
+static int tmpfs_resolve_parent(tmpfs_t* fs, const char* path, char* name) {
+    char parent_path[VFS_PATH_MAX];
+    const char* slash = strrchr(path, '/');
+    const char* last = slash ? slash + 1 : path;
+    size_t parent_len = last - path;
+
+    if (strlen(last) == 0 || strlen(last) > TMPFS_NAME_MAX || parent_len >= sizeof(parent_path)) {
+        return -1;
+    }
+
+    memcpy(parent_path, path, parent_len);
+    parent_path[parent_len] = '\0';
+    strcpy(name, last);
+
+    int parent = tmpfs_lookup(fs, parent_path);
+    if (parent < 0 || fs->nodes[parent].type != TMPFS_NODE_DIR) {
+        return -1;
+    }
+    return parent;
+}
+
+static int tmpfs_new_node(tmpfs_t* fs, const char* path, uint8_t type) {
+    char name[TMPFS_NAME_MAX + 1];
+    int parent = tmpfs_resolve_parent(fs, path, name);
+    if (parent < 0 || tmpfs_find_child(fs, parent, name) >= 0) {
+        return -1;
+    }
+
+    for (int i = 1; i < TMPFS_MAX_NODES; i++) {
+        tmpfs_node_t* node = &fs->nodes[i];
+        if (node->type == TMPFS_NODE_FREE) {
+            memset(node, 0, sizeof(tmpfs_node_t));
+            strcpy(node->name, name);
+            node->type = type;
+            node->parent = parent;
+            return i;
+        }
+    }
+
+    //log(LOG_ERROR, "tmpfs: out of nodes");
+    return -1;
+}
+
+int tmpfs_create_file(tmpfs_t* fs, const char* path, uint32_t mode __attribute__((unused))) {
+    if (!fs || !path) {
+        return -1;
+    }
+    return tmpfs_new_node(fs, path, TMPFS_NODE_FILE) < 0 ? -1 : 0;
+}
+
+int tmpfs_create_directory(tmpfs_t* fs, const char* path) {
+    if (!fs || !path) {
+        return -1;
+    }
+    return tmpfs_new_node(fs, path, TMPFS_NODE_DIR) < 0 ? -1 : 0;
+}
+
+// A file that is still open loses its name now and its pages on the last close
+int tmpfs_delete_file(tmpfs_t* fs, const char* path) {
+    int index = tmpfs_lookup(fs, path);
+    if (index <= 0 || fs->nodes[index].type != TMPFS_NODE_FILE) {
+        return -1;
+    }
+
+    if (fs->nodes[index].refs > 0) {
+        fs->nodes[index].orphan = 1;
+        fs->nodes[index].name[0] = '\0';
+        return 0;
+    }
+
+    tmpfs_release_node(fs, index);
+    return 0;
+}
+
+int tmpfs_remove_directory(tmpfs_t* fs, const char* path) {
+    int index = tmpfs_lookup(fs, path);
+    if (index <= 0 || fs->nodes[index].type != TMPFS_NODE_DIR) {
+        return -1;
+    }
+
+    for (int i = 1; i < TMPFS_MAX_NODES; i++) {
+        if (fs->nodes[i].type != TMPFS_NODE_FREE && !fs->nodes[i].orphan && fs->nodes[i].parent == index) {
+            return -1;
+        }
+    }
+
+    tmpfs_release_node(fs, index);
+    return 0;
+}
+
+int tmpfs_rename(tmpfs_t* fs, const char* old_path, const char* new_path) {
+    char name[TMPFS_NAME_MAX + 1];
+    int index = tmpfs_lookup(fs, old_path);
+    int parent = tmpfs_resolve_parent(fs, new_path, name);
+    if (index <= 0 || parent < 0 || tmpfs_find_child(fs, parent, name) >= 0) {
+        return -1;
+    }
+
+    // A directory can't move underneath itself
+    for (int dir = parent; dir != 0; dir = fs->nodes[dir].parent) {
+        if (dir == index) {
+            return -1;
+        }
+    }
+
+    fs->nodes[index].parent = parent;
+    strcpy(fs->nodes[index].name, name);
+    return 0;
+}
+
+int tmpfs_open_file(tmpfs_t* fs, const char* path, int flags, tmpfs_file_t* file) {
+    int index = tmpfs_lookup(fs, path);
+    if (index <= 0 || !file || fs->nodes[index].type != TMPFS_NODE_FILE) {
+        return -1;
+    }
+
+    tmpfs_node_t* node = &fs->nodes[index];
+    node->refs++;
+    if (flags & 1) {
+        tmpfs_truncate(node, 0);
+    }
+
+    file->fs = fs;
+    file->node = index;
+    file->position = 0;
+    file->flags = flags;
+    return 0;
+}
+
+int tmpfs_close_file(tmpfs_file_t* file) {
+    if (!file || !file->fs) {
+        return -1;
+    }
+
+    tmpfs_node_t* node = &file->fs->nodes[file->node];
+    if (node->refs > 0 && --node->refs == 0 && node->orphan) {
+        tmpfs_release_node(file->fs, file->node);
+    }
+
+    memset(file, 0, sizeof(tmpfs_file_t));
+    return 0;
+}
+
+int tmpfs_read_file(tmpfs_file_t* file, void* buffer, size_t size) {
+    if (!file || !file->fs || !buffer || size == 0) {
+        return -1;
+    }
+
+    tmpfs_node_t* node = &file->fs->nodes[file->node];
+    if (file->position >= node->size) {
+        return 0;
+    }
+    if (file->position + size > node->size) {
+        size = node->size - file->position;
+    }
+
+    size_t bytes_read = 0;
+    while (bytes_read < size) {
+        uint32_t page = file->position / TMPFS_PAGE_SIZE;
+        uint32_t offset = file->position % TMPFS_PAGE_SIZE;
+        size_t chunk = TMPFS_PAGE_SIZE - offset;
+        if (chunk > size - bytes_read) {
+            chunk = size - bytes_read;
+        }
+
+        uint8_t* dest = (uint8_t*)buffer + bytes_read;
+        if (node->pages[page]) {
+            memcpy(dest, page_pool[node->pages[page] - 1] + offset, chunk);
+        } else {
+            memset(dest, 0, chunk);
+        }
+
+        bytes_read += chunk;
+        file->position += chunk;
+    }
+
+    return bytes_read;
+}
+
+// Pages are taken as the write reaches them; the write comes up short when the file
+// hits TMPFS_FILE_PAGES or the pool runs dry
+int tmpfs_write_file(tmpfs_file_t* file, const void* buffer, size_t size) {
+    if (!file || !file->fs || !buffer || size == 0) {
+        return -1;
+    }
+
+    tmpfs_node_t* node = &file->fs->nodes[file->node];
+    size_t bytes_written = 0;
+    while (bytes_written < size) {
+        uint32_t page = file->position / TMPFS_PAGE_SIZE;
+        uint32_t offset = file->position % TMPFS_PAGE_SIZE;
+        if (page >= TMPFS_FILE_PAGES) {
+            break;
+        }
+
+        if (!node->pages[page]) {
+            node->pages[page] = tmpfs_page_alloc();
+            if (!node->pages[page]) {
+                break;
+            }
+        }
+
+        size_t chunk = TMPFS_PAGE_SIZE - offset;
+        if (chunk > size - bytes_written) {
+            chunk = size - bytes_written;
+        }
+
+        memcpy(page_pool[node->pages[page] - 1] + offset, (const uint8_t*)buffer + bytes_written, chunk);
+        bytes_written += chunk;
+        file->position += chunk;
+    }
+
+    if (file->position > node->size) {
+        node->size = file->position;
+    }
+    return bytes_written;
+}
+
+int tmpfs_truncate_file(tmpfs_file_t* file, uint64_t size) {
+    if (!file || !file->fs || size > file->fs->nodes[file->node].size) {
+        return -1;
+    }
+
+    tmpfs_truncate(&file->fs->nodes[file->node], size);
+    if (file->position > size) {
+        file->position = size;
+    }
+    return 0;
+}
+
+void tmpfs_get_stats(tmpfs_t* fs, uint32_t* used_pages, uint32_t* free_pages_out, uint32_t* used_nodes) {
+    uint32_t pages = 0;
+    uint32_t nodes = 0;
+    for (int i = 0; i < TMPFS_MAX_NODES; i++) {
+        if (fs->nodes[i].type == TMPFS_NODE_FREE) {
+            continue;
+        }
+        nodes++;
+        for (uint32_t p = 0; p < TMPFS_FILE_PAGES; p++) {
+            if (fs->nodes[i].pages[p]) {
+                pages++;
+            }
+        }
+    }
+
+    *used_pages = pages;
+    *free_pages_out = free_count;
+    *used_nodes = nodes;
+}
+
+int tmpfs_unmount(tmpfs_t* fs) {
+    if (!fs || !fs->mounted) {
+        return -1;
+    }
+
+    for (int i = 0; i < TMPFS_MAX_NODES; i++) {
+        if (fs->nodes[i].refs > 0) {
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < TMPFS_MAX_NODES; i++) {
+        if (fs->nodes[i].type != TMPFS_NODE_FREE) {
+            tmpfs_release_node(fs, i);
+        }
+    }
+    fs->mounted = 0;
+    return 0;
+}
+
+static int tmpfs_vfs_open(void* fs, const char* path, int flags, vfs_file_t* file) {
+    return tmpfs_open_file(fs, path, flags, &file->tmpfs);
+}
+
+static int tmpfs_vfs_close(vfs_file_t* file) {
+    return tmpfs_close_file(&file->tmpfs);
+}
+
+static int tmpfs_vfs_read(vfs_file_t* file, void* buffer, size_t size) {
+    return tmpfs_read_file(&file->tmpfs, buffer, size);
+}
+
+static int tmpfs_vfs_write(vfs_file_t* file, const void* buffer, size_t size) {
+    return tmpfs_write_file(&file->tmpfs, buffer, size);
+}
+
+static int tmpfs_vfs_seek(vfs_file_t* file, uint64_t position) {
+    file->tmpfs.position = position;
+    return 0;
+}
+
+static int tmpfs_vfs_truncate(vfs_file_t* file, uint64_t size) {
+    return tmpfs_truncate_file(&file->tmpfs, size);
+}
+
+static int tmpfs_vfs_create(void* fs, const char* path, uint32_t mode) {
+    return tmpfs_create_file(fs, path, mode);
+}
+
+static int tmpfs_vfs_unlink(void* fs, const char* path) {
+    return tmpfs_delete_file(fs, path);
+}
+
+static int tmpfs_vfs_mkdir(void* fs, const char* path) {
+    return tmpfs_create_directory(fs, path);
+}
+
+static int tmpfs_vfs_rmdir(void* fs, const char* path) {
+    return tmpfs_remove_directory(fs, path);
+}
+
+static int tmpfs_vfs_rename(void* fs, const char* old_path, const char* new_path) {
+    return tmpfs_rename(fs, old_path, new_path);
+}
+
+static int tmpfs_vfs_readdir(void* fs, const char* path, vfs_filldir_t fill, void* ctx) {
+    tmpfs_t* tmpfs = fs;
+    int dir = tmpfs_lookup(tmpfs, path);
+    if (dir < 0 || tmpfs->nodes[dir].type != TMPFS_NODE_DIR) {
+        return -1;
+    }
+
+    for (int i = 1; i < TMPFS_MAX_NODES; i++) {
+        tmpfs_node_t* node = &tmpfs->nodes[i];
+        if (node->type == TMPFS_NODE_FREE || node->orphan || node->parent != dir) {
+            continue;
+        }
+        if (fill(ctx, node->name, node->type == TMPFS_NODE_DIR ? VFS_TYPE_DIR : VFS_TYPE_FILE) != 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static int tmpfs_vfs_stat(void* fs, const char* path, vfs_stat_t* st) {
+    tmpfs_t* tmpfs = fs;
+    int index = tmpfs_lookup(tmpfs, path);
+    if (index < 0) {
+        return -1;
+    }
+
+    st->type = tmpfs->nodes[index].type == TMPFS_NODE_DIR ? VFS_TYPE_DIR : VFS_TYPE_FILE;
+    st->size = tmpfs->nodes[index].size;
+    return 0;
+}
+
+static int tmpfs_vfs_sync(void* fs __attribute__((unused))) {
+    return 0;
+}
+
+static int tmpfs_vfs_unmount(void* fs) {
+    return tmpfs_unmount(fs);
+}
+
+const vfs_ops_t tmpfs_vfs_ops = {
+    .name = "tmpfs",
+    .open = tmpfs_vfs_open,
+    .close = tmpfs_vfs_close,
+    .read = tmpfs_vfs_read,
+    .write = tmpfs_vfs_write,
+    .seek = tmpfs_vfs_seek,
+    .truncate = tmpfs_vfs_truncate,
+    .copy_range = NULL,
+    .create = tmpfs_vfs_create,
+    .unlink = tmpfs_vfs_unlink,
+    .mkdir = tmpfs_vfs_mkdir,
+    .rmdir = tmpfs_vfs_rmdir,
+    .rename = tmpfs_vfs_rename,
+    .readdir = tmpfs_vfs_readdir,
+    .stat = tmpfs_vfs_stat,
+    .sync = tmpfs_vfs_sync,
+    .unmount = tmpfs_vfs_unmount,
+};
+
+// Mounts an empty tmpfs at `path`
+int tmpfs_mount(const char* path) {
+    if (!pool_ready) {
+        tmpfs_pool_init();
+    }
+
+    for (int i = 0; i < TMPFS_MAX_MOUNTS; i++) {
+        tmpfs_t* fs = &instances[i];
+        if (fs->mounted) {
+            continue;
+        }
+
+        memset(fs, 0, sizeof(tmpfs_t));
+        fs->nodes[0].type = TMPFS_NODE_DIR;
+        fs->mounted = 1;
+        if (vfs_mount(path, &tmpfs_vfs_ops, fs) != 0) {
+            fs->mounted = 0;
+            return -1;
+        }
+        return 0;
+    }
+
+    //log(LOG_ERROR, "tmpfs: no free instance");
+    return -1;
+}
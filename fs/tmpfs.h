@@ -0,0 +1,57 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TMPFS_MAX_MOUNTS 2
+#define TMPFS_MAX_NODES 128
+#define TMPFS_NAME_MAX 63
+#define TMPFS_FILE_PAGES 128
+#define TMPFS_POOL_PAGES 256
+#define TMPFS_PAGE_SIZE 4096
+
+#define TMPFS_NODE_FREE 0
+#define TMPFS_NODE_FILE 1
+#define TMPFS_NODE_DIR 2
+
+// A file or directory. pages[] holds pool page numbers plus one, so 0 is a hole.
+typedef struct {
+    char name[TMPFS_NAME_MAX + 1];
+    uint8_t type;
+    uint8_t orphan;
+    uint16_t parent;
+    uint16_t refs;
+    uint32_t size;
+    uint16_t pages[TMPFS_FILE_PAGES];
+} tmpfs_node_t;
+
+// Node 0 is the root directory
+typedef struct {
+    tmpfs_node_t nodes[TMPFS_MAX_NODES];
+    int mounted;
+} tmpfs_t;
+
+typedef struct {
+    tmpfs_t* fs;
+    uint32_t node;
+    uint64_t position;
+    int flags;
+} tmpfs_file_t;
+
+int tmpfs_mount(const char* path);
+int tmpfs_unmount(tmpfs_t* fs);
+int tmpfs_create_file(tmpfs_t* fs, const char* path, uint32_t mode);
+int tmpfs_delete_file(tmpfs_t* fs, const char* path);
+int tmpfs_open_file(tmpfs_t* fs, const char* path, int flags, tmpfs_file_t* file);
+int tmpfs_close_file(tmpfs_file_t* file);
+int tmpfs_read_file(tmpfs_file_t* file, void* buffer, size_t size);
+int tmpfs_write_file(tmpfs_file_t* file, const void* buffer, size_t size);
+int tmpfs_truncate_file(tmpfs_file_t* file, uint64_t size);
+int tmpfs_create_directory(tmpfs_t* fs, const char* path);
+int tmpfs_remove_directory(tmpfs_t* fs, const char* path);
+int tmpfs_rename(tmpfs_t* fs, const char* old_path, const char* new_path);
+int tmpfs_lookup(tmpfs_t* fs, const char* path);
+void tmpfs_get_stats(tmpfs_t* fs, uint32_t* used_pages, uint32_t* free_pages, uint32_t* used_nodes);
+
+#endif
@@ -0,0 +1,387 @@
+#include "vfs.h"
+#include "../kernel/logger.h"
+#include <string.h>
+
+// Virtual filesystem switch. Each mount binds an absolute path to a filesystem instance
+// and its operations; a path goes to the mount with the longest matching prefix, which
+// sees the remainder as an absolute path of its own. Relative paths start at the
+// working directory kept here, so it can cross mounts.
+
+static vfs_mount_t mounts[VFS_MAX_MOUNTS];
+static char cwd[VFS_PATH_MAX] = "/";
+
+// Makes `path` absolute and removes empty, "." and ".." components
+int vfs_normalize_path(const char* path, char* out) {
+    if (!path || !out) {
+        return -1;
+    }
+
+    static char joined[VFS_PATH_MAX * 2];
+    if (path[0] == '/') {
+        joined[0] = '\0';
+    } else {
+        strcpy(joined, cwd);
+        strcat(joined, "/");
+    }
+    if (strlen(joined) + strlen(path) >= sizeof(joined)) {
+        return -1;
+    }
+    strcat(joined, path);
+
+    size_t length = 0;
+    const char* p = joined;
+    while (*p) {
+        while (*p == '/') p++;
+        const char* start = p;
+        while (*p && *p != '/') p++;
+        size_t name_len = p - start;
+
+        if (name_len == 0 || (name_len == 1 && start[0] == '.')) {
+            continue;
+        }
+        if (name_len == 2 && start[0] == '.' && start[1] == '.') {
+            while (length > 0 && out[length - 1] != '/') length--;
+            if (length > 0) length--;
+            continue;
+        }
+        if (length + 1 + name_len >= VFS_PATH_MAX) {
+            return -1;
+        }
+
+        out[length++] = '/';
+        memcpy(out + length, start, name_len);
+        length += name_len;
+    }
+
+    if (length == 0) {
+        out[length++] = '/';
+    }
+    out[length] = '\0';
+    return 0;
+}
+
+// `path` is under `prefix` when it equals it or continues with a '/'
+static int vfs_path_under(const char* path, const char* prefix) {
+    size_t length = strlen(prefix);
+    if (length == 1) {
+        return 1;
+    }
+    return strncmp(path, prefix, length) == 0 && (path[length] == '\0' || path[length] == '/');
+}
+
+// Finds the mount serving a normalized path and stores the path inside it in `rest`
+vfs_mount_t* vfs_find_mount(const char* path, char* rest) {
+    vfs_mount_t* best = NULL;
+    size_t best_len = 0;
+
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        size_t length = strlen(mounts[i].path);
+        if (mounts[i].used && vfs_path_under(path, mounts[i].path) && (!best || length > best_len)) {
+            best = &mounts[i];
+            best_len = length;
+        }
+    }
+
+    if (best && rest) {
+        const char* remainder = best_len == 1 ? path : path + best_len;
+        strcpy(rest, *remainder ? remainder : "/");
+    }
+    return best;
+}
+
+static vfs_mount_t* vfs_resolve(const char* path, char* rest) {
+    char full[VFS_PATH_MAX];
+    if (vfs_normalize_path(path, full) != 0) {
+        return NULL;
+    }
+    return vfs_find_mount(full, rest);
+}
+
+int vfs_mount(const char* path, const vfs_ops_t* ops, void* fs) {
+    char full[VFS_PATH_MAX];
+    if (!ops || !fs || vfs_normalize_path(path, full) != 0) {
+        return -1;
+    }
+
+    vfs_mount_t* slot = NULL;
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (mounts[i].used && strcmp(mounts[i].path, full) == 0) {
+            //log(LOG_ERROR, "%s is already a mount point", full);
+            return -1;
+        }
+        if (!mounts[i].used && !slot) {
+            slot = &mounts[i];
+        }
+    }
+
+    if (!slot) {
+        //log(LOG_ERROR, "Mount table full");
+        return -1;
+    }
+
+    strcpy(slot->path, full);
+    slot->ops = ops;
+    slot->fs = fs;
+    slot->used = 1;
+    log(LOG_OK, "Mounted %s filesystem on %s", ops->name, full);
+    return 0;
+}
+
+// Detaches the mount at `path` and lets its filesystem shut down. A mount with other
+// mounts below it or files mapped from it stays.
+int vfs_unmount(const char* path) {
+    char full[VFS_PATH_MAX];
+    if (vfs_normalize_path(path, full) != 0) {
+        return -1;
+    }
+
+    vfs_mount_t* mount = NULL;
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (mounts[i].used && strcmp(mounts[i].path, full) == 0) {
+            mount = &mounts[i];
+        }
+    }
+    if (!mount) {
+        return -1;
+    }
+
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (mounts[i].used && &mounts[i] != mount && vfs_path_under(mounts[i].path, full)) {
+            //log(LOG_ERROR, "%s is busy", full);
+            return -1;
+        }
+    }
+    if (vfs_map_busy(mount)) {
+        return -1;
+    }
+
+    if (mount->ops->unmount(mount->fs) != 0) {
+        return -1;
+    }
+
+    mount->used = 0;
+    if (vfs_path_under(cwd, full)) {
+        strcpy(cwd, "/");
+    }
+    return 0;
+}
+
+vfs_mount_t* vfs_get_mount(int index) {
+    if (index < 0 || index >= VFS_MAX_MOUNTS || !mounts[index].used) {
+        return NULL;
+    }
+    return &mounts[index];
+}
+
+int vfs_open(const char* path, int flags, vfs_file_t* file) {
+    char rest[VFS_PATH_MAX];
+    vfs_mount_t* mount = vfs_resolve(path, rest);
+    if (!mount || !file) {
+        return -1;
+    }
+
+    memset(file, 0, sizeof(vfs_file_t));
+    if (mount->ops->open(mount->fs, rest, flags, file) != 0) {
+        return -1;
+    }
+
+    file->mount = mount;
+    return 0;
+}
+
+int vfs_close(vfs_file_t* file) {
+    if (!file || !file->mount) {
+        return -1;
+    }
+
+    int result = file->mount->ops->close(file);
+    file->mount = NULL;
+    return result;
+}
+
+int vfs_read(vfs_file_t* file, void* buffer, size_t size) {
+    if (!file || !file->mount) {
+        return -1;
+    }
+    return file->mount->ops->read(file, buffer, size);
+}
+
+int vfs_write(vfs_file_t* file, const void* buffer, size_t size) {
+    if (!file || !file->mount) {
+        return -1;
+    }
+    return file->mount->ops->write(file, buffer, size);
+}
+
+int vfs_seek(vfs_file_t* file, uint64_t position) {
+    if (!file || !file->mount) {
+        return -1;
+    }
+    return file->mount->ops->seek(file, position);
+}
+
+// Shrinks an open file to `size` bytes
+int vfs_truncate(vfs_file_t* file, uint64_t size) {
+    if (!file || !file->mount) {
+        return -1;
+    }
+    return file->mount->ops->truncate(file, size);
+}
+
+// Lets the filesystem copy internally when both files live on the same mount, and
+// streams through a bounce buffer otherwise
+int vfs_copy_file_range(vfs_file_t* src, vfs_file_t* dst, size_t size) {
+    if (!src || !dst || !src->mount || !dst->mount) {
+        return -1;
+    }
+
+    if (src->mount == dst->mount && src->mount->ops->copy_range) {
+        return src->mount->ops->copy_range(src, dst, size);
+    }
+
+    static uint8_t bounce[RFSS_BLOCK_SIZE * 4];
+    size_t copied = 0;
+    while (copied < size) {
+        size_t chunk = size - copied < sizeof(bounce) ? size - copied : sizeof(bounce);
+        int bytes_read = vfs_read(src, bounce, chunk);
+        if (bytes_read <= 0) {
+            break;
+        }
+
+        int bytes_written = vfs_write(dst, bounce, bytes_read);
+        if (bytes_written > 0) {
+            copied += bytes_written;
+        }
+        if (bytes_written != bytes_read) {
+            break;
+        }
+    }
+
+    return copied;
+}
+
+int vfs_create(const char* path, uint32_t mode) {
+    char rest[VFS_PATH_MAX];
+    vfs_mount_t* mount = vfs_resolve(path, rest);
+    return mount ? mount->ops->create(mount->fs, rest, mode) : -1;
+}
+
+int vfs_unlink(const char* path) {
+    char rest[VFS_PATH_MAX];
+    vfs_mount_t* mount = vfs_resolve(path, rest);
+    return mount ? mount->ops->unlink(mount->fs, rest) : -1;
+}
+
+int vfs_mkdir(const char* path) {
+    char rest[VFS_PATH_MAX];
+    vfs_mount_t* mount = vfs_resolve(path, rest);
+    return mount ? mount->ops->mkdir(mount->fs, rest) : -1;
+}
+
+int vfs_rmdir(const char* path) {
+    char rest[VFS_PATH_MAX];
+    vfs_mount_t* mount = vfs_resolve(path, rest);
+    return mount ? mount->ops->rmdir(mount->fs, rest) : -1;
+}
+
+// Renames stay within one mount; moving between filesystems is a copy the caller makes
+int vfs_rename(const char* old_path, const char* new_path) {
+    char old_rest[VFS_PATH_MAX];
+    char new_rest[VFS_PATH_MAX];
+    vfs_mount_t* mount = vfs_resolve(old_path, old_rest);
+    if (!mount || vfs_resolve(new_path, new_rest) != mount) {
+        return -1;
+    }
+    return mount->ops->rename(mount->fs, old_rest, new_rest);
+}
+
+typedef struct {
+    const char* dir;
+    vfs_filldir_t fill;
+    void* ctx;
+} vfs_readdir_ctx_t;
+
+// Whether the mount point sits directly inside `dir`
+static int vfs_mount_in_dir(const vfs_mount_t* mount, const char* dir) {
+    const char* slash = strrchr(mount->path, '/');
+    size_t parent_len = slash == mount->path ? 1 : (size_t)(slash - mount->path);
+    return mount->used && slash[1] != '\0' && strlen(dir) == parent_len && strncmp(mount->path, dir, parent_len) == 0;
+}
+
+// Mount points directly below `dir` cover whatever the parent filesystem has there
+static int vfs_is_mount_child(const char* dir, const char* name) {
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (vfs_mount_in_dir(&mounts[i], dir) && strcmp(strrchr(mounts[i].path, '/') + 1, name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int vfs_readdir_filter(void* ctx, const char* name, uint32_t type) {
+    vfs_readdir_ctx_t* readdir_ctx = ctx;
+    if (vfs_is_mount_child(readdir_ctx->dir, name)) {
+        return 0;
+    }
+    return readdir_ctx->fill(readdir_ctx->ctx, name, type);
+}
+
+int vfs_readdir(const char* path, vfs_filldir_t fill, void* ctx) {
+    char full[VFS_PATH_MAX];
+    char rest[VFS_PATH_MAX];
+    if (!fill || vfs_normalize_path(path && *path ? path : ".", full) != 0) {
+        return -1;
+    }
+
+    vfs_mount_t* mount = vfs_find_mount(full, rest);
+    if (!mount) {
+        return -1;
+    }
+
+    vfs_readdir_ctx_t readdir_ctx = { full, fill, ctx };
+    if (mount->ops->readdir(mount->fs, rest, vfs_readdir_filter, &readdir_ctx) != 0) {
+        return -1;
+    }
+
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (vfs_mount_in_dir(&mounts[i], full) && fill(ctx, strrchr(mounts[i].path, '/') + 1, VFS_TYPE_DIR) != 0) {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+int vfs_stat(const char* path, vfs_stat_t* st) {
+    char rest[VFS_PATH_MAX];
+    vfs_mount_t* mount = vfs_resolve(path, rest);
+    if (!mount || !st) {
+        return -1;
+    }
+    return mount->ops->stat(mount->fs, rest, st);
+}
+
+int vfs_chdir(const char* path) {
+    char full[VFS_PATH_MAX];
+    vfs_stat_t st;
+    if (vfs_normalize_path(path, full) != 0 || vfs_stat(full, &st) != 0 || st.type != VFS_TYPE_DIR) {
+        return -1;
+    }
+
+    strcpy(cwd, full);
+    return 0;
+}
+
+const char* vfs_getcwd(void) {
+    return cwd;
+}
+
+int vfs_sync(void) {
+    int result = vfs_msync_all();
+    for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+        if (mounts[i].used && mounts[i].ops->sync(mounts[i].fs) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
@@ -0,0 +1,136 @@
+#ifndef VFS_H
+#define VFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "rfss.h"
+#include "tmpfs.h"
+
+#define VFS_MAX_MOUNTS 8
+#define VFS_PATH_MAX 256
+#define VFS_NAME_MAX 255
+
+#define VFS_TYPE_FILE 1
+#define VFS_TYPE_DIR 2
+
+#define VFS_O_READ 0
+#define VFS_O_TRUNC 1
+
+typedef struct vfs_mount vfs_mount_t;
+
+typedef struct {
+    uint32_t type;
+    uint64_t size;
+} vfs_stat_t;
+
+typedef struct {
+    vfs_mount_t* mount;
+    union {
+        rfss_file_t rfss;
+        tmpfs_file_t tmpfs;
+    };
+} vfs_file_t;
+
+// Called once per directory entry; a non-zero return stops the listing
+typedef int (*vfs_filldir_t)(void* ctx, const char* name, uint32_t type);
+
+// Operations a filesystem provides to the VFS. Paths are absolute within the mount.
+// Every entry except copy_range is required.
+typedef struct {
+    const char* name;
+    int (*open)(void* fs, const char* path, int flags, vfs_file_t* file);
+    int (*close)(vfs_file_t* file);
+    int (*read)(vfs_file_t* file, void* buffer, size_t size);
+    int (*write)(vfs_file_t* file, const void* buffer, size_t size);
+    int (*seek)(vfs_file_t* file, uint64_t position);
+    int (*truncate)(vfs_file_t* file, uint64_t size);
+    int (*copy_range)(vfs_file_t* src, vfs_file_t* dst, size_t size);
+    int (*create)(void* fs, const char* path, uint32_t mode);
+    int (*unlink)(void* fs, const char* path);
+    int (*mkdir)(void* fs, const char* path);
+    int (*rmdir)(void* fs, const char* path);
+    int (*rename)(void* fs, const char* old_path, const char* new_path);
+    int (*readdir)(void* fs, const char* path, vfs_filldir_t fill, void* ctx);
+    int (*stat)(void* fs, const char* path, vfs_stat_t* st);
+    int (*sync)(void* fs);
+    int (*unmount)(void* fs);
+} vfs_ops_t;
+
+struct vfs_mount {
+    char path[VFS_PATH_MAX];
+    const vfs_ops_t* ops;
+    void* fs;
+    int used;
+};
+
+int vfs_mount(const char* path, const vfs_ops_t* ops, void* fs);
+int vfs_unmount(const char* path);
+vfs_mount_t* vfs_get_mount(int index);
+vfs_mount_t* vfs_find_mount(const char* path, char* rest);
+int vfs_normalize_path(const char* path, char* out);
+
+#define VFS_MAX_MAPS 4
+#define VFS_MAP_FRAMES 4
+#define VFS_MAP_PAGE_SIZE 4096
+
+#define VFS_MAP_READ 0
+#define VFS_MAP_WRITE 1
+
+typedef struct {
+    uint32_t page;
+    uint32_t last_used;
+    uint8_t valid;
+    uint8_t dirty;
+    uint8_t data[VFS_MAP_PAGE_SIZE];
+} vfs_map_frame_t;
+
+// A file mapped page by page. A page is read in the first time it is touched and kept
+// in one of a few frames; dirty frames go back to the file when they are evicted,
+// synced or unmapped. `size` is the mapped length, which vfs_map_resize can move away
+// from the file's until the next sync.
+typedef struct {
+    vfs_file_t file;
+    uint64_t size;
+    uint64_t file_size;
+    int flags;
+    int used;
+    uint32_t clock;
+    uint32_t faults;
+    uint32_t writebacks;
+    vfs_map_frame_t frames[VFS_MAP_FRAMES];
+} vfs_map_t;
+
+int vfs_open(const char* path, int flags, vfs_file_t* file);
+int vfs_close(vfs_file_t* file);
+int vfs_read(vfs_file_t* file, void* buffer, size_t size);
+int vfs_write(vfs_file_t* file, const void* buffer, size_t size);
+int vfs_seek(vfs_file_t* file, uint64_t position);
+int vfs_truncate(vfs_file_t* file, uint64_t size);
+int vfs_copy_file_range(vfs_file_t* src, vfs_file_t* dst, size_t size);
+int vfs_create(const char* path, uint32_t mode);
+int vfs_unlink(const char* path);
+int vfs_mkdir(const char* path);
+int vfs_rmdir(const char* path);
+int vfs_rename(const char* old_path, const char* new_path);
+int vfs_readdir(const char* path, vfs_filldir_t fill, void* ctx);
+int vfs_stat(const char* path, vfs_stat_t* st);
+int vfs_chdir(const char* path);
+const char* vfs_getcwd(void);
+int vfs_sync(void);
+
+vfs_map_t* vfs_mmap(const char* path, int flags);
+uint8_t* vfs_map_page(vfs_map_t* map, uint32_t page, int write);
+int vfs_map_get(vfs_map_t* map, uint64_t offset);
+int vfs_map_set(vfs_map_t* map, uint64_t offset, uint8_t value);
+int vfs_map_move(vfs_map_t* map, uint64_t dst, uint64_t src, uint64_t length);
+int vfs_map_resize(vfs_map_t* map, uint64_t size);
+int vfs_msync(vfs_map_t* map);
+int vfs_munmap(vfs_map_t* map);
+int vfs_msync_all(void);
+int vfs_map_busy(const vfs_mount_t* mount);
+
+extern const vfs_ops_t rfss_vfs_ops;
+int rfss_vfs_mount(uint32_t device_id, const char* path);
+extern const vfs_ops_t tmpfs_vfs_ops;
+
+#endif
@@ -0,0 +1,291 @@
+#include "vfs.h"
+#include <string.h>
+
+// File mappings. There is no paging, so a "page fault" is a call to vfs_map_page for a
+// page that isn't resident: the least recently used frame is written back if dirty and
+// refilled from the file, which for RFSS means from the block cache. Only the frames
+// of a mapping are ever in memory, whatever the size of the file.
+
+static vfs_map_t maps[VFS_MAX_MAPS];
+
+// Writes zeros from the current end of the file up to `end`, so a page written further
+// out doesn't leave blocks the filesystem allocated but nothing filled
+static int vfs_map_fill_gap(vfs_map_t* map, uint64_t end) {
+    static uint8_t zero_page[VFS_MAP_PAGE_SIZE];
+
+    while (map->file_size < end) {
+        uint64_t chunk = end - map->file_size;
+        if (chunk > VFS_MAP_PAGE_SIZE) {
+            chunk = VFS_MAP_PAGE_SIZE;
+        }
+        if (vfs_seek(&map->file, map->file_size) != 0 || vfs_write(&map->file, zero_page, chunk) != (int)chunk) {
+            return -1;
+        }
+        map->file_size += chunk;
+    }
+    return 0;
+}
+
+static int vfs_map_writeback(vfs_map_t* map, vfs_map_frame_t* frame) {
+    if (!frame->valid || !frame->dirty) {
+        return 0;
+    }
+
+    uint64_t offset = (uint64_t)frame->page * VFS_MAP_PAGE_SIZE;
+    uint64_t length = map->size - offset;
+    if (length > VFS_MAP_PAGE_SIZE) {
+        length = VFS_MAP_PAGE_SIZE;
+    }
+
+    if (vfs_map_fill_gap(map, offset) != 0 || vfs_seek(&map->file, offset) != 0 ||
+        vfs_write(&map->file, frame->data, length) != (int)length) {
+        return -1;
+    }
+
+    if (offset + length > map->file_size) {
+        map->file_size = offset + length;
+    }
+    frame->dirty = 0;
+    map->writebacks++;
+    return 0;
+}
+
+// Maps `path` for reading, or for reading and writing with VFS_MAP_WRITE. Nothing is
+// read until a page is touched.
+vfs_map_t* vfs_mmap(const char* path, int flags) {
+    vfs_stat_t st;
+    if (!path || vfs_stat(path, &st) != 0 || st.type != VFS_TYPE_FILE) {
+        return NULL;
+    }
+
+    for (int i = 0; i < VFS_MAX_MAPS; i++) {
+        vfs_map_t* map = &maps[i];
+        if (map->used) {
+            continue;
+        }
+
+        memset(map, 0, sizeof(vfs_map_t));
+        if (vfs_open(path, VFS_O_READ, &map->file) != 0) {
+            return NULL;
+        }
+
+        map->size = st.size;
+        map->file_size = st.size;
+        map->flags = flags;
+        map->used = 1;
+        return map;
+    }
+
+    return NULL;
+}
+
+// Returns the resident copy of `page`, faulting it in first if needed. A page touched
+// for writing is written back later.
+uint8_t* vfs_map_page(vfs_map_t* map, uint32_t page, int write) {
+    if (!map || !map->used || (uint64_t)page * VFS_MAP_PAGE_SIZE >= map->size) {
+        return NULL;
+    }
+    if (write && !(map->flags & VFS_MAP_WRITE)) {
+        return NULL;
+    }
+
+    vfs_map_frame_t* frame = NULL;
+    vfs_map_frame_t* victim = &map->frames[0];
+    for (int i = 0; i < VFS_MAP_FRAMES; i++) {
+        vfs_map_frame_t* candidate = &map->frames[i];
+        if (candidate->valid && candidate->page == page) {
+            frame = candidate;
+            break;
+        }
+        if (victim->valid && (!candidate->valid || candidate->last_used < victim->last_used)) {
+            victim = candidate;
+        }
+    }
+
+    if (!frame) {
+        if (vfs_map_writeback(map, victim) != 0) {
+            return NULL;
+        }
+
+        victim->valid = 0;
+        memset(victim->data, 0, VFS_MAP_PAGE_SIZE);
+
+        uint64_t offset = (uint64_t)page * VFS_MAP_PAGE_SIZE;
+        if (offset < map->file_size) {
+            uint64_t length = map->file_size - offset;
+            if (length > VFS_MAP_PAGE_SIZE) {
+                length = VFS_MAP_PAGE_SIZE;
+            }
+            if (vfs_seek(&map->file, offset) != 0 || vfs_read(&map->file, victim->data, length) != (int)length) {
+                return NULL;
+            }
+        }
+
+        victim->page = page;
+        victim->valid = 1;
+        victim->dirty = 0;
+        map->faults++;
+        frame = victim;
+    }
+
+    frame->last_used = ++map->clock;
+    if (write) {
+        frame->dirty = 1;
+    }
+    return frame->data;
+}
+
+// Returns the byte at `offset`, or -1 past the end of the mapping
+int vfs_map_get(vfs_map_t* map, uint64_t offset) {
+    if (!map || offset >= map->size) {
+        return -1;
+    }
+    uint8_t* page = vfs_map_page(map, offset / VFS_MAP_PAGE_SIZE, 0);
+    return page ? page[offset % VFS_MAP_PAGE_SIZE] : -1;
+}
+
+int vfs_map_set(vfs_map_t* map, uint64_t offset, uint8_t value) {
+    if (!map || offset >= map->size) {
+        return -1;
+    }
+    uint8_t* page = vfs_map_page(map, offset / VFS_MAP_PAGE_SIZE, 1);
+    if (!page) {
+        return -1;
+    }
+    page[offset % VFS_MAP_PAGE_SIZE] = value;
+    return 0;
+}
+
+// memmove within the mapping. Each step moves what fits in both the source and the
+// destination page; the source page was just touched, so faulting in the destination
+// never evicts it.
+int vfs_map_move(vfs_map_t* map, uint64_t dst, uint64_t src, uint64_t length) {
+    if (!map || dst + length > map->size || src + length > map->size) {
+        return -1;
+    }
+
+    uint64_t done = 0;
+    while (done < length) {
+        uint64_t from;
+        uint64_t to;
+        uint64_t chunk = length - done;
+
+        if (dst <= src) {
+            from = src + done;
+            to = dst + done;
+            if (chunk > VFS_MAP_PAGE_SIZE - from % VFS_MAP_PAGE_SIZE) chunk = VFS_MAP_PAGE_SIZE - from % VFS_MAP_PAGE_SIZE;
+            if (chunk > VFS_MAP_PAGE_SIZE - to % VFS_MAP_PAGE_SIZE) chunk = VFS_MAP_PAGE_SIZE - to % VFS_MAP_PAGE_SIZE;
+        } else {
+            // Overlapping forward move: go from the end
+            uint64_t from_end = src + length - done;
+            uint64_t to_end = dst + length - done;
+            if (chunk > (from_end - 1) % VFS_MAP_PAGE_SIZE + 1) chunk = (from_end - 1) % VFS_MAP_PAGE_SIZE + 1;
+            if (chunk > (to_end - 1) % VFS_MAP_PAGE_SIZE + 1) chunk = (to_end - 1) % VFS_MAP_PAGE_SIZE + 1;
+            from = from_end - chunk;
+            to = to_end - chunk;
+        }
+
+        uint8_t* source = vfs_map_page(map, from / VFS_MAP_PAGE_SIZE, 0);
+        uint8_t* dest = source ? vfs_map_page(map, to / VFS_MAP_PAGE_SIZE, 1) : NULL;
+        if (!dest) {
+            return -1;
+        }
+
+        memmove(dest + to % VFS_MAP_PAGE_SIZE, source + from % VFS_MAP_PAGE_SIZE, chunk);
+        done += chunk;
+    }
+
+    return 0;
+}
+
+// Changes the mapped length. Growing adds zeros that reach the file on the next sync;
+// shrinking drops the pages past the new end and truncates the file right away.
+int vfs_map_resize(vfs_map_t* map, uint64_t size) {
+    if (!map || !map->used || !(map->flags & VFS_MAP_WRITE)) {
+        return -1;
+    }
+
+    if (size < map->size) {
+        for (int i = 0; i < VFS_MAP_FRAMES; i++) {
+            vfs_map_frame_t* frame = &map->frames[i];
+            uint64_t start = (uint64_t)frame->page * VFS_MAP_PAGE_SIZE;
+            if (!frame->valid || start + VFS_MAP_PAGE_SIZE <= size) {
+                continue;
+            }
+            if (start >= size) {
+                frame->valid = 0;
+                frame->dirty = 0;
+            } else {
+                memset(frame->data + (size - start), 0, VFS_MAP_PAGE_SIZE - (size - start));
+            }
+        }
+
+        if (size < map->file_size) {
+            if (vfs_truncate(&map->file, size) != 0) {
+                return -1;
+            }
+            map->file_size = size;
+        }
+    }
+
+    map->size = size;
+    return 0;
+}
+
+// Writes dirty pages back in file order and extends the file to the mapped length
+int vfs_msync(vfs_map_t* map) {
+    if (!map || !map->used) {
+        return -1;
+    }
+
+    while (1) {
+        vfs_map_frame_t* next = NULL;
+        for (int i = 0; i < VFS_MAP_FRAMES; i++) {
+            vfs_map_frame_t* frame = &map->frames[i];
+            if (frame->valid && frame->dirty && (!next || frame->page < next->page)) {
+                next = frame;
+            }
+        }
+        if (!next) {
+            break;
+        }
+        if (vfs_map_writeback(map, next) != 0) {
+            return -1;
+        }
+    }
+
+    if ((map->flags & VFS_MAP_WRITE) && vfs_map_fill_gap(map, map->size) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int vfs_munmap(vfs_map_t* map) {
+    if (!map || !map->used) {
+        return -1;
+    }
+
+    int result = vfs_msync(map);
+    vfs_close(&map->file);
+    map->used = 0;
+    return result;
+}
+
+int vfs_msync_all(void) {
+    int result = 0;
+    for (int i = 0; i < VFS_MAX_MAPS; i++) {
+        if (maps[i].used && (maps[i].flags & VFS_MAP_WRITE) && vfs_msync(&maps[i]) != 0) {
+            result = -1;
+        }
+    }
+    return result;
+}
+
+int vfs_map_busy(const vfs_mount_t* mount) {
+    for (int i = 0; i < VFS_MAX_MAPS; i++) {
+        if (maps[i].used && maps[i].file.mount == mount) {
+            return 1;
+        }
+    }
+    return 0;
+}
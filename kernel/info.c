@@ -47,3 +47,10 @@ void get_system_info(system_info_t* info) {
     uint64_t bytes = get_total_memory();
     info->total_ram = bytes >> 20; // Convert bytes to MB (divide by 1024*1024)
 }
+
+// CPUID.1:ECX bit 20, needed for the crc32 instruction
+int cpu_has_sse42(void) {
+    unsigned int eax, ebx, ecx, edx;
+    get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    return (ecx >> 20) & 1;
+}
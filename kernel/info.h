@@ -18,7 +18,7 @@ typedef struct {
 } system_info_t;
 
 
-static void get_cpuid(unsigned int eax_in, unsigned int* eax_out, unsigned int* ebx_out, unsigned int* ecx_out, unsigned int* edx_out);
 void get_system_info(system_info_t* info);
+int cpu_has_sse42(void);
 
 #endif // __INFO_H__
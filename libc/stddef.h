@@ -5,4 +5,6 @@
 typedef unsigned int size_t;
 typedef int ptrdiff_t;
 
+#define offsetof(type, member) __builtin_offsetof(type, member)
+
 #endif
@@ -23,14 +23,51 @@
 #include <../drivers/ata.h>
 #include "../mm/memory.h"
 #include "../kernel/process.h"
-#include "../fs/rfss.h"
+#include "../fs/vfs.h"
 
-static rfss_fs_t primary_fs;
+// Dirty filesystem metadata and cached blocks are written back this often (5 s at 100 Hz)
+#define SYNC_INTERVAL_TICKS 500
+// Volumes with background defragmentation on move at most one file this often
+#define DEFRAG_INTERVAL_TICKS 50
 
 static void timer_callback(registers_t* regs __attribute__((unused))) {
+    pit_handler();
     schedule();
 }
 
+// Runs from the idle loop rather than the timer interrupt because it waits on the disk.
+// Interrupts stay off meanwhile so a shell command can't run in the middle of it.
+static void periodic_sync(void) {
+    static uint64_t last_sync = 0;
+
+    if (pit_ticks() - last_sync < SYNC_INTERVAL_TICKS) {
+        return;
+    }
+    last_sync = pit_ticks();
+
+    __asm__ __volatile__ ("cli");
+    vfs_sync();
+    __asm__ __volatile__ ("sti");
+}
+
+static void periodic_defrag(void) {
+    static uint64_t last_step = 0;
+
+    if (pit_ticks() - last_step < DEFRAG_INTERVAL_TICKS) {
+        return;
+    }
+    last_step = pit_ticks();
+
+    __asm__ __volatile__ ("cli");
+    for (uint32_t i = 0; i < RFSS_MAX_MOUNTS; i++) {
+        rfss_fs_t* fs = rfss_get_mount(i);
+        if (fs && fs->defrag_enabled) {
+            rfss_defrag_step(fs);
+        }
+    }
+    __asm__ __volatile__ ("sti");
+}
+
 void start_kernel(multiboot_info_t* mbd, unsigned int magic __attribute__((unused))) {
     init_screen(mbd);
     init_graphics();
@@ -56,11 +93,15 @@ void start_kernel(multiboot_info_t* mbd, unsigned int magic __attribute__((unuse
     log(LOG_OK, "ATA initialized");
 
     log(LOG_SYSTEM, "Attempting to auto-mount primary device...");
-    if (rfss_mount(0, &primary_fs) == 0) {
+    if (rfss_vfs_mount(0, "/") == 0) {
         log(LOG_OK, "Primary device mounted automatically");
     } else {
         log(LOG_LOG, "Primary device not mounted (not formatted or error)");
     }
+
+    if (tmpfs_mount("/tmp") != 0) {
+        log(LOG_ERROR, "Failed to mount tmpfs on /tmp");
+    }
     
     log(LOG_SYSTEM, "Initializing GDT...");
     init_gdt();
@@ -116,5 +157,7 @@ void start_kernel(multiboot_info_t* mbd, unsigned int magic __attribute__((unuse
     
     for (;;) {
         __asm__ __volatile__ ("hlt");
+        periodic_sync();
+        periodic_defrag();
     }
 }
\ No newline at end of file
@@ -4,7 +4,7 @@
 #include <../drivers/keyboard/keyboard.h>
 #include "../drivers/ata.h"
 #include <../cpu/ports.h>
-#include <../fs/rfss.h>
+#include <../fs/vfs.h>
 #include "../ui/desktop/desktop.h"
 #include <../libc/syscall.h>
 #include <../libc/stdio.h>
@@ -19,12 +19,28 @@
 #include "edit.h"
 
 
+// Typing opens this much room at the cursor whenever the gap is used up
+#define EDIT_GAP 4096
+// A redraw shows this many lines around the cursor, looking at most this many bytes
+// either side of it
+#define EDIT_LINES 20
+#define EDIT_WINDOW 2048
+
 static int editmode = 0;
-char edit_buffer[4096];
+static vfs_map_t* edit_map = NULL;
+// The mapping holds the text before the cursor, then gap_size unused bytes, then the
+// rest. Typing fills the gap and moving the cursor carries it along a byte at a time,
+// so a key only touches the pages at the cursor; edit_save closes it.
+static int gap_size = 0;
+static int line_count = 1;
 int buffer_pos = 0;
 int cursor_pos = 0;
 char current_file[256];
 
+// Byte `i` of the text, skipping the gap
+static int edit_char_at(int i) {
+    return vfs_map_get(edit_map, i < cursor_pos ? i : i + gap_size);
+}
 
 void cmd_edit(const char* args) {
     if (!args || !*args) {
@@ -32,31 +48,37 @@ void cmd_edit(const char* args) {
         return;
     }
     strcpy(current_file, args);
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
-        printf("No filesystem mounted\n");
-        return;
-    }
-    rfss_file_t file;
-    if (rfss_open_file(fs, args, 0, &file) != 0) {
+    edit_map = vfs_mmap(args, VFS_MAP_WRITE);
+    if (!edit_map) {
         printf("File not found: %s\n", args);
         return;
     }
-    buffer_pos = 0;
-    uint8_t buf[1024];
-    int bytes;
-    while ((bytes = rfss_read_file(&file, buf, sizeof(buf))) > 0) {
-        for (int i = 0; i < bytes && buffer_pos < sizeof(edit_buffer) - 1; i++) {
-            edit_buffer[buffer_pos++] = buf[i];
-        }
-    }
-    edit_buffer[buffer_pos] = '\0';
-    rfss_close_file(&file);
+    buffer_pos = edit_map->size;
     cursor_pos = buffer_pos;
+    gap_size = 0;
+    line_count = 1;
+    for (int i = 0; i < buffer_pos; i++) {
+        if (vfs_map_get(edit_map, i) == '\n') line_count++;
+    }
     redraw_edit();
     set_editmode(1);
 }
 
+int edit_save(void) {
+    int result = 0;
+    if (gap_size > 0 &&
+        (vfs_map_move(edit_map, cursor_pos, cursor_pos + gap_size, buffer_pos - cursor_pos) != 0 ||
+         vfs_map_resize(edit_map, buffer_pos) != 0)) {
+        result = -1;
+    }
+    if (vfs_munmap(edit_map) != 0) {
+        result = -1;
+    }
+    edit_map = NULL;
+    gap_size = 0;
+    return result;
+}
+
 int is_editmode()
 {
     return editmode;
@@ -75,64 +97,83 @@ void redraw_edit() {
     console_printf("Editing: %s\n", current_file);
     console_set_color(0xFFFFFF, 0x000000); // reset to white text on black bg
 
-    // Count lines and characters
-    int lines = 1;
-    for (int i = 0; i < buffer_pos; i++) {
-        if (edit_buffer[i] == '\n') lines++;
-    }
-    int chars = buffer_pos;
-
     // Display lines and characters
-    console_printf("Lines: %d, Characters: %d\n\n", lines, chars);
+    console_printf("Lines: %d, Characters: %d\n\n", line_count, buffer_pos);
 
-    // Print the file content
-    printf("%s", edit_buffer);
+    // Print the lines around the cursor
+    int start = cursor_pos;
+    int lines = 0;
+    while (start > 0 && cursor_pos - start < EDIT_WINDOW) {
+        if (edit_char_at(start - 1) == '\n' && ++lines > EDIT_LINES / 2) break;
+        start--;
+    }
+
+    char chunk[257];
+    int length = 0;
+    lines = 0;
+    for (int i = start; i < buffer_pos && i - cursor_pos < EDIT_WINDOW && lines < EDIT_LINES; i++) {
+        chunk[length] = edit_char_at(i);
+        if (chunk[length++] == '\n') lines++;
+        if (length == 256) {
+            chunk[length] = '\0';
+            printf("%s", chunk);
+            length = 0;
+        }
+    }
+    chunk[length] = '\0';
+    printf("%s", chunk);
 }
 
 void edit_move_cursor_left() {
-    if (cursor_pos > 0) cursor_pos--;
+    if (cursor_pos > 0) {
+        if (gap_size > 0) {
+            vfs_map_set(edit_map, cursor_pos - 1 + gap_size, vfs_map_get(edit_map, cursor_pos - 1));
+        }
+        cursor_pos--;
+    }
     redraw_edit();
 }
 
 void edit_move_cursor_right() {
-    if (cursor_pos < buffer_pos) cursor_pos++;
+    if (cursor_pos < buffer_pos) {
+        if (gap_size > 0) {
+            vfs_map_set(edit_map, cursor_pos, vfs_map_get(edit_map, cursor_pos + gap_size));
+        }
+        cursor_pos++;
+    }
     redraw_edit();
 }
 
+// Opens EDIT_GAP bytes at the cursor by moving the rest of the text up once
+static int edit_open_gap(void) {
+    if (vfs_map_resize(edit_map, buffer_pos + EDIT_GAP) != 0) {
+        return -1;
+    }
+    if (vfs_map_move(edit_map, cursor_pos + EDIT_GAP, cursor_pos, buffer_pos - cursor_pos) != 0) {
+        vfs_map_resize(edit_map, buffer_pos);
+        return -1;
+    }
+    gap_size = EDIT_GAP;
+    return 0;
+}
+
 void edit_input_char(char c)
 {
     if (c == '\b') {
         if (cursor_pos > 0) {
-            // delete at cursor_pos - 1
-            for (int i = cursor_pos - 1; i < buffer_pos - 1; i++) {
-                edit_buffer[i] = edit_buffer[i + 1];
-            }
+            // delete at cursor_pos - 1 by widening the gap over it
+            if (vfs_map_get(edit_map, cursor_pos - 1) == '\n') line_count--;
             buffer_pos--;
             cursor_pos--;
-            edit_buffer[buffer_pos] = '\0';
-        }
-    } else if (c == '\n') {
-        if (buffer_pos < sizeof(edit_buffer) - 1) {
-            // insert \n at cursor_pos
-            for (int i = buffer_pos; i > cursor_pos; i--) {
-                edit_buffer[i] = edit_buffer[i - 1];
-            }
-            edit_buffer[cursor_pos] = '\n';
-            buffer_pos++;
-            cursor_pos++;
-            edit_buffer[buffer_pos] = '\0';
-        }
-    } else {
-        if (buffer_pos < sizeof(edit_buffer) - 1) {
-            // insert c at cursor_pos
-            for (int i = buffer_pos; i > cursor_pos; i--) {
-                edit_buffer[i] = edit_buffer[i - 1];
-            }
-            edit_buffer[cursor_pos] = c;
-            buffer_pos++;
-            cursor_pos++;
-            edit_buffer[buffer_pos] = '\0';
+            gap_size++;
         }
+    } else if (gap_size > 0 || edit_open_gap() == 0) {
+        // insert c (or a newline) at cursor_pos
+        vfs_map_set(edit_map, cursor_pos, c);
+        if (c == '\n') line_count++;
+        buffer_pos++;
+        cursor_pos++;
+        gap_size--;
     }
     redraw_edit();
 }
@@ -9,10 +9,10 @@ void edit_input_char(char c);
 void redraw_edit();
 void edit_move_cursor_left();
 void edit_move_cursor_right();
+int edit_save(void);
 
 extern char current_file[];
 extern int buffer_pos;
-extern char edit_buffer[];
 extern int cursor_pos;
 
 
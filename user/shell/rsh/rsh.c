@@ -1,46 +1,42 @@
 #include "rsh.h"
 #include <stdio.h>
 #include <string.h>
-#include <../fs/rfss.h>
+#include <../fs/vfs.h>
 #include <../libc/syscall.h>
 #include <../libc/stdio.h>
 #include <../mm/memory.h>
 #include <../user/shell/commands.h>
 
-void execute_script(char* script, char** script_args, int arg_count);
+void execute_script(vfs_map_t* script, char** script_args, int arg_count);
 char* trim(char* str);
 int starts_with(char* str, char* prefix);
 
 void execute_rsh_script(const char* filename, char** script_args, int arg_count) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
-        printf("No filesystem mounted\n");
-        return;
-    }
-    rfss_file_t file;
-    if (rfss_open_file(fs, filename, 0, &file) != 0) {
+    // Mapped rather than read so scripts of any length run a line at a time
+    vfs_map_t* script = vfs_mmap(filename, VFS_MAP_READ);
+    if (!script) {
         printf("Cannot open file %s\n", filename);
         return;
     }
-    char buffer[4096];
-    int len = rfss_read_file(&file, (uint8_t*)buffer, sizeof(buffer) - 1);
-    buffer[len] = '\0';
-    rfss_close_file(&file);
-    execute_script(buffer, script_args, arg_count);
+    execute_script(script, script_args, arg_count);
+    vfs_munmap(script);
 }
 
-void execute_script(char* script, char** script_args, int arg_count) {
-    char* p = script;
+void execute_script(vfs_map_t* script, char** script_args, int arg_count) {
+    uint64_t offset = 0;
     int in_if = 0;
     int execute_if = 0;
-    while (*p) {
+    while (offset < script->size) {
         char line[256];
         int i = 0;
-        while (*p && *p != '\n' && i < 255) {
-            line[i++] = *p++;
+        int c;
+        while ((c = vfs_map_get(script, offset)) > 0 && c != '\n' && i < 255) {
+            line[i++] = c;
+            offset++;
         }
         line[i] = '\0';
-        if (*p == '\n') p++;
+        if (c == '\n') offset++;
+        if (c <= 0) offset = script->size;
         char* trimmed = trim(line);
         if (strcmp(trimmed, "if true") == 0) {
             in_if = 1;
@@ -7,8 +7,10 @@
 #include <field_map.h>
 #include <../drivers/keyboard/keyboard.h>
 #include "../drivers/ata.h"
+#include "../drivers/blkdev.h"
 #include <../cpu/ports.h>
 #include <../fs/rfss.h>
+#include <../fs/vfs.h>
 #include "../ui/desktop/desktop.h"
 #include <../libc/syscall.h>
 #include <../libc/stdio.h>
@@ -43,7 +45,12 @@ static void cmd_mv(const char* args);
 static void cmd_rm(const char* args);
 static void cmd_cat(const char* args);
 static void cmd_df(const char* args);
+static void cmd_sync(const char* args);
+static void cmd_journal(const char* args);
 static void cmd_fsck_rfss(const char* args);
+static void cmd_bench_rfss(const char* args);
+static void cmd_frag(const char* args);
+static void cmd_defrag(const char* args);
 static void cmd_lsdisk(const char* args);
 static void cmd_startx(const char* args);
 static void cmd_forktest(const char* args);
@@ -52,6 +59,9 @@ static void cmd_lsusb(const char* args);
 static void cmd_rsh(const char* args);
 static void cmd_credits(const char* args);
 
+static int parse_device(const char* name);
+static int shell_fs_mounted(void);
+static rfss_fs_t* shell_current_rfss(void);
 static uint32_t parse_ip(const char* str);
 static int is_ip_address(const char* str);
 static void cmd_ping(const char* args);
@@ -66,8 +76,8 @@ static const command_t commands[] = {
     {"reboot", "Reboot the system.", cmd_reboot, CMD_UNSAFE},
     {"lsdisk", "List available disk devices", cmd_lsdisk, CMD_SAFE},
     {"mkfs.rfss", "Format disk with Rfss+ filesystem", cmd_mkfs_rfss, CMD_UNSAFE},
-    {"mount", "Mount Rfss+ filesystem", cmd_mount, CMD_UNSAFE},
-    {"umount", "Unmount Rfss+ filesystem", cmd_umount, CMD_UNSAFE},
+    {"mount", "Mount a filesystem (mount <device|tmpfs> [path])", cmd_mount, CMD_UNSAFE},
+    {"umount", "Unmount a filesystem (umount [path])", cmd_umount, CMD_UNSAFE},
     {"ls", "List directory contents", cmd_ls, CMD_SAFE},
     {"cd", "Change directory", cmd_cd, CMD_SAFE},
     {"mkdir", "Create directory", cmd_mkdir, CMD_SAFE},
@@ -78,7 +88,12 @@ static const command_t commands[] = {
     {"rm", "Remove files", cmd_rm, CMD_SAFE},
     {"cat", "Display file contents", cmd_cat, CMD_SAFE},
     {"df", "Show filesystem usage", cmd_df, CMD_SAFE},
+    {"sync", "Write cached filesystem changes to disk", cmd_sync, CMD_SAFE},
+    {"journal", "Turn filesystem journaling on or off", cmd_journal, CMD_UNSAFE},
     {"fsck.rfss", "Check filesystem consistency", cmd_fsck_rfss, CMD_MAINTENANCE},
+    {"bench.rfss", "Benchmark block allocation (default 100000 blocks)", cmd_bench_rfss, CMD_MAINTENANCE},
+    {"frag", "Show fragmentation of files and the volume (frag [path])", cmd_frag, CMD_SAFE},
+    {"defrag", "Defragment the volume now, or in the background (defrag [on|off])", cmd_defrag, CMD_MAINTENANCE},
     {"startx", "Start the desktop environment", cmd_startx, CMD_SAFE},
     {"forktest", "Test fork syscall", cmd_forktest, CMD_SAFE},
     {"exit", "Exit the application", cmd_exit, CMD_SAFE},
@@ -210,9 +225,8 @@ void shell_display_prompt(void) {
     console_set_color(0x00FFFFFF, 0x00000000);
     printf(" ]");
 
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (fs && fs->mounted) {
-        printf(" [%s]", fs->current_path);
+    if (shell_fs_mounted()) {
+        printf(" [%s]", vfs_getcwd());
     } else {
         printf(" [~]");
     }
@@ -385,15 +399,21 @@ static void cmd_mkfs_rfss(const char* args) {
     }
     label[i] = '\0';
 
-    if (strcmp(device_str, "hda") == 0) {
-        device_id = 0;
-    } else {
+    device_id = parse_device(device_str);
+    if (device_id < 0) {
         printf("Unsupported device: %s\n", device_str);
         kfree(device_str);
         kfree(label);
         return;
     }
 
+    if (rfss_get_mount(device_id)) {
+        printf("Device %s is mounted\n", device_str);
+        kfree(device_str);
+        kfree(label);
+        return;
+    }
+
     if (!ata_drive_exists(device_id)) {
         printf("Device %s not found\n", device_str);
         kfree(device_str);
@@ -413,7 +433,12 @@ static void cmd_mkfs_rfss(const char* args) {
 
 static void cmd_mount(const char* args) {
     if (!args || !*args) {
-        printf("Usage: mount <device>\n");
+        for (int i = 0; i < VFS_MAX_MOUNTS; i++) {
+            vfs_mount_t* mount = vfs_get_mount(i);
+            if (mount) {
+                printf("%s on %s\n", mount->ops->name, mount->path);
+            }
+        }
         return;
     }
 
@@ -422,7 +447,6 @@ static void cmd_mount(const char* args) {
         printf("Memory allocation failed\n");
         return;
     }
-    int device_id = 0;
 
     const char* p = args;
     int i = 0;
@@ -430,10 +454,21 @@ static void cmd_mount(const char* args) {
         device_str[i++] = *p++;
     }
     device_str[i] = '\0';
+    if (*p == ' ') p++;
 
-    if (strcmp(device_str, "hda") == 0) {
-        device_id = 0;
-    } else {
+    if (strcmp(device_str, "tmpfs") == 0) {
+        if (tmpfs_mount(*p ? p : "/tmp") == 0) {
+            printf("Filesystem mounted successfully\n");
+        } else {
+            printf("Failed to mount filesystem\n");
+        }
+        kfree(device_str);
+        return;
+    }
+
+    const char* path = *p ? p : "/";
+    int device_id = parse_device(device_str);
+    if (device_id < 0) {
         printf("Unsupported device: %s\n", device_str);
         kfree(device_str);
         return;
@@ -445,10 +480,8 @@ static void cmd_mount(const char* args) {
         return;
     }
 
-    static rfss_fs_t filesystem;
-    if (rfss_mount(device_id, &filesystem) == 0) {
+    if (rfss_vfs_mount(device_id, path) == 0) {
         printf("Filesystem mounted successfully\n");
-        rfss_journal_replay(&filesystem);
     } else {
         printf("Failed to mount filesystem\n");
     }
@@ -456,22 +489,29 @@ static void cmd_mount(const char* args) {
 }
 
 static void cmd_umount(const char* args) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
+    const char* path = args && *args ? args : "/";
+    if (!shell_fs_mounted()) {
         printf("No filesystem mounted\n");
         return;
     }
     
-    if (rfss_unmount(fs) == 0) {
+    if (vfs_unmount(path) == 0) {
         printf("Filesystem unmounted successfully\n");
     } else {
         printf("Failed to unmount filesystem\n");
     }
 }
 
+static int ls_print_entry(void* ctx __attribute__((unused)), const char* name, uint32_t type __attribute__((unused))) {
+    for (int j = 0; name[j]; j++) {
+        putchar(name[j] < 32 || name[j] > 126 ? '?' : name[j]);
+    }
+    putchar(' ');
+    return 0;
+}
+
 static void cmd_ls(const char* args) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
+    if (!shell_fs_mounted()) {
         printf("No filesystem mounted\n");
         return;
     }
@@ -481,51 +521,15 @@ static void cmd_ls(const char* args) {
         return;
     }
 
-    rfss_dir_entry_t* entries;
-    int count;
-
-    if (rfss_list_directory(fs, args, &entries, &count) != 0) {
+    if (vfs_readdir(args, ls_print_entry, NULL) != 0) {
         printf("Failed to list directory\n");
         return;
     }
-    
-    if (count == 0) {
-        printf("\n");
-        return;
-    }
-    
-    for (int i = 0; i < count; i++) {
-        if (entries[i].name_len == 1 && entries[i].name[0] == '.') {
-            continue;
-        }
-        if (entries[i].name_len == 2 && entries[i].name[0] == '.' && entries[i].name[1] == '.') {
-            continue;
-        }
-        
-        if (entries[i].name_len > 0 && entries[i].name_len < RFSS_MAX_FILENAME) {
-            char filename[RFSS_MAX_FILENAME + 1];
-            memset(filename, 0, sizeof(filename));
-            memcpy(filename, entries[i].name, entries[i].name_len);
-            filename[entries[i].name_len] = '\0';
-            
-            int j;
-            for (j = 0; j < entries[i].name_len; j++) {
-                if (filename[j] < 32 || filename[j] > 126) {
-                    filename[j] = '?';
-                }
-            }
-            
-            printf("%s ", filename);
-        }
-    }
     printf("\n");
-    if (entries) kfree(entries);
-    
 }
 
 static void cmd_cd(const char* args) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
+    if (!shell_fs_mounted()) {
         printf("No filesystem mounted\n");
         return;
     }
@@ -539,39 +543,13 @@ static void cmd_cd(const char* args) {
         return;
     }
 
-    char new_path[256];
-    if (strcmp(args, "..") == 0) {
-        if (strcmp(fs->current_path, "/") == 0) {
-            return; // already root
-        } else {
-            strcpy(new_path, fs->current_path);
-            char* last = strrchr(new_path, '/');
-            if (last == new_path) {
-                strcpy(new_path, "/");
-            } else {
-                *last = '\0';
-            }
-        }
-    } else if (args[0] == '/') {
-        strcpy(new_path, args);
-    } else {
-        strcpy(new_path, fs->current_path);
-        if (strcmp(new_path, "/") != 0) {
-            strncat(new_path, "/", sizeof(new_path) - strlen(new_path) - 1);
-        }
-        strncat(new_path, args, sizeof(new_path) - strlen(new_path) - 1);
-    }
-
-    if (rfss_change_directory(fs, new_path) != 0) {
+    if (vfs_chdir(args) != 0) {
         printf("cd: %s: No such directory\n", args);
-    } else {
-        strcpy(fs->current_path, new_path);
     }
 }
 
 static void cmd_mkdir(const char* args) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
+    if (!shell_fs_mounted()) {
         printf("No filesystem mounted\n");
         return;
     }
@@ -586,12 +564,11 @@ static void cmd_mkdir(const char* args) {
         return;
     }
 
-    if(rfss_create_directory(fs, args) != 0) printf("mkdir: failed to create '%s'\n", args);
+    if (vfs_mkdir(args) != 0) printf("mkdir: failed to create '%s'\n", args);
 }
 
 static void cmd_rmdir(const char* args) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
+    if (!shell_fs_mounted()) {
         printf("No filesystem mounted\n");
         return;
     }
@@ -606,13 +583,12 @@ static void cmd_rmdir(const char* args) {
         return;
     }
 
-    if (rfss_remove_directory(fs, args) != 0) printf("rmdir: failed to remove '%s'\n", args);
+    if (vfs_rmdir(args) != 0) printf("rmdir: failed to remove '%s'\n", args);
 
 }
 
 static void cmd_touch(const char* args) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
+    if (!shell_fs_mounted()) {
         printf("No filesystem mounted\n");
         return;
     }
@@ -627,14 +603,13 @@ static void cmd_touch(const char* args) {
         return;
     }
 
-    if (rfss_create_file(fs, args, 0644) != 0) {
+    if (vfs_create(args, 0644) != 0) {
         printf("touch: cannot create '%s'\n", args);
     }
 }
 
 static void cmd_cp(const char* args) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
+    if (!shell_fs_mounted()) {
         printf("No filesystem mounted\n");
         return;
     }
@@ -690,35 +665,31 @@ static void cmd_cp(const char* args) {
         return;
     }
     
-    rfss_file_t src_file, dst_file;
-    if (rfss_open_file(fs, source, 0, &src_file) != 0) {
+    vfs_file_t src_file, dst_file;
+    vfs_stat_t st;
+    if (vfs_stat(source, &st) != 0 || st.type != VFS_TYPE_FILE || vfs_open(source, VFS_O_READ, &src_file) != 0) {
         printf("cp: cannot open '%s'\n", source);
         return;
     }
     
-    if (rfss_create_file(fs, dest, 0644) != 0) {
+    if (vfs_create(dest, 0644) != 0) {
         printf("cp: cannot create '%s'\n", dest);
-        rfss_close_file(&src_file);
+        vfs_close(&src_file);
         return;
     }
     
-    if (rfss_open_file(fs, dest, 1, &dst_file) != 0) {
+    if (vfs_open(dest, VFS_O_TRUNC, &dst_file) != 0) {
         printf("cp: cannot open '%s' for writing\n", dest);
-        rfss_close_file(&src_file);
+        vfs_close(&src_file);
         return;
     }
     
-    uint8_t buffer[1024];
-    int bytes_read;
-    while ((bytes_read = rfss_read_file(&src_file, buffer, sizeof(buffer))) > 0) {
-        if (rfss_write_file(&dst_file, buffer, bytes_read) != bytes_read) {
-            printf("cp: write error\n");
-            break;
-        }
+    if (st.size > 0 && vfs_copy_file_range(&src_file, &dst_file, st.size) != (int)st.size) {
+        printf("cp: write error\n");
     }
     
-    rfss_close_file(&src_file);
-    rfss_close_file(&dst_file);
+    vfs_close(&src_file);
+    vfs_close(&dst_file);
     kfree(source);
     kfree(dest);
 }
@@ -775,14 +746,18 @@ static void cmd_mv(const char* args) {
         return;
     }
 
-    printf("mv: not implemented yet\n");
+    if (!shell_fs_mounted()) {
+        printf("No filesystem mounted\n");
+    } else if (vfs_rename(source, dest) != 0) {
+        printf("mv: cannot move '%s' to '%s'\n", source, dest);
+    }
+
     kfree(source);
     kfree(dest);
 }
 
 static void cmd_rm(const char* args) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
+    if (!shell_fs_mounted()) {
         printf("No filesystem mounted\n");
         return;
     }
@@ -797,14 +772,13 @@ static void cmd_rm(const char* args) {
         return;
     }
 
-    if (rfss_delete_file(fs, args) != 0) {
+    if (vfs_unlink(args) != 0) {
         printf("rm: cannot remove '%s'\n", args);
     }
 }
 
 static void cmd_cat(const char* args) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
+    if (!shell_fs_mounted()) {
         printf("No filesystem mounted\n");
         return;
     }
@@ -819,67 +793,295 @@ static void cmd_cat(const char* args) {
         return;
     }
 
-    rfss_file_t file;
-    if (rfss_open_file(fs, args, 0, &file) != 0) {
+    vfs_file_t file;
+    if (vfs_open(args, VFS_O_READ, &file) != 0) {
         printf("cat: cannot open '%s'\n", args);
         return;
     }
 
     uint8_t buffer[1024];
     int bytes_read;
-    while ((bytes_read = rfss_read_file(&file, buffer, sizeof(buffer))) > 0) {
+    while ((bytes_read = vfs_read(&file, buffer, sizeof(buffer))) > 0) {
         for (int i = 0; i < bytes_read; i++) {
             putchar(buffer[i]);
         }
     }
 
-    rfss_close_file(&file);
+    vfs_close(&file);
     putchar('\n');
 }
 
-static void cmd_df(const char* args) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
+static void cmd_df(const char* args __attribute__((unused))) {
+    if (!shell_fs_mounted()) {
         printf("No filesystem mounted\n");
         return;
     }
     
-    uint32_t total_blocks, free_blocks, total_inodes, free_inodes;
-    if (rfss_get_stats(fs, &total_blocks, &free_blocks, &total_inodes, &free_inodes) != 0) {
-        printf("Failed to get filesystem statistics\n");
+    for (int m = 0; m < VFS_MAX_MOUNTS; m++) {
+        vfs_mount_t* mount = vfs_get_mount(m);
+        if (mount && mount->ops == &tmpfs_vfs_ops) {
+            uint32_t used_pages, free_pages, used_nodes;
+            tmpfs_get_stats(mount->fs, &used_pages, &free_pages, &used_nodes);
+            printf("Filesystem statistics for %s (tmpfs):\n", mount->path);
+            printf("Memory: %d KB used, %d KB free in shared pool\n",
+                   (used_pages * TMPFS_PAGE_SIZE) / 1024, (free_pages * TMPFS_PAGE_SIZE) / 1024);
+            printf("Nodes: %d used of %d\n", used_nodes, TMPFS_MAX_NODES);
+            continue;
+        }
+        if (!mount || mount->ops != &rfss_vfs_ops) {
+            continue;
+        }
+
+        uint32_t total_blocks, free_blocks, total_inodes, free_inodes;
+        if (rfss_get_stats(mount->fs, &total_blocks, &free_blocks, &total_inodes, &free_inodes) != 0) {
+            printf("Failed to get filesystem statistics for %s\n", mount->path);
+            continue;
+        }
+        
+        uint32_t used_blocks = total_blocks - free_blocks;
+        uint32_t used_inodes = total_inodes - free_inodes;
+        
+        printf("Filesystem statistics for %s:\n", mount->path);
+        printf("Blocks: %d total, %d used, %d free (%d%% used)\n",
+               total_blocks, used_blocks, free_blocks,
+               total_blocks > 0 ? (used_blocks * 100) / total_blocks : 0);
+        printf("Inodes: %d total, %d used, %d free (%d%% used)\n",
+               total_inodes, used_inodes, free_inodes,
+               total_inodes > 0 ? (used_inodes * 100) / total_inodes : 0);
+        printf("Block size: %d bytes\n", RFSS_BLOCK_SIZE);
+        printf("Total size: %d KB\n", (total_blocks * RFSS_BLOCK_SIZE) / 1024);
+        printf("Free space: %d KB\n", (free_blocks * RFSS_BLOCK_SIZE) / 1024);
+    }
+
+    rfss_cache_stats_t cache;
+    rfss_cache_get_stats(&cache);
+    uint32_t lookups = cache.hits + cache.misses;
+    printf("Block cache: %d/%d blocks used, %d dirty\n", cache.used, cache.size, cache.dirty);
+    printf("Cache hits: %u, misses: %u (%d%% hit rate)\n",
+           cache.hits, cache.misses,
+           lookups > 0 ? (uint32_t)(((uint64_t)cache.hits * 100) / lookups) : 0);
+    printf("Cache evictions: %u, write-backs: %u, read ahead: %u\n",
+           cache.evictions, cache.writebacks, cache.readahead);
+
+    rfss_dcache_stats_t dcache;
+    rfss_dcache_get_stats(&dcache);
+    lookups = dcache.hits + dcache.misses;
+    printf("Lookup cache: %d/%d names, %u hits (%u negative), %u misses (%d%% hit rate)\n",
+           dcache.used, dcache.size, dcache.hits, dcache.negative_hits, dcache.misses,
+           lookups > 0 ? (uint32_t)(((uint64_t)dcache.hits * 100) / lookups) : 0);
+
+    blk_stats_t queue;
+    blk_get_stats(&queue);
+    printf("Block queue: %u requests, %u merged, %u commands issued\n",
+           queue.submitted, queue.merged, queue.dispatched);
+}
+
+static void cmd_sync(const char* args __attribute__((unused))) {
+    if (!shell_fs_mounted()) {
+        printf("No filesystem mounted\n");
         return;
     }
-    
-    uint32_t used_blocks = total_blocks - free_blocks;
-    uint32_t used_inodes = total_inodes - free_inodes;
-    
-    printf("Filesystem statistics:\n");
-    printf("Blocks: %d total, %d used, %d free (%d%% used)\n",
-           total_blocks, used_blocks, free_blocks,
-           total_blocks > 0 ? (used_blocks * 100) / total_blocks : 0);
-    printf("Inodes: %d total, %d used, %d free (%d%% used)\n",
-           total_inodes, used_inodes, free_inodes,
-           total_inodes > 0 ? (used_inodes * 100) / total_inodes : 0);
-    printf("Block size: %d bytes\n", RFSS_BLOCK_SIZE);
-    printf("Total size: %d KB\n", (total_blocks * RFSS_BLOCK_SIZE) / 1024);
-    printf("Free space: %d KB\n", (free_blocks * RFSS_BLOCK_SIZE) / 1024);
+
+    if (vfs_sync() != 0) {
+        printf("sync: failed to write back filesystem\n");
+    }
+}
+
+static void cmd_journal(const char* args) {
+    rfss_fs_t* fs = shell_current_rfss();
+    if (!fs) {
+        printf("No Rfss+ filesystem mounted here\n");
+        return;
+    }
+
+    if (!args || !*args) {
+        printf("Journaling is %s\n", fs->journaling_enabled ? "on" : "off");
+        return;
+    }
+
+    int result;
+    if (strcmp(args, "on") == 0) {
+        result = rfss_enable_journaling(fs);
+    } else if (strcmp(args, "off") == 0) {
+        result = rfss_disable_journaling(fs);
+    } else {
+        printf("Usage: journal [on|off]\n");
+        return;
+    }
+
+    if (result != 0) {
+        printf("journal: failed to switch journaling %s\n", args);
+    }
 }
 
 static void cmd_fsck_rfss(const char* args __attribute__((unused))) {
-    rfss_fs_t* fs = rfss_get_mounted_fs();
-    if (!fs || !fs->mounted) {
-        printf("No filesystem mounted\n");
+    rfss_fs_t* fs = shell_current_rfss();
+    if (!fs) {
+        printf("No Rfss+ filesystem mounted here\n");
         return;
     }
 
     printf("Checking filesystem consistency...\n");
-    if (rfss_check_filesystem(fs) == 0) {
+    rfss_fsck_report_t report;
+    int result = rfss_fsck(fs, &report);
+
+    for (int i = 0; i < RFSS_FSCK_PASSES; i++) {
+        printf("  %s: %d errors, %d kcycles\n", rfss_fsck_pass_names[i], report.errors[i],
+               (uint32_t)(report.cycles[i] / 1000));
+    }
+    printf("%d inodes, %d directories, %d blocks in use, %d reads\n",
+           report.inodes, report.directories, report.blocks, report.reads);
+
+    if (result == 0) {
         printf("Filesystem is clean\n");
+    } else if (report.total_errors == 0) {
+        printf("fsck.rfss: can't check this filesystem\n");
     } else {
-        printf("Filesystem has errors\n");
+        printf("Filesystem has %d errors\n", report.total_errors);
     }
 }
 
+static void cmd_bench_rfss(const char* args) {
+    rfss_fs_t* fs = shell_current_rfss();
+    if (!fs) {
+        printf("No Rfss+ filesystem mounted here\n");
+        return;
+    }
+
+    uint32_t operations = 0;
+    while (args && *args >= '0' && *args <= '9') {
+        operations = operations * 10 + (*args++ - '0');
+    }
+    if (operations == 0) {
+        operations = 100000;
+    }
+
+    rfss_alloc_bench_t bench;
+    if (rfss_alloc_benchmark(fs, operations, &bench) != 0) {
+        printf("Benchmark failed\n");
+        return;
+    }
+
+    printf("Allocated %u blocks, freed %u\n", bench.allocs, bench.frees);
+    if (bench.allocs > 0) {
+        printf("Allocate: %llu cycles/block\n", bench.alloc_cycles / bench.allocs);
+    }
+    if (bench.frees > 0) {
+        printf("Free: %llu cycles/block\n", bench.free_cycles / bench.frees);
+    }
+}
+
+typedef struct {
+    rfss_fs_t* fs;
+    const char* dir;
+} frag_ctx_t;
+
+static void frag_print_file(rfss_fs_t* fs, const char* name, const char* path) {
+    rfss_inode_t* inode = rfss_get_inode(fs, rfss_resolve_path(fs, path));
+    if (!inode || ((inode->mode >> 12) & 0xF) != RFSS_FILE_REGULAR) {
+        return;
+    }
+
+    if (inode->flags & RFSS_INODE_FLAG_INLINE) {
+        printf("%s: %d bytes inline\n", name, (uint32_t)inode->size);
+        return;
+    }
+
+    uint32_t runs = rfss_file_runs(fs, inode);
+    printf("%s: %d blocks in %d runs, score %d%%\n", name, inode->blocks_count, runs,
+           rfss_frag_score(runs, inode->blocks_count));
+}
+
+static int frag_print_entry(void* ctx, const char* name, uint32_t type) {
+    frag_ctx_t* frag = ctx;
+    if (type != VFS_TYPE_FILE) {
+        return 0;
+    }
+
+    char path[VFS_PATH_MAX];
+    if (strlen(frag->dir) + strlen(name) + 2 > sizeof(path)) {
+        return 0;
+    }
+    strcpy(path, frag->dir);
+    if (path[strlen(path) - 1] != '/') {
+        strcat(path, "/");
+    }
+    strcat(path, name);
+
+    frag_print_file(frag->fs, name, path);
+    return 0;
+}
+
+static void cmd_frag(const char* args) {
+    char full[VFS_PATH_MAX];
+    char rest[VFS_PATH_MAX];
+    if (vfs_normalize_path(args && *args ? args : ".", full) != 0) {
+        printf("Invalid path\n");
+        return;
+    }
+
+    vfs_mount_t* mount = vfs_find_mount(full, rest);
+    if (!mount || mount->ops != &rfss_vfs_ops) {
+        printf("No Rfss+ filesystem mounted here\n");
+        return;
+    }
+
+    // Scores only mean something once buffered data has its blocks
+    rfss_fs_t* fs = mount->fs;
+    rfss_sync(fs);
+
+    vfs_stat_t st;
+    if (vfs_stat(full, &st) != 0) {
+        printf("frag: %s not found\n", full);
+        return;
+    }
+    if (st.type == VFS_TYPE_FILE) {
+        frag_print_file(fs, full, rest);
+        return;
+    }
+
+    frag_ctx_t ctx = { fs, rest };
+    vfs_readdir(full, frag_print_entry, &ctx);
+
+    rfss_frag_stats_t stats;
+    if (rfss_frag_stats(fs, &stats) != 0) {
+        return;
+    }
+    printf("Volume: %d files, %d fragmented, score %d%%\n", stats.files, stats.fragmented,
+           stats.joins ? stats.breaks * 100 / stats.joins : 0);
+    printf("Free space: %d blocks in %d runs, largest %d, score %d%%\n", stats.free_blocks, stats.free_runs,
+           stats.largest_free, rfss_frag_score(stats.free_runs, stats.free_blocks));
+}
+
+static void cmd_defrag(const char* args) {
+    rfss_fs_t* fs = shell_current_rfss();
+    if (!fs) {
+        printf("No Rfss+ filesystem mounted here\n");
+        return;
+    }
+
+    if (args && strcmp(args, "on") == 0) {
+        fs->defrag_enabled = 1;
+        return;
+    }
+    if (args && strcmp(args, "off") == 0) {
+        fs->defrag_enabled = 0;
+        return;
+    }
+    if (args && *args) {
+        printf("Usage: defrag [on|off]\n");
+        return;
+    }
+
+    uint32_t files = 0;
+    int blocks = rfss_defrag(fs, &files);
+    if (blocks < 0 || rfss_sync(fs) != 0) {
+        printf("defrag: failed\n");
+        return;
+    }
+    printf("Moved %d blocks in %d file moves\n", blocks, files);
+}
+
 void shell_input_char(char c) {
     if (is_editmode()) {
         edit_input_char(c);
@@ -922,17 +1124,7 @@ void shell_input_char(char c) {
 void shell_special_key(uint8_t scancode) {
     if (is_editmode() && scancode == 0x01) { // ESC
         // save file
-        int saved = 0;
-        rfss_fs_t* fs = rfss_get_mounted_fs();
-        if (fs && fs->mounted) {
-            rfss_file_t file;
-            if (rfss_open_file(fs, current_file, 1, &file) == 0) {
-                if (rfss_write_file(&file, (uint8_t*)edit_buffer, buffer_pos) == buffer_pos) {
-                    saved = 1;
-                }
-                rfss_close_file(&file);
-            }
-        }
+        int saved = edit_save() == 0;
         console_clear();
         if (saved) {
             printf("File saved successfully.\n");
@@ -1038,6 +1230,24 @@ static void cmd_lsusb(const char* args __attribute__((unused))) {
     }
 }
 
+// hda..hdd name the four ATA devices
+static int parse_device(const char* name) {
+    if (strlen(name) == 3 && name[0] == 'h' && name[1] == 'd' && name[2] >= 'a' && name[2] <= 'd') {
+        return name[2] - 'a';
+    }
+    return -1;
+}
+
+static int shell_fs_mounted(void) {
+    return vfs_find_mount(vfs_getcwd(), NULL) != NULL;
+}
+
+// RFSS volume holding the working directory, for the commands that only apply to RFSS
+static rfss_fs_t* shell_current_rfss(void) {
+    vfs_mount_t* mount = vfs_find_mount(vfs_getcwd(), NULL);
+    return mount && mount->ops == &rfss_vfs_ops ? mount->fs : NULL;
+}
+
 static uint32_t parse_ip(const char* str) {
     uint32_t ip = 0;
     int octet = 0;